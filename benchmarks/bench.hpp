@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace gnunetpp::bench
+{
+/**
+ * @brief A microbenchmark. `fn` is called with the number of iterations to run
+ * and must run the measured operation exactly that many times
+ */
+struct Benchmark
+{
+    std::string name;
+    size_t iterations;
+    std::function<void(size_t)> fn;
+};
+
+std::vector<Benchmark>& registry();
+
+/**
+ * @brief Number of calls to operator new so far, on all threads
+ */
+size_t allocationCount();
+
+struct Registrar
+{
+    Registrar(std::string name, size_t iterations, std::function<void(size_t)> fn)
+    {
+        registry().push_back({std::move(name), iterations, std::move(fn)});
+    }
+};
+
+// Keeps the compiler from optimizing away values we compute but never use
+template <typename T>
+inline void doNotOptimize(const T& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+}
+
+#define GNUNETPP_BENCH_CONCAT_IMPL(a, b) a##b
+#define GNUNETPP_BENCH_CONCAT(a, b) GNUNETPP_BENCH_CONCAT_IMPL(a, b)
+/**
+ * @brief Registers a benchmark. The body has access to `iterations`
+ */
+#define GNUNETPP_BENCHMARK(name, num_iterations) \
+static void GNUNETPP_BENCH_CONCAT(bench_fn_, __LINE__)(size_t iterations); \
+static gnunetpp::bench::Registrar GNUNETPP_BENCH_CONCAT(bench_registrar_, __LINE__)(name, num_iterations, \
+    GNUNETPP_BENCH_CONCAT(bench_fn_, __LINE__)); \
+static void GNUNETPP_BENCH_CONCAT(bench_fn_, __LINE__)(size_t iterations)
@@ -0,0 +1,161 @@
+#include "bench.hpp"
+
+#include "inner/coroutine.hpp"
+
+#include <string>
+
+using namespace gnunetpp;
+using gnunetpp::bench::doNotOptimize;
+
+// Build with -DGNUNETPP_FRAME_POOL=OFF to compare against plain heap allocated frames
+
+namespace
+{
+Task<int> value(int i)
+{
+    co_return i;
+}
+
+Task<std::string> text(int i)
+{
+    co_return std::string(32, 'a' + i % 26);
+}
+
+Task<int> nested(int depth)
+{
+    if(depth == 0)
+        co_return 1;
+    co_return co_await nested(depth - 1) + 1;
+}
+
+async_generator<int> numbers(size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+        co_yield static_cast<int>(i);
+}
+
+template <typename Fn>
+void runSync(Fn&& fn)
+{
+    async_run([&]() -> Task<> {
+        co_await fn();
+    });
+}
+
+// How GeneratorWrapper iterated before its iterator awaited the queue directly. Every
+// step ran two Tasks and copied the element into the caller's iterator. Kept as a baseline
+template <typename T>
+struct TaskIterator
+{
+    static Task<TaskIterator> next(QueuedAwaiter<T>& queue)
+    {
+        auto value = co_await queue;
+        co_return TaskIterator{std::move(value), &queue};
+    }
+
+    Task<TaskIterator> operator++()
+    {
+        *this = co_await next(*queue);
+        co_return *this;
+    }
+
+    std::optional<T> value;
+    QueuedAwaiter<T>* queue;
+};
+
+// Feeds `iterations` elements to a consumer that is already suspended on the generator,
+// so every element goes through a suspend and resume like results arriving from GNUnet
+template <typename T, typename Consume>
+void streamTo(size_t iterations, Consume consume)
+{
+    auto awaiter = std::make_unique<QueuedAwaiter<T>>();
+    auto queue = awaiter.get();
+    GeneratorWrapper<T> gen(std::move(awaiter), [] {});
+    async_run([&]() -> Task<> {
+        co_await consume(gen);
+    });
+    for(size_t i = 0; i < iterations; i++)
+        queue->addValue(T(32, 'a' + i % 26));
+    queue->finish();
+}
+}
+
+GNUNETPP_BENCHMARK("coroutine/Task<int> create and await", 1000000)
+{
+    runSync([&]() -> Task<> {
+        int sum = 0;
+        for(size_t i = 0; i < iterations; i++)
+            sum += co_await value(i);
+        doNotOptimize(sum);
+    });
+}
+
+GNUNETPP_BENCHMARK("coroutine/Task<std::string> create and await", 1000000)
+{
+    runSync([&]() -> Task<> {
+        for(size_t i = 0; i < iterations; i++)
+            doNotOptimize(co_await text(i));
+    });
+}
+
+GNUNETPP_BENCHMARK("coroutine/Task nested 8 deep", 100000)
+{
+    runSync([&]() -> Task<> {
+        for(size_t i = 0; i < iterations; i++)
+            doNotOptimize(co_await nested(8));
+    });
+}
+
+// Starting a coroutine that completes right away, ie. the fixed cost of async_run()
+GNUNETPP_BENCHMARK("coroutine/async_run", 1000000)
+{
+    for(size_t i = 0; i < iterations; i++)
+        async_run([]() -> Task<> { co_return; });
+}
+
+GNUNETPP_BENCHMARK("coroutine/async_generator per element", 1000000)
+{
+    runSync([&]() -> Task<> {
+        int sum = 0;
+        auto gen = numbers(iterations);
+        for(auto it = co_await gen.begin(); it != gen.end(); co_await ++it)
+            sum += *it;
+        doNotOptimize(sum);
+    });
+}
+
+GNUNETPP_BENCHMARK("coroutine/GeneratorWrapper per element", 1000000)
+{
+    auto awaiter = std::make_unique<QueuedAwaiter<int>>();
+    auto queue = awaiter.get();
+    GeneratorWrapper<int> gen(std::move(awaiter), [] {});
+    for(size_t i = 0; i < iterations; i++)
+        queue->addValue(static_cast<int>(i));
+    queue->finish();
+    runSync([&]() -> Task<> {
+        int sum = 0;
+        for(auto it = co_await gen.begin(); it != gen.end(); co_await ++it)
+            sum += *it;
+        doNotOptimize(sum);
+    });
+}
+
+GNUNETPP_BENCHMARK("coroutine/GeneratorWrapper<std::string> streamed", 1000000)
+{
+    streamTo<std::string>(iterations, [](GeneratorWrapper<std::string>& gen) -> Task<> {
+        size_t size = 0;
+        for(auto it = co_await gen.begin(); it != gen.end(); co_await ++it)
+            size += it->size();
+        doNotOptimize(size);
+    });
+}
+
+GNUNETPP_BENCHMARK("coroutine/Task per element baseline streamed", 1000000)
+{
+    streamTo<std::string>(iterations, [](GeneratorWrapper<std::string>& gen) -> Task<> {
+        size_t size = 0;
+        for(auto it = co_await TaskIterator<std::string>::next(*gen.awaiter); it.value; co_await ++it)
+            size += it.value->size();
+        doNotOptimize(size);
+    });
+}
@@ -0,0 +1,96 @@
+#include "bench.hpp"
+
+#include "inner/Function.hpp"
+#include "inner/MPSCQueue.hpp"
+
+#include <coroutine>
+#include <memory>
+#include <string>
+
+using namespace gnunetpp::detail;
+using gnunetpp::bench::doNotOptimize;
+
+namespace
+{
+struct Service {};
+
+// What the service callbacks typically capture: an object, a coroutine handle and a
+// pointer to the awaiter. 24 bytes, too big for the inline buffer of libstdc++'s
+// std::function
+template <typename Fn>
+void storeAndCall(size_t iterations)
+{
+    Service service;
+    int counter = 0;
+    for(size_t i = 0; i < iterations; i++) {
+        Fn fn = [&service, &counter, handle = std::coroutine_handle<>()] {
+            doNotOptimize(service);
+            doNotOptimize(handle);
+            counter++;
+        };
+        Fn moved = std::move(fn);
+        moved();
+    }
+    doNotOptimize(counter);
+}
+
+// Callback stored in a heap pack, as DHT::get and GNS::lookup do
+template <typename Fn>
+void heapPack(size_t iterations)
+{
+    struct Pack
+    {
+        Fn cb;
+        void* handle;
+    };
+    std::string name = "gnunet.org";
+    for(size_t i = 0; i < iterations; i++) {
+        auto pack = new Pack{[name_size = name.size(), &name, i] { doNotOptimize(name_size + i + name.size()); }, nullptr};
+        pack->cb();
+        delete pack;
+    }
+}
+
+// scheduler::queue() from the GNUnet thread
+template <typename Fn>
+void postAndDrain(size_t iterations)
+{
+    MPSCQueue<Fn> inbox;
+    int counter = 0;
+    for(size_t i = 0; i < iterations; i++) {
+        inbox.push([&counter, i, ptr = &inbox] { counter += i; doNotOptimize(ptr); });
+        inbox.drain([](Fn& fn) { fn(); });
+    }
+    doNotOptimize(counter);
+}
+}
+
+GNUNETPP_BENCHMARK("std::function/store and call", 1000000)
+{
+    storeAndCall<std::function<void()>>(iterations);
+}
+
+GNUNETPP_BENCHMARK("Function/store and call", 1000000)
+{
+    storeAndCall<gnunetpp::Function<void()>>(iterations);
+}
+
+GNUNETPP_BENCHMARK("std::function/callback pack", 1000000)
+{
+    heapPack<std::function<void()>>(iterations);
+}
+
+GNUNETPP_BENCHMARK("Function/callback pack", 1000000)
+{
+    heapPack<gnunetpp::Function<void()>>(iterations);
+}
+
+GNUNETPP_BENCHMARK("std::function/queue", 1000000)
+{
+    postAndDrain<std::function<void()>>(iterations);
+}
+
+GNUNETPP_BENCHMARK("Function/queue", 1000000)
+{
+    postAndDrain<gnunetpp::Function<void()>>(iterations);
+}
@@ -0,0 +1,99 @@
+#include "bench.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <new>
+#include <string>
+#include <string_view>
+
+static std::atomic<size_t> g_allocations{0};
+
+// Count every heap allocation in the process so benchmarks can report allocs/op
+void* operator new(size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if(void* ptr = std::malloc(size == 0 ? 1 : size))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+namespace gnunetpp::bench
+{
+std::vector<Benchmark>& registry()
+{
+    static std::vector<Benchmark> benchmarks;
+    return benchmarks;
+}
+
+size_t allocationCount()
+{
+    return g_allocations.load(std::memory_order_relaxed);
+}
+}
+
+using namespace gnunetpp::bench;
+
+static std::string jsonString(std::string_view str)
+{
+    std::string result = "\"";
+    for(char c : str) {
+        if(c == '"' || c == '\\')
+            result += '\\';
+        result += c;
+    }
+    return result + "\"";
+}
+
+int main(int argc, char** argv)
+{
+    // Optional filter: only run benchmarks whose name contains the argument. --json prints
+    // the results as a JSON array for regression tracking instead of a table
+    std::string_view filter;
+    bool json = false;
+    for(int i = 1; i < argc; i++) {
+        if(std::string_view(argv[i]) == "--json")
+            json = true;
+        else
+            filter = argv[i];
+    }
+    if(json)
+        std::cout << "[";
+    bool first = true;
+    for(auto& bench : registry()) {
+        if(bench.name.find(filter) == std::string::npos)
+            continue;
+        // Warm up caches and allocators before measuring
+        bench.fn(std::max<size_t>(bench.iterations / 10, 1));
+        size_t allocs_before = allocationCount();
+        auto start = std::chrono::steady_clock::now();
+        bench.fn(bench.iterations);
+        auto end = std::chrono::steady_clock::now();
+        size_t allocs = allocationCount() - allocs_before;
+        double ns = std::chrono::duration<double, std::nano>(end - start).count();
+        if(json) {
+            std::cout << (first ? "\n" : ",\n") << "  {\"name\": " << jsonString(bench.name)
+                << ", \"iterations\": " << bench.iterations
+                << std::fixed << std::setprecision(1) << ", \"ns_per_op\": " << ns / bench.iterations
+                << std::setprecision(3) << ", \"allocs_per_op\": " << double(allocs) / bench.iterations << "}";
+            first = false;
+            continue;
+        }
+        std::cout << std::left << std::setw(48) << bench.name
+            << std::right << std::setw(12) << std::fixed << std::setprecision(1) << ns / bench.iterations << " ns/op"
+            << std::setw(10) << std::setprecision(2) << double(allocs) / bench.iterations << " allocs/op\n";
+    }
+    if(json)
+        std::cout << "\n]\n";
+}
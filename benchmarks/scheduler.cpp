@@ -0,0 +1,157 @@
+#include "bench.hpp"
+
+#include "gnunetpp-scheduler.hpp"
+#include "inner/Infra.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace gnunetpp;
+using gnunetpp::bench::doNotOptimize;
+
+// These run against a real GNUnet scheduler on its own thread. It only needs the GNUnet
+// util library, no peer has to be running
+
+namespace
+{
+struct SchedulerThread
+{
+    SchedulerThread()
+    {
+        std::atomic<bool> started = false;
+        thread = std::thread([&] {
+            gnunetpp::run([&](const GNUNET_CONFIGURATION_Handle*) {
+                started = true;
+            }, "gnunetpp-bench");
+        });
+        while(!started)
+            std::this_thread::yield();
+    }
+
+    ~SchedulerThread()
+    {
+        scheduler::queue([] { gnunetpp::shutdown(); });
+        thread.join();
+    }
+
+    std::thread thread;
+};
+
+// One GNUnet scheduler per process, started by the first benchmark that needs it
+void startSchedulerThread()
+{
+    static SchedulerThread scheduler_thread;
+}
+
+// Runs `fn` on the GNUnet thread and waits until it called the `done` callback it is
+// given. The hop there and back is paid once per benchmark run, not per iteration
+template <typename Fn>
+void onGNUnetThread(Fn fn)
+{
+    startSchedulerThread();
+    std::atomic<bool> finished = false;
+    scheduler::queue([&] {
+        fn([&finished] { finished.store(true, std::memory_order_release); });
+    });
+    while(!finished.load(std::memory_order_acquire))
+        std::this_thread::yield();
+}
+}
+
+GNUNETPP_BENCHMARK("scheduler/queue from main thread", 1000000)
+{
+    onGNUnetThread([iterations](auto done) {
+        auto remaining = std::make_shared<size_t>(iterations);
+        for(size_t i = 0; i < iterations; i++) {
+            scheduler::queue([remaining, done] {
+                if(--*remaining == 0)
+                    done();
+            });
+        }
+    });
+}
+
+GNUNETPP_BENCHMARK("scheduler/queue from foreign thread", 1000000)
+{
+    std::atomic<size_t> remaining = iterations;
+    startSchedulerThread();
+    for(size_t i = 0; i < iterations; i++) {
+        scheduler::queue([&remaining] {
+            remaining.fetch_sub(1, std::memory_order_release);
+        });
+    }
+    while(remaining.load(std::memory_order_acquire) != 0)
+        std::this_thread::yield();
+}
+
+GNUNETPP_BENCHMARK("scheduler/queue from 4 foreign threads", 1000000)
+{
+    std::atomic<size_t> remaining = iterations;
+    startSchedulerThread();
+    std::vector<std::thread> producers;
+    for(size_t t = 0; t < 4; t++) {
+        producers.emplace_back([&remaining, count = iterations / 4 + (t < iterations % 4)] {
+            for(size_t i = 0; i < count; i++) {
+                scheduler::queue([&remaining] {
+                    remaining.fetch_sub(1, std::memory_order_release);
+                });
+            }
+        });
+    }
+    for(auto& producer : producers)
+        producer.join();
+    while(remaining.load(std::memory_order_acquire) != 0)
+        std::this_thread::yield();
+}
+
+// A timeout that is armed and cancelled before it fires, the common case for request timeouts
+GNUNETPP_BENCHMARK("scheduler/runLater and cancel", 1000000)
+{
+    onGNUnetThread([iterations](auto done) {
+        for(size_t i = 0; i < iterations; i++)
+            scheduler::cancel(scheduler::runLater(std::chrono::seconds(30), [] {}));
+        done();
+    });
+}
+
+// Same with 10k other timers outstanding
+GNUNETPP_BENCHMARK("scheduler/runLater and cancel (10k live)", 1000000)
+{
+    onGNUnetThread([iterations](auto done) {
+        std::vector<TaskID> background;
+        for(size_t i = 0; i < 10000; i++)
+            background.push_back(scheduler::runLater(std::chrono::seconds(30 + i % 1000), [] {}));
+        for(size_t i = 0; i < iterations; i++)
+            scheduler::cancel(scheduler::runLater(std::chrono::seconds(30), [] {}));
+        for(auto id : background)
+            scheduler::cancel(id);
+        done();
+    });
+}
+
+GNUNETPP_BENCHMARK("scheduler/runLater fired", 100000)
+{
+    onGNUnetThread([iterations](auto done) {
+        auto remaining = std::make_shared<size_t>(iterations);
+        for(size_t i = 0; i < iterations; i++) {
+            scheduler::runLater(std::chrono::microseconds(0), [remaining, done] {
+                if(--*remaining == 0)
+                    done();
+            });
+        }
+    });
+}
+
+// Suspending a coroutine and resuming it through the queue, the cheapest round trip
+// through the event loop
+GNUNETPP_BENCHMARK("scheduler/yield in a coroutine", 1000000)
+{
+    onGNUnetThread([iterations](auto done) {
+        async_run([iterations, done]() -> Task<> {
+            for(size_t i = 0; i < iterations; i++)
+                co_await scheduler::yield();
+            done();
+        });
+    });
+}
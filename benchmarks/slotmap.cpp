@@ -0,0 +1,92 @@
+#include "bench.hpp"
+
+#include "inner/UniqueData.hpp"
+#include "inner/SlotMap.hpp"
+
+using namespace gnunetpp::detail;
+using gnunetpp::bench::doNotOptimize;
+
+namespace
+{
+// Roughly the size of scheduler::TaskData
+struct Payload
+{
+    void* handle;
+    std::function<void()> fn;
+    bool repeat;
+};
+
+// The access pattern of a timer: add, look up when it fires, remove
+template <typename Map>
+void addLookupRemove(Map& map, size_t iterations)
+{
+    for(size_t i = 0; i < iterations; i++) {
+        if constexpr(requires { map.visit(0, [](Payload&) {}); }) {
+            auto id = map.add(Payload{nullptr, nullptr, false});
+            map.visit(id, [](Payload& data) { doNotOptimize(data); });
+            map.remove(id);
+        }
+        else {
+            auto [id, data] = map.add(Payload{nullptr, nullptr, false});
+            doNotOptimize(data);
+            if constexpr(requires { map.get(id); })
+                doNotOptimize(map.get(id));
+            else
+                doNotOptimize(map[id]);
+            map.remove(id);
+        }
+    }
+}
+
+// Same but with 10k other timers outstanding
+template <typename Map>
+void addLookupRemoveLoaded(Map& map, size_t iterations)
+{
+    std::vector<size_t> background;
+    for(size_t i = 0; i < 10000; i++) {
+        if constexpr(requires { map.visit(0, [](Payload&) {}); })
+            background.push_back(map.add(Payload{nullptr, nullptr, false}));
+        else
+            background.push_back(map.add(Payload{nullptr, nullptr, false}).first);
+    }
+    addLookupRemove(map, iterations);
+    for(auto id : background)
+        map.remove(id);
+}
+}
+
+GNUNETPP_BENCHMARK("UniqueData add/lookup/remove", 1000000)
+{
+    UniqueData<Payload> map;
+    addLookupRemove(map, iterations);
+}
+
+GNUNETPP_BENCHMARK("SlotMap add/lookup/remove", 1000000)
+{
+    SlotMap<Payload> map;
+    addLookupRemove(map, iterations);
+}
+
+GNUNETPP_BENCHMARK("ConcurrentSlotMap add/lookup/remove", 1000000)
+{
+    ConcurrentSlotMap<Payload> map;
+    addLookupRemove(map, iterations);
+}
+
+GNUNETPP_BENCHMARK("UniqueData add/lookup/remove (10k live)", 1000000)
+{
+    UniqueData<Payload> map;
+    addLookupRemoveLoaded(map, iterations);
+}
+
+GNUNETPP_BENCHMARK("SlotMap add/lookup/remove (10k live)", 1000000)
+{
+    SlotMap<Payload> map;
+    addLookupRemoveLoaded(map, iterations);
+}
+
+GNUNETPP_BENCHMARK("ConcurrentSlotMap add/lookup/remove (10k live)", 1000000)
+{
+    ConcurrentSlotMap<Payload> map;
+    addLookupRemoveLoaded(map, iterations);
+}
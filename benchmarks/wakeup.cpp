@@ -0,0 +1,118 @@
+#include "bench.hpp"
+
+#include "inner/MPSCQueue.hpp"
+#include "inner/Wakeup.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
+
+using namespace gnunetpp::detail;
+
+namespace
+{
+// What the scheduler did before Wakeup: one byte per notify, drained with a read loop
+struct PipeWakeup
+{
+    int fds[2];
+    bool open()
+    {
+        return pipe(fds) == 0;
+    }
+    ~PipeWakeup()
+    {
+        close(fds[0]);
+        close(fds[1]);
+    }
+    int fd() const
+    {
+        return fds[0];
+    }
+    void notify()
+    {
+        [[maybe_unused]] auto len = write(fds[1], "1", 1);
+    }
+    void consume()
+    {
+        char buf[1024];
+        while(read(fds[0], buf, sizeof(buf)) == sizeof(buf)) {}
+    }
+};
+
+// The cross thread post path without GNUnet: producers push into the inbox and poke the
+// wakeup, a consumer thread polls the fd and drains the inbox in batches like the
+// GNUnet thread does. Every producer waits for its post to be handled before sending
+// the next one, so ns/op is the round trip latency of a post with N producers competing
+template <typename WakeupType>
+void postRoundTrip(size_t producers, size_t iterations)
+{
+    WakeupType wakeup;
+    wakeup.open();
+    MPSCQueue<std::atomic<bool>*> inbox;
+    std::atomic<bool> stop{false};
+
+    std::thread consumer([&] {
+        pollfd fd{wakeup.fd(), POLLIN, 0};
+        while(!stop.load()) {
+            poll(&fd, 1, -1);
+            wakeup.consume();
+            inbox.drain([](std::atomic<bool>* done) {
+                done->store(true, std::memory_order_release);
+            });
+        }
+    });
+
+    std::vector<std::thread> threads;
+    for(size_t i = 0; i < producers; i++) {
+        threads.emplace_back([&] {
+            std::atomic<bool> done;
+            for(size_t n = 0; n < iterations; n++) {
+                done.store(false, std::memory_order_relaxed);
+                inbox.push(&done);
+                wakeup.notify();
+                while(!done.load(std::memory_order_acquire))
+                    std::this_thread::yield();
+            }
+        });
+    }
+    for(auto& thread : threads)
+        thread.join();
+
+    stop.store(true);
+    wakeup.notify();
+    consumer.join();
+}
+}
+
+GNUNETPP_BENCHMARK("pipe/post round trip, 1 producer", 20000)
+{
+    postRoundTrip<PipeWakeup>(1, iterations);
+}
+
+GNUNETPP_BENCHMARK("wakeup/post round trip, 1 producer", 20000)
+{
+    postRoundTrip<Wakeup>(1, iterations);
+}
+
+GNUNETPP_BENCHMARK("pipe/post round trip, 4 producers", 20000)
+{
+    postRoundTrip<PipeWakeup>(4, iterations);
+}
+
+GNUNETPP_BENCHMARK("wakeup/post round trip, 4 producers", 20000)
+{
+    postRoundTrip<Wakeup>(4, iterations);
+}
+
+GNUNETPP_BENCHMARK("pipe/post round trip, 16 producers", 5000)
+{
+    postRoundTrip<PipeWakeup>(16, iterations);
+}
+
+GNUNETPP_BENCHMARK("wakeup/post round trip, 16 producers", 5000)
+{
+    postRoundTrip<Wakeup>(16, iterations);
+}
@@ -0,0 +1,133 @@
+#include "CLI/App.hpp"
+#include "CLI/Formatter.hpp"
+#include "CLI/Config.hpp"
+
+#include "gnunetpp-epoll.hpp"
+#include "gnunetpp.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace gnunetpp;
+using Clock = std::chrono::steady_clock;
+
+// Latency of asking GNUnet to run something and getting the answer back in the
+// application's event loop. This is what every call into a GNUnet service from an
+// application reactor pays on top of the service itself.
+
+static void report(const std::string& name, std::vector<Clock::duration>& samples)
+{
+    std::sort(samples.begin(), samples.end());
+    auto us = [](Clock::duration d) {
+        return std::chrono::duration<double, std::micro>(d).count();
+    };
+    std::cout << name << ": " << samples.size() << " round trips"
+        << ", p50 " << us(samples[samples.size() / 2]) << "us"
+        << ", p99 " << us(samples[samples.size() * 99 / 100]) << "us"
+        << ", max " << us(samples.back()) << "us" << std::endl;
+}
+
+// GNUnet on its own thread. The request hops to the GNUnet thread through queue() and
+// its wakeup pipe, the answer hops back through an eventfd in the application's epoll set
+static void measureThread(size_t rounds)
+{
+    std::atomic<bool> started = false;
+    std::thread gnunet([&] {
+        gnunetpp::run([&](const GNUNET_CONFIGURATION_Handle*) {
+            started = true;
+        });
+    });
+    while(!started)
+        std::this_thread::yield();
+
+    int app_epoll = epoll_create1(EPOLL_CLOEXEC);
+    int answer = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = answer;
+    epoll_ctl(app_epoll, EPOLL_CTL_ADD, answer, &ev);
+
+    std::vector<Clock::duration> samples;
+    samples.reserve(rounds);
+    for(size_t i = 0; i < rounds; i++) {
+        auto begin = Clock::now();
+        scheduler::queue([answer] {
+            uint64_t one = 1;
+            [[maybe_unused]] auto n = write(answer, &one, sizeof(one));
+        });
+        epoll_event events[1];
+        while(epoll_wait(app_epoll, events, 1, -1) != 1) {}
+        uint64_t value;
+        [[maybe_unused]] auto n = read(answer, &value, sizeof(value));
+        samples.push_back(Clock::now() - begin);
+    }
+    report("separate GNUnet thread", samples);
+
+    scheduler::queue([] { gnunetpp::shutdown(); });
+    gnunet.join();
+    close(answer);
+    close(app_epoll);
+}
+
+// GNUnet driven from the application's epoll loop. The request is scheduled on the same
+// thread and the answer is ready as soon as the driver fd fires
+static void measureDriver(size_t rounds)
+{
+    int app_epoll = epoll_create1(EPOLL_CLOEXEC);
+    // The first round waits for GNUnet to start and isn't measured
+    bool answered = false;
+    EpollDriver driver([&](const GNUNET_CONFIGURATION_Handle*) { answered = true; });
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &driver;
+    epoll_ctl(app_epoll, EPOLL_CTL_ADD, driver.fd(), &ev);
+
+    std::vector<Clock::duration> samples;
+    samples.reserve(rounds);
+    for(size_t i = 0; i <= rounds; i++) {
+        auto begin = Clock::now();
+        while(!answered) {
+            epoll_event events[1];
+            if(epoll_wait(app_epoll, events, 1, -1) == 1 && events[0].data.ptr == &driver)
+                driver.run();
+        }
+        if(i != 0)
+            samples.push_back(Clock::now() - begin);
+        answered = false;
+        if(i != rounds)
+            scheduler::queue([&] { answered = true; });
+    }
+    report("application epoll loop", samples);
+
+    gnunetpp::shutdown();
+    epoll_ctl(app_epoll, EPOLL_CTL_DEL, driver.fd(), nullptr);
+    close(app_epoll);
+}
+
+int main(int argc, char** argv)
+{
+    CLI::App app("Compares calling into GNUnet from an application event loop with GNUnet "
+        "on its own thread and driven by the application's epoll loop", "gnunetpp-epoll");
+    std::string mode = "driver";
+    size_t rounds = 10000;
+    app.add_option("mode", mode, "driver or thread. Only one GNUnet scheduler can run per process")
+        ->check(CLI::IsMember({"driver", "thread"}));
+    app.add_option("-n,--rounds", rounds, "Number of round trips to measure");
+    CLI11_PARSE(app, argc, argv);
+    if(rounds == 0)
+        return 0;
+
+    if(mode == "driver")
+        measureDriver(rounds);
+    else
+        measureThread(rounds);
+    return 0;
+}
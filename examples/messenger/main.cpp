@@ -98,7 +98,14 @@ Task<> service(const GNUNET_CONFIGURATION_Handle* cfg)
 
     // Read from stdin and send each line as a message to the room.
     while(true) {
-        std::string line = co_await scheduler::readStdin();
+        std::string line;
+        try {
+            line = co_await scheduler::readStdin();
+        }
+        catch(const OperationCancelled&) {
+            // Ctrl+C while waiting for input
+            co_return;
+        }
         if(!line.empty() && line.back() == '\n')
             line.pop_back();
         if(line == "/exit") {
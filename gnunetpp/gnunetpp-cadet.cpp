@@ -1,5 +1,6 @@
 #include "gnunetpp-cadet.hpp"
 #include "gnunetpp-crypto.hpp"
+#include "inner/Instrumentation.hpp"
 #include <gnunet/gnunet_protocols.h>
 #include <gnunet/gnunet_util_lib.h>
 
@@ -37,6 +38,8 @@ static void *cadet_connection_trampoline (
     const GNUNET_PeerIdentity *source)
 
 {
+    detail::CallbackScope scope(detail::CallbackSite::CADET);
+    detail::ResumeBatch batch;
     auto callback_pack = reinterpret_cast<internal::OpenPortCallbackPack*>(cls);
     auto cadet = callback_pack->self;
     const auto& port_hash = callback_pack->port;
@@ -52,6 +55,8 @@ static void *cadet_connection_trampoline (
 
 static void cadet_disconnect_trampoline(void *cls, const GNUNET_CADET_Channel *channel)
 {
+    detail::CallbackScope scope(detail::CallbackSite::CADET);
+    detail::ResumeBatch batch;
     auto portListenerPack = static_cast<PortListenerPack*>(cls);
     auto cadet = portListenerPack->cadet;
 
@@ -68,6 +73,8 @@ static void cadet_disconnect_trampoline(void *cls, const GNUNET_CADET_Channel *c
 
 static void cadet_disconnect_client_trampoline(void *cls, const GNUNET_CADET_Channel *channel)
 {
+    detail::CallbackScope scope(detail::CallbackSite::CADET);
+    detail::ResumeBatch batch;
     auto pack = static_cast<ConnectPack*>(cls);
     auto channel_ptr = pack->channel.lock();
     GNUNET_assert(channel_ptr);
@@ -83,6 +90,8 @@ static int accept_all(void *cls, const struct GNUNET_MessageHeader *msg)
 
 static void cadet_message_trampoline(void *cls, const struct GNUNET_MessageHeader *msg)
 {
+    detail::CallbackScope scope(detail::CallbackSite::CADET);
+    detail::ResumeBatch batch;
     auto pack = static_cast<PortListenerPack*>(cls);
     auto size = ntohs(msg->size);
     auto type = ntohs(msg->type);
@@ -102,6 +111,8 @@ static void cadet_message_trampoline(void *cls, const struct GNUNET_MessageHeade
 
 static void cadet_message_client_trampoline(void *cls, const struct GNUNET_MessageHeader *msg)
 {
+    detail::CallbackScope scope(detail::CallbackSite::CADET);
+    detail::ResumeBatch batch;
     auto pack = static_cast<ConnectPack*>(cls);
     auto channel_ptr = pack->channel.lock();
     GNUNET_assert(channel_ptr);
@@ -211,6 +222,8 @@ struct ListPeersCallbackPack
 {
     std::function<void(const std::vector<GNUNET_CADET_PeerListEntry>&)> callback;
     std::vector<GNUNET_CADET_PeerListEntry> peers;
+    GNUNET_CADET_PeersLister* handle = nullptr;
+    std::optional<StopCallback> on_stop;
 };
 
 static void list_peers_trampoline(void* cls, const GNUNET_CADET_PeerListEntry *ple)
@@ -220,27 +233,50 @@ static void list_peers_trampoline(void* cls, const GNUNET_CADET_PeerListEntry *p
     if(ple)
         pack->peers.push_back(*ple);
     else {
+        pack->on_stop.reset();
         pack->callback(pack->peers);
         delete pack;
     }
 }
 
-void CADET::listPeers(const GNUNET_CONFIGURATION_Handle* cfg, std::function<void(const std::vector<GNUNET_CADET_PeerListEntry>&)> callback)
+void CADET::listPeers(const GNUNET_CONFIGURATION_Handle* cfg, std::function<void(const std::vector<GNUNET_CADET_PeerListEntry>&)> callback
+    , std::stop_token stop)
 {
-    auto cls = new ListPeersCallbackPack{callback, {}};
-    GNUNET_CADET_list_peers(cfg, list_peers_trampoline, cls);
+    if(stop.stop_requested())
+        throw OperationCancelled();
+    auto pack = new ListPeersCallbackPack{std::move(callback), {}};
+    pack->handle = GNUNET_CADET_list_peers(cfg, list_peers_trampoline, pack);
+    if(pack->handle == nullptr) {
+        pack->callback({});
+        delete pack;
+        return;
+    }
+    if(stop.stop_possible()) {
+        pack->on_stop.emplace(std::move(stop), [pack] {
+            GNUNET_CADET_list_peers_cancel(pack->handle);
+            auto callback = std::move(pack->callback);
+            auto peers = std::move(pack->peers);
+            delete pack;
+            callback(peers);
+        });
+    }
 }
 
 Task<std::vector<GNUNET_CADET_PeerListEntry>> CADET::listPeers(const GNUNET_CONFIGURATION_Handle* cfg)
 {
     struct PeerListAwaiter : public EagerAwaiter<std::vector<GNUNET_CADET_PeerListEntry>> {
-        PeerListAwaiter(const GNUNET_CONFIGURATION_Handle* cfg) {
-            listPeers(cfg, [this](const std::vector<GNUNET_CADET_PeerListEntry>& peers) {
-                setValue(peers);
-            });
+        PeerListAwaiter(const GNUNET_CONFIGURATION_Handle* cfg, std::stop_token stop) {
+            describe("CADET list peers");
+            listPeers(cfg, [this, stop](const std::vector<GNUNET_CADET_PeerListEntry>& peers) {
+                if(stop.stop_requested())
+                    setException(std::make_exception_ptr(OperationCancelled()));
+                else
+                    setValue(peers);
+            }, stop);
         }
     };
-    co_return co_await PeerListAwaiter(cfg);
+    auto stop = co_await currentStopToken();
+    co_return co_await PeerListAwaiter(cfg, std::move(stop));
 }
 
 void CADETChannel::send(const void* data, size_t size, uint16_t type)
@@ -321,6 +357,8 @@ struct ListPathsCallbackPack
 {
     std::function<void(const std::vector<std::vector<GNUNET_PeerIdentity>>&)> callback;
     std::vector<std::vector<GNUNET_PeerIdentity>> paths;
+    GNUNET_CADET_GetPath* handle = nullptr;
+    std::optional<StopCallback> on_stop;
 };
 
 void list_paths_trampoline(void* cls, const GNUNET_CADET_PeerPathDetail* ppd)
@@ -340,32 +378,57 @@ void list_paths_trampoline(void* cls, const GNUNET_CADET_PeerPathDetail* ppd)
         return;
     }
 
+    pack->on_stop.reset();
     pack->callback(pack->paths);
     delete pack;
 }
 
-void CADET::pathsToPeer(const GNUNET_CONFIGURATION_Handle* cfg, const GNUNET_PeerIdentity& peer, std::function<void(const std::vector<std::vector<GNUNET_PeerIdentity>>&)> callback)
+void CADET::pathsToPeer(const GNUNET_CONFIGURATION_Handle* cfg, const GNUNET_PeerIdentity& peer
+    , std::function<void(const std::vector<std::vector<GNUNET_PeerIdentity>>&)> callback, std::stop_token stop)
 {
-    auto cls = new ListPathsCallbackPack{std::move(callback), {}};
-    GNUNET_CADET_get_path(cfg, &peer, list_paths_trampoline, cls);
+    if(stop.stop_requested())
+        throw OperationCancelled();
+    auto pack = new ListPathsCallbackPack{std::move(callback), {}};
+    pack->handle = GNUNET_CADET_get_path(cfg, &peer, list_paths_trampoline, pack);
+    if(pack->handle == nullptr) {
+        pack->callback({});
+        delete pack;
+        return;
+    }
+    if(stop.stop_possible()) {
+        pack->on_stop.emplace(std::move(stop), [pack] {
+            GNUNET_CADET_get_path_cancel(pack->handle);
+            auto callback = std::move(pack->callback);
+            auto paths = std::move(pack->paths);
+            delete pack;
+            callback(paths);
+        });
+    }
 }
 
 Task<std::vector<std::vector<GNUNET_PeerIdentity>>> CADET::pathsToPeer(const GNUNET_CONFIGURATION_Handle* cfg, const GNUNET_PeerIdentity& peer)
 {
     struct PathAwaiter : public EagerAwaiter<std::vector<std::vector<GNUNET_PeerIdentity>>> {
-        PathAwaiter(const GNUNET_CONFIGURATION_Handle* cfg, const GNUNET_PeerIdentity& peer) {
-            pathsToPeer(cfg, peer, [this](const std::vector<std::vector<GNUNET_PeerIdentity>>& paths) {
-                setValue(paths);
-            });
+        PathAwaiter(const GNUNET_CONFIGURATION_Handle* cfg, const GNUNET_PeerIdentity& peer, std::stop_token stop) {
+            describe("CADET paths", [&] { return crypto::to_string(peer); });
+            pathsToPeer(cfg, peer, [this, stop](const std::vector<std::vector<GNUNET_PeerIdentity>>& paths) {
+                if(stop.stop_requested())
+                    setException(std::make_exception_ptr(OperationCancelled()));
+                else
+                    setValue(paths);
+            }, stop);
         }
     };
-    co_return co_await PathAwaiter(cfg, peer);
+    auto stop = co_await currentStopToken();
+    co_return co_await PathAwaiter(cfg, peer, std::move(stop));
 }
 
 struct ListTunnelsCallbackPack
 {
     std::function<void(const std::vector<GNUNET_CADET_TunnelDetails>&)> callback;
     std::vector<GNUNET_CADET_TunnelDetails> tunnels;
+    GNUNET_CADET_ListTunnels* handle = nullptr;
+    std::optional<StopCallback> on_stop;
 };
 
 void list_tunnels_trampoline(void* cls, const GNUNET_CADET_TunnelDetails* td)
@@ -377,24 +440,47 @@ void list_tunnels_trampoline(void* cls, const GNUNET_CADET_TunnelDetails* td)
         return;
     }
 
+    pack->on_stop.reset();
     pack->callback(pack->tunnels);
     delete pack;
 }
 
-void CADET::listTunnels(const GNUNET_CONFIGURATION_Handle* cfg, std::function<void(const std::vector<GNUNET_CADET_TunnelDetails>&)> callback)
+void CADET::listTunnels(const GNUNET_CONFIGURATION_Handle* cfg, std::function<void(const std::vector<GNUNET_CADET_TunnelDetails>&)> callback
+    , std::stop_token stop)
 {
-    auto cls = new ListTunnelsCallbackPack{std::move(callback), {}};
-    GNUNET_CADET_list_tunnels(cfg, list_tunnels_trampoline, cls);
+    if(stop.stop_requested())
+        throw OperationCancelled();
+    auto pack = new ListTunnelsCallbackPack{std::move(callback), {}};
+    pack->handle = GNUNET_CADET_list_tunnels(cfg, list_tunnels_trampoline, pack);
+    if(pack->handle == nullptr) {
+        pack->callback({});
+        delete pack;
+        return;
+    }
+    if(stop.stop_possible()) {
+        pack->on_stop.emplace(std::move(stop), [pack] {
+            GNUNET_CADET_list_tunnels_cancel(pack->handle);
+            auto callback = std::move(pack->callback);
+            auto tunnels = std::move(pack->tunnels);
+            delete pack;
+            callback(tunnels);
+        });
+    }
 }
 
 Task<std::vector<GNUNET_CADET_TunnelDetails>> CADET::listTunnels(const GNUNET_CONFIGURATION_Handle* cfg)
 {
     struct TunnelAwaiter : public EagerAwaiter<std::vector<GNUNET_CADET_TunnelDetails>> {
-        TunnelAwaiter(const GNUNET_CONFIGURATION_Handle* cfg) {
-            listTunnels(cfg, [this](const std::vector<GNUNET_CADET_TunnelDetails>& tunnels) {
-                setValue(tunnels);
-            });
+        TunnelAwaiter(const GNUNET_CONFIGURATION_Handle* cfg, std::stop_token stop) {
+            describe("CADET list tunnels");
+            listTunnels(cfg, [this, stop](const std::vector<GNUNET_CADET_TunnelDetails>& tunnels) {
+                if(stop.stop_requested())
+                    setException(std::make_exception_ptr(OperationCancelled()));
+                else
+                    setValue(tunnels);
+            }, stop);
         }
     };
-    co_return co_await TunnelAwaiter(cfg);
+    auto stop = co_await currentStopToken();
+    co_return co_await TunnelAwaiter(cfg, std::move(stop));
 }
\ No newline at end of file
@@ -194,8 +194,10 @@ struct CADET : public Service
      * @brief Get a list of peers that we know about
      * 
      * @param cfg Handle to GNUnet
+     * @param stop Cancels the request when stopped. The callback gets the peers listed so far
      */
-    static void listPeers(const GNUNET_CONFIGURATION_Handle* cfg, std::function<void(const std::vector<GNUNET_CADET_PeerListEntry>&)>);
+    static void listPeers(const GNUNET_CONFIGURATION_Handle* cfg, std::function<void(const std::vector<GNUNET_CADET_PeerListEntry>&)>
+        , std::stop_token stop = {});
     static Task<std::vector<GNUNET_CADET_PeerListEntry>> listPeers(const GNUNET_CONFIGURATION_Handle* cfg);
 
     /**
@@ -203,11 +205,20 @@ struct CADET : public Service
      * 
      * @param cfg Handle to GNUnet
      * @param peer Peer to get paths to
+     * @param stop Cancels the request when stopped. The callback gets the paths found so far
      */
-    static void pathsToPeer(const GNUNET_CONFIGURATION_Handle* cfg, const GNUNET_PeerIdentity& peer, std::function<void(const std::vector<std::vector<GNUNET_PeerIdentity>>&)> callback);
+    static void pathsToPeer(const GNUNET_CONFIGURATION_Handle* cfg, const GNUNET_PeerIdentity& peer
+        , std::function<void(const std::vector<std::vector<GNUNET_PeerIdentity>>&)> callback, std::stop_token stop = {});
     static Task<std::vector<std::vector<GNUNET_PeerIdentity>>> pathsToPeer(const GNUNET_CONFIGURATION_Handle* cfg, const GNUNET_PeerIdentity& peer);
 
-    static void listTunnels(const GNUNET_CONFIGURATION_Handle* cfg, std::function<void(const std::vector<GNUNET_CADET_TunnelDetails>&)> callback);
+    /**
+     * @brief Get a list of tunnels to other peers
+     *
+     * @param cfg Handle to GNUnet
+     * @param stop Cancels the request when stopped. The callback gets the tunnels listed so far
+     */
+    static void listTunnels(const GNUNET_CONFIGURATION_Handle* cfg, std::function<void(const std::vector<GNUNET_CADET_TunnelDetails>&)> callback
+        , std::stop_token stop = {});
     static Task<std::vector<GNUNET_CADET_TunnelDetails>> listTunnels(const GNUNET_CONFIGURATION_Handle* cfg);
 
     /**
@@ -33,6 +33,8 @@ struct PutCallbackPack
 struct GetCallbackPack
 {
     std::function<void(std::optional<std::vector<uint8_t>>, uint64_t)> callback; 
+    GNUNET_DATASTORE_QueueEntry* qe = nullptr;
+    std::optional<StopCallback> on_stop;
 };
 
 static void put_callback (void *cls,
@@ -40,6 +42,8 @@ static void put_callback (void *cls,
                 struct GNUNET_TIME_Absolute min_expiration,
                 const char *msg)
 {
+    // Resume the awaiting coroutine, which may well put again, once GNUnet's callback is done with the pack
+    detail::ResumeBatch batch;
     auto pack = reinterpret_cast<PutCallbackPack*>(cls);
     std::optional<std::string> error;
     // Success == 0 means we have an error, else there should be no error message
@@ -61,6 +65,7 @@ void get_callback(void *cls,
         GNUNET_TIME_Absolute expiration,
         uint64_t uid)
 {
+    detail::ResumeBatch batch;
     auto pack = reinterpret_cast<GetCallbackPack*>(cls);
     std::optional<std::vector<uint8_t>> data_vec;
     GNUNET_assert((data == NULL && size == 0) || (data != NULL));
@@ -68,6 +73,7 @@ void get_callback(void *cls,
         data_vec = std::vector<uint8_t>(size);
         memcpy(data_vec->data(), data, size);
     }
+    pack->on_stop.reset();
     pack->callback(data_vec, uid);
     delete pack;
 }
@@ -118,6 +124,7 @@ Task<> DataStore::put(GNUNET_HashCode key
             , uint32_t queue_priority
             , uint32_t max_queue_size)
     {
+        describe("DataStore put", [&] { return crypto::to_string(key); });
         self->put(key, data, data_size, [this](std::optional<std::string> error) {
             if(error)
                 this->setException(std::make_exception_ptr(std::runtime_error(*error)));
@@ -131,13 +138,25 @@ Task<> DataStore::put(GNUNET_HashCode key
 }
 
 void DataStore::getOne(const GNUNET_HashCode& hash, std::function<void(std::optional<std::vector<uint8_t>>, uint64_t)> callback
-    , uint32_t queue_priority, uint32_t max_queue_size, GNUNET_BLOCK_Type type, uint64_t uid)
+    , uint32_t queue_priority, uint32_t max_queue_size, GNUNET_BLOCK_Type type, uint64_t uid, std::stop_token stop)
 {
+    if(stop.stop_requested())
+        throw OperationCancelled();
     GetCallbackPack* pack = new GetCallbackPack{std::move(callback)};
     auto handel = GNUNET_DATASTORE_get_key(datastore, uid, GNUNET_NO, &hash, type, queue_priority, max_queue_size, get_callback, pack);
     if(handel == NULL) {
         pack->callback(std::nullopt, 0);
         delete pack;
+        return;
+    }
+    pack->qe = handel;
+    if(stop.stop_possible()) {
+        pack->on_stop.emplace(std::move(stop), [pack]() {
+            GNUNET_DATASTORE_cancel(pack->qe);
+            auto callback = std::move(pack->callback);
+            delete pack;
+            callback(std::nullopt, 0);
+        });
     }
 }
 
@@ -151,14 +170,20 @@ Task<std::optional<std::vector<uint8_t>>> DataStore::getOne(GNUNET_HashCode hash
             , uint32_t queue_priority
             , uint32_t max_queue_size
             , GNUNET_BLOCK_Type type
-            , uint64_t uid)
+            , uint64_t uid
+            , std::stop_token stop)
         {
-            self->getOne(hash, [this](std::optional<std::vector<uint8_t>> data, uint64_t uid) {
-                this->setValue(data);
-            }, queue_priority, max_queue_size, type, uid);
+            describe("DataStore get", [&] { return crypto::to_string(hash); });
+            self->getOne(hash, [this, stop](std::optional<std::vector<uint8_t>> data, uint64_t uid) {
+                if(stop.stop_requested())
+                    this->setException(std::make_exception_ptr(OperationCancelled()));
+                else
+                    this->setValue(data);
+            }, queue_priority, max_queue_size, type, uid, stop);
         }
     };
-    GetAwaiter awaiter(this, hash, queue_priority, max_queue_size, type, uid);
+    auto stop = co_await currentStopToken();
+    GetAwaiter awaiter(this, hash, queue_priority, max_queue_size, type, uid, std::move(stop));
     co_return co_await awaiter;
 }
 
@@ -174,6 +199,7 @@ async_generator<std::vector<uint8_t>> DataStore::get(GNUNET_HashCode hash
             , GNUNET_BLOCK_Type type
             , uint64_t uid)
         {
+            describe("DataStore get", [&] { return crypto::to_string(hash); });
             self->getOne(hash, [this](std::optional<std::vector<uint8_t>> data, uint64_t uid) {
                 this->setValue({data, uid});
             }, queue_priority, max_queue_size, type, uid);
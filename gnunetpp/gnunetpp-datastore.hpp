@@ -28,31 +28,36 @@ struct DataStore : public Service
         , GNUNET_BLOCK_Type type = GNUNET_BLOCK_TYPE_TEST
         , uint32_t queue_priority = 2
         , uint32_t max_queue_size = 1);
+    /**
+     * @brief Fetches one value stored under `hash`. `callback` gets std::nullopt if there is none
+     *
+     * @param stop Cancels the request when stopped. `callback` is called with std::nullopt
+     */
     void getOne(const GNUNET_HashCode& hash, std::function<void(std::optional<std::vector<uint8_t>>, uint64_t)> callback
         , uint32_t queue_priority=1, uint32_t max_queue_size=1, GNUNET_BLOCK_Type type = GNUNET_BLOCK_TYPE_TEST
-        , uint64_t uid = 0);
+        , uint64_t uid = 0, std::stop_token stop = {});
     void getOne(const GNUNET_HashCode& hash, std::function<void(std::optional<std::vector<uint8_t>>)> callback
         , uint32_t queue_priority=1, uint32_t max_queue_size=1, GNUNET_BLOCK_Type type = GNUNET_BLOCK_TYPE_TEST
-        , uint64_t uid = 0)
+        , uint64_t uid = 0, std::stop_token stop = {})
     {
         auto functor = [callback=std::move(callback)](std::optional<std::vector<uint8_t>> data, uint64_t uid) {
             callback(data);
         };
-        getOne(hash, std::move(functor), queue_priority, max_queue_size, type, uid);
+        getOne(hash, std::move(functor), queue_priority, max_queue_size, type, uid, std::move(stop));
     }
     void getOne(const std::string_view key, std::function<void(std::optional<std::vector<uint8_t>>, uint64_t)> callback
         , uint32_t queue_priority=1, uint32_t max_queue_size=1, GNUNET_BLOCK_Type type = GNUNET_BLOCK_TYPE_TEST
-        , uint64_t uid = 0)
+        , uint64_t uid = 0, std::stop_token stop = {})
     {
         auto hash = gnunetpp::crypto::hash(key);
-        getOne(hash, std::move(callback), queue_priority, max_queue_size, type, uid);
+        getOne(hash, std::move(callback), queue_priority, max_queue_size, type, uid, std::move(stop));
     }
     void getOne(const std::string_view key, std::function<void(std::optional<std::vector<uint8_t>>)> callback
         , uint32_t queue_priority=1, uint32_t max_queue_size=1, GNUNET_BLOCK_Type type = GNUNET_BLOCK_TYPE_TEST
-        , uint64_t uid = 0)
+        , uint64_t uid = 0, std::stop_token stop = {})
     {
         auto hash = gnunetpp::crypto::hash(key);
-        getOne(hash, std::move(callback), queue_priority, max_queue_size, type, uid);
+        getOne(hash, std::move(callback), queue_priority, max_queue_size, type, uid, std::move(stop));
     }
     
     Task<> put(GNUNET_HashCode key
@@ -135,6 +140,10 @@ struct DataStore : public Service
         return put(hash, data.data(), data.size(), expiration, priority, replication, anonymity, type, queue_priority, max_queue_size);
     }
     
+    /**
+     * @brief Fetches one value stored under `hash`. The coroutine version, throws
+     * OperationCancelled when the awaiting task is stopped
+     */
     Task<std::optional<std::vector<uint8_t>>> getOne(GNUNET_HashCode hash
         , uint32_t queue_priority=1, uint32_t max_queue_size=1, GNUNET_BLOCK_Type type = GNUNET_BLOCK_TYPE_TEST
         , uint64_t uid = 0);
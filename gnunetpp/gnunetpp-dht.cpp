@@ -19,10 +19,11 @@ GNUNET_DHT_PutHandle* DHT::put(const std::string_view key, const std::string_vie
     , std::chrono::microseconds expiration
     , unsigned int replication
     , GNUNET_BLOCK_Type data_type
-    , GNUNET_DHT_RouteOption routing_options)
+    , GNUNET_DHT_RouteOption routing_options
+    , std::stop_token stop)
 {
     auto key_hash = crypto::hash(key);
-    return put(key_hash, data, std::move(completedCallback), expiration, replication, data_type, routing_options);
+    return put(key_hash, data, std::move(completedCallback), expiration, replication, data_type, routing_options, std::move(stop));
 }
 
 GNUNET_DHT_PutHandle* DHT::put(const GNUNET_HashCode& key_hash, const std::string_view data
@@ -30,22 +31,37 @@ GNUNET_DHT_PutHandle* DHT::put(const GNUNET_HashCode& key_hash, const std::strin
     , std::chrono::microseconds expiration
     , unsigned int replication
     , GNUNET_BLOCK_Type data_type
-    , GNUNET_DHT_RouteOption routing_options)
+    , GNUNET_DHT_RouteOption routing_options
+    , std::stop_token stop)
 {
     if(dht_handle == NULL)
         throw std::runtime_error("DHT not connected");
+    if(stop.stop_requested())
+        throw OperationCancelled();
 
     // XXX: This only works because internally GNUNet uses msec. If they ever change this, this will break.
     const size_t num_usecs = expiration.count();
     GNUNET_TIME_Relative gnunet_expiration{num_usecs};
 
-    PutCallbackFunctor* functor = new PutCallbackFunctor(std::move(completedCallback));
+    auto pack = new PutCallbackPack;
+    pack->callback = std::move(completedCallback);
 
     // No need to copy data to ensure lifetime ourselves, GNUNet does it for us
     GNUNET_DHT_PutHandle* handle = GNUNET_DHT_put(dht_handle, &key_hash, replication, routing_options, data_type, data.size()
-        , data.data(), GNUNET_TIME_relative_to_absolute(gnunet_expiration), &DHT::putCallback, functor);
-    if(handle == NULL)
+        , data.data(), GNUNET_TIME_relative_to_absolute(gnunet_expiration), &DHT::putCallback, pack);
+    if(handle == NULL) {
+        delete pack;
         throw std::runtime_error("Failed to put data into GNUNet DHT");
+    }
+    pack->handle = handle;
+    if(stop.stop_possible()) {
+        pack->on_stop.emplace(std::move(stop), [pack] {
+            GNUNET_DHT_put_cancel(pack->handle);
+            auto callback = std::move(pack->callback);
+            delete pack;
+            callback();
+        });
+    }
     return handle;
 }
 
@@ -92,14 +108,20 @@ Task<> DHT::put(GNUNET_HashCode key_hash, const std::string_view data
             , std::chrono::microseconds expiration
             , unsigned int replication
             , GNUNET_BLOCK_Type data_type
-            , GNUNET_DHT_RouteOption routing_options)
+            , GNUNET_DHT_RouteOption routing_options
+            , std::stop_token stop)
         {
-            dht->put(key_hash, data, [this] () {
-                setValue();
-            }, expiration, replication, data_type, routing_options);
+            describe("DHT put", [&] { return crypto::to_string(key_hash); });
+            dht->put(key_hash, data, [this, stop] () {
+                if(stop.stop_requested())
+                    setException(std::make_exception_ptr(OperationCancelled()));
+                else
+                    setValue();
+            }, expiration, replication, data_type, routing_options, stop);
         }
     };
-    co_await PutAwaiter(this, key_hash, data, expiration, replication, data_type, routing_options);
+    auto stop = co_await currentStopToken();
+    co_await PutAwaiter(this, key_hash, data, expiration, replication, data_type, routing_options, std::move(stop));
 }
 
 DHT::GetCallbackPack* DHT::get(const std::string_view key, GetCallbackFunctor completedCallback
@@ -107,10 +129,11 @@ DHT::GetCallbackPack* DHT::get(const std::string_view key, GetCallbackFunctor co
     , GNUNET_BLOCK_Type data_type
     , unsigned int replication
     , GNUNET_DHT_RouteOption routing_options
-    , std::function<void()> finished_callback)
+    , Function<void()> finished_callback
+    , std::stop_token stop)
 {
     return get(crypto::hash(key), std::move(completedCallback), search_timeout
-        , data_type, replication, routing_options, std::move(finished_callback));
+        , data_type, replication, routing_options, std::move(finished_callback), std::move(stop));
 }
 
 DHT::GetCallbackPack* DHT::get(const GNUNET_HashCode& key_hash, GetCallbackFunctor completedCallback
@@ -118,10 +141,25 @@ DHT::GetCallbackPack* DHT::get(const GNUNET_HashCode& key_hash, GetCallbackFunct
     , GNUNET_BLOCK_Type data_type
     , unsigned int replication
     , GNUNET_DHT_RouteOption routing_options
-    , std::function<void()> finished_callback)
+    , Function<void()> finished_callback
+    , std::stop_token stop)
+{
+    return startGet(key_hash, std::move(completedCallback), search_timeout, data_type, replication, routing_options
+        , std::move(finished_callback), std::move(stop));
+}
+
+DHT::GetCallbackPack* DHT::startGet(const GNUNET_HashCode& key_hash, GetCallbackFunctor completedCallback
+    , std::optional<std::chrono::microseconds> search_timeout
+    , GNUNET_BLOCK_Type data_type
+    , unsigned int replication
+    , GNUNET_DHT_RouteOption routing_options
+    , Function<void()> finished_callback
+    , std::stop_token stop)
 {
     if(dht_handle == NULL)
         throw std::runtime_error("DHT not connected");
+    if(stop.stop_requested())
+        throw OperationCancelled();
     auto data = new GetCallbackPack;
 
     GNUNET_DHT_GetHandle* handle = GNUNET_DHT_get_start(dht_handle, data_type, &key_hash, replication, routing_options
@@ -132,13 +170,18 @@ DHT::GetCallbackPack* DHT::get(const GNUNET_HashCode& key_hash, GetCallbackFunct
     }
     data->callback = std::move(completedCallback);
     data->handle = handle;
-    data->timer_task = scheduler::runLater(search_timeout, [data, this] () {
-        GNUNET_DHT_get_stop(data->handle);
-        if(data->finished_callback)
-            data->finished_callback();
-        delete data;
-    }, true);
+    if(search_timeout) {
+        data->timer_task = scheduler::runLater(*search_timeout, [data, this] () {
+            GNUNET_DHT_get_stop(data->handle);
+            data->on_stop.reset();
+            if(data->finished_callback)
+                data->finished_callback();
+            delete data;
+        }, true);
+    }
     data->finished_callback = std::move(finished_callback);
+    if(stop.stop_possible())
+        data->on_stop.emplace(std::move(stop), [data] { data->cancel(); });
     return data;
 }
 
@@ -146,28 +189,46 @@ GeneratorWrapper<std::string> DHT::get(const std::string_view key
         , std::chrono::microseconds search_timeout
         , GNUNET_BLOCK_Type data_type
         , unsigned int replication
-        , GNUNET_DHT_RouteOption routing_options)
+        , GNUNET_DHT_RouteOption routing_options
+        , std::stop_token stop)
 {
-    return get(crypto::hash(key), search_timeout, data_type, replication, routing_options);
+    return get(crypto::hash(key), search_timeout, data_type, replication, routing_options, std::move(stop));
 }
 
 GeneratorWrapper<std::string> DHT::get(GNUNET_HashCode key_hash
         , std::chrono::microseconds search_timeout
         , GNUNET_BLOCK_Type data_type
         , unsigned int replication
-        , GNUNET_DHT_RouteOption routing_options)
-
+        , GNUNET_DHT_RouteOption routing_options
+        , std::stop_token stop)
 {
+    // The search window ends the search through its stop token, the same way `stop` does.
+    // The search keeps the window alive. The timer only holds on to the stop source
+    struct Window
+    {
+        std::stop_source stop;
+        std::optional<StopCallback> forward;
+        TaskID timer = 0;
+    };
+    auto window = std::make_shared<Window>();
+    if(stop.stop_possible())
+        window->forward.emplace(std::move(stop), [source = window->stop] () mutable { source.request_stop(); });
+
     auto awaiter = std::make_unique<QueuedAwaiter<std::string>>();
-    auto handle = get(key_hash, [awaiter=awaiter.get()] (std::string_view data) {
+    awaiter->describe("DHT get", [&] { return crypto::to_string(key_hash); });
+    auto handle = startGet(key_hash, [awaiter=awaiter.get()] (std::string_view data) {
         awaiter->addValue(std::string(data));
         return true;
-    }, search_timeout, data_type, replication, routing_options
-    , [awaiter=awaiter.get()](){
+    }, std::nullopt, data_type, replication, routing_options
+    , [awaiter=awaiter.get(), window](){
+        scheduler::cancel(window->timer);
         awaiter->finish();
-    });
+    }, window->stop.get_token());
     if(handle == NULL)
         throw std::runtime_error("Failed to get data from GNUNet DHT");
+    window->timer = scheduler::runLater(search_timeout, [source = window->stop] () mutable {
+        source.request_stop();
+    });
 
     return GeneratorWrapper<std::string>(std::move(awaiter), [this, awaiter=awaiter.get(), handle] {
         handle->cancel();
@@ -178,6 +239,7 @@ void DHT::GetCallbackPack::cancel()
 {
     GNUNET_DHT_get_stop(handle);
     scheduler::cancel(timer_task);
+    on_stop.reset();
     if(finished_callback)
         finished_callback();
     delete this;
@@ -205,6 +267,8 @@ void DHT::getCallback(void *cls,
     size_t size,
     const void *data)
 {
+    detail::CallbackScope scope(detail::CallbackSite::DHT);
+    detail::ResumeBatch batch;
     auto pack = reinterpret_cast<GetCallbackPack*>(cls);
     assert(pack != nullptr);
     std::string_view data_view{reinterpret_cast<const char*>(data), size};
@@ -212,6 +276,7 @@ void DHT::getCallback(void *cls,
     if(keep_running == false) {
         GNUNET_DHT_get_stop(pack->handle);
         scheduler::cancel(pack->timer_task);
+        pack->on_stop.reset();
         if(pack->finished_callback)
             pack->finished_callback();
         delete pack;
@@ -13,21 +13,23 @@
 #include <functional>
 #include <cassert>
 #include <memory>
+#include <optional>
 
 
 namespace gnunetpp
 {
 struct DHT : public Service
 {
-    using PutCallbackFunctor = std::function<void()>;
-    using GetCallbackFunctor = std::function<bool(std::string_view)>;
+    using PutCallbackFunctor = Function<void()>;
+    using GetCallbackFunctor = Function<bool(std::string_view)>;
 
     struct GetCallbackPack
     {
         GNUNET_DHT_GetHandle* handle;
-        TaskID timer_task;
+        TaskID timer_task = 0;
         GetCallbackFunctor callback;
-        std::function<void()> finished_callback;
+        Function<void()> finished_callback;
+        std::optional<StopCallback> on_stop;
 
         void cancel();
     };
@@ -58,6 +60,7 @@ struct DHT : public Service
      * @param replication How many copies of the insert command should be sent (!= number of copies of the data)
      * @param data_type The type of the data block. `GNUNET_BLOCK_TYPE_TEST` is generic but does not support error checking.
      * @param routing_options The routing options to use for the insert command
+     * @param stop Aborts the insert when stopped. `completedCallback` is still called
      * @return GNUNET_DHT_PutHandle* a handle to the operation. Can be used to cancel the operation.
      */
     GNUNET_DHT_PutHandle* put(const std::string_view key, const std::string_view data
@@ -65,13 +68,15 @@ struct DHT : public Service
         , std::chrono::microseconds expiration = std::chrono::hours(1)
         , unsigned int replication = 5
         , GNUNET_BLOCK_Type data_type = GNUNET_BLOCK_TYPE_TEST
-        , GNUNET_DHT_RouteOption routing_options = GNUNET_DHT_RO_NONE);
+        , GNUNET_DHT_RouteOption routing_options = GNUNET_DHT_RO_NONE
+        , std::stop_token stop = {});
     GNUNET_DHT_PutHandle* put(const GNUNET_HashCode& key_hash, const std::string_view data
         , PutCallbackFunctor completedCallback
         , std::chrono::microseconds expiration = std::chrono::hours(1)
         , unsigned int replication = 5
         , GNUNET_BLOCK_Type data_type = GNUNET_BLOCK_TYPE_TEST
-        , GNUNET_DHT_RouteOption routing_options = GNUNET_DHT_RO_NONE);
+        , GNUNET_DHT_RouteOption routing_options = GNUNET_DHT_RO_NONE
+        , std::stop_token stop = {});
 
     /**
      * @brief Searches the DHT for the given `key`.
@@ -82,6 +87,8 @@ struct DHT : public Service
      * @param data_type The type of the data block. `GNUNET_BLOCK_TYPE_TEST` is generic but does not support error checking.
      * @param replication How many copies of the get command should be sent (to avoid evil nodes)
      * @param routing_options The routing options to use for the get command
+     * @param finishedCallback Called once the search is over, including when it was cancelled
+     * @param stop Cancels the search when stopped
      * @return GetCallbackPack* 
      */
     GetCallbackPack* get(const std::string_view key, GetCallbackFunctor completedCallback
@@ -89,25 +96,37 @@ struct DHT : public Service
         , GNUNET_BLOCK_Type data_type = GNUNET_BLOCK_TYPE_TEST
         , unsigned int replication = 5
         , GNUNET_DHT_RouteOption routing_options = GNUNET_DHT_RO_NONE
-        , std::function<void()> finishedCallback = nullptr);
+        , Function<void()> finishedCallback = nullptr
+        , std::stop_token stop = {});
     GetCallbackPack* get(const GNUNET_HashCode& key_hash, GetCallbackFunctor completedCallback
         , std::chrono::microseconds search_timeout = std::chrono::seconds(10)
         , GNUNET_BLOCK_Type data_type = GNUNET_BLOCK_TYPE_TEST
         , unsigned int replication = 5
         , GNUNET_DHT_RouteOption routing_options = GNUNET_DHT_RO_NONE
-        , std::function<void()> finishedCallback = nullptr);
-
+        , Function<void()> finishedCallback = nullptr
+        , std::stop_token stop = {});
 
+    /**
+     * @brief Searches the DHT for the given `key`. The generator version, ends once
+     * `search_timeout` has passed or early when `stop` is stopped
+     */
     GeneratorWrapper<std::string> get(const std::string_view key
         , std::chrono::microseconds search_timeout = std::chrono::seconds(10)
         , GNUNET_BLOCK_Type data_type = GNUNET_BLOCK_TYPE_TEST
         , unsigned int replication = 5
-        , GNUNET_DHT_RouteOption routing_options = GNUNET_DHT_RO_NONE);
+        , GNUNET_DHT_RouteOption routing_options = GNUNET_DHT_RO_NONE
+        , std::stop_token stop = {});
     GeneratorWrapper<std::string> get(GNUNET_HashCode key_hash
         , std::chrono::microseconds search_timeout = std::chrono::seconds(10)
         , GNUNET_BLOCK_Type data_type = GNUNET_BLOCK_TYPE_TEST
         , unsigned int replication = 5
-        , GNUNET_DHT_RouteOption routing_options = GNUNET_DHT_RO_NONE);
+        , GNUNET_DHT_RouteOption routing_options = GNUNET_DHT_RO_NONE
+        , std::stop_token stop = {});
+
+    /**
+     * @brief Inserts `data` into the DHT. The coroutine version, throws OperationCancelled
+     * when the awaiting task is stopped
+     */
 
     Task<> put(const std::string_view key, const std::string_view data
         , std::chrono::microseconds expiration = std::chrono::hours(1)
@@ -149,14 +168,32 @@ struct DHT : public Service
     }
 
 protected:
+    struct PutCallbackPack
+    {
+        PutCallbackFunctor callback;
+        GNUNET_DHT_PutHandle* handle = nullptr;
+        std::optional<StopCallback> on_stop;
+    };
+
     static void putCallback(void* cls)
     {
-        // ensure functor is deleted even if it throws
-        std::unique_ptr<PutCallbackFunctor> functor{static_cast<PutCallbackFunctor*>(cls)};
-        assert(functor != nullptr);
-        (*functor)();
+        // ensure pack is deleted even if it throws
+        detail::CallbackScope scope(detail::CallbackSite::DHT);
+        std::unique_ptr<PutCallbackPack> pack{static_cast<PutCallbackPack*>(cls)};
+        assert(pack != nullptr);
+        pack->on_stop.reset();
+        pack->callback();
     }
 
+    // Starts a search. Without `search_timeout` it only ends through `stop` or the callback
+    GetCallbackPack* startGet(const GNUNET_HashCode& key_hash, GetCallbackFunctor completedCallback
+        , std::optional<std::chrono::microseconds> search_timeout
+        , GNUNET_BLOCK_Type data_type
+        , unsigned int replication
+        , GNUNET_DHT_RouteOption routing_options
+        , Function<void()> finished_callback
+        , std::stop_token stop);
+
     static void getCallback(void *cls,
                            struct GNUNET_TIME_Absolute exp,
                            const struct GNUNET_HashCode *query_hash,
@@ -0,0 +1,233 @@
+#include "gnunetpp-epoll.hpp"
+
+#ifdef __linux__
+
+#include "inner/Infra.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace gnunetpp
+{
+EpollDriver::EpollDriver(std::function<void(const GNUNET_CONFIGURATION_Handle*)> f
+    , const std::string& service_name, const std::string& config_file)
+    : start_(std::move(f))
+{
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = timer_fd_;
+    if(epoll_fd_ < 0 || timer_fd_ < 0 || epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &event) != 0) {
+        if(epoll_fd_ >= 0)
+            close(epoll_fd_);
+        if(timer_fd_ >= 0)
+            close(timer_fd_);
+        throw std::runtime_error("Failed to create epoll instance");
+    }
+
+    GNUNET_log_setup(service_name.c_str(), "WARNING", nullptr);
+    cfg_ = GNUNET_CONFIGURATION_create();
+    if(GNUNET_CONFIGURATION_load(cfg_, config_file.empty() ? nullptr : config_file.c_str()) != GNUNET_OK) {
+        GNUNET_CONFIGURATION_destroy(cfg_);
+        close(epoll_fd_);
+        close(timer_fd_);
+        throw std::runtime_error("Failed to load GNUnet configuration");
+    }
+
+    driver_.cls = this;
+    driver_.add = &EpollDriver::onAdd;
+    driver_.del = &EpollDriver::onDel;
+    driver_.set_wakeup = &EpollDriver::onSetWakeup;
+    handle_ = GNUNET_SCHEDULER_driver_init(&driver_);
+    // Tasks added from the application's callbacks, like scheduler::queue(), must get run()
+    // called. GNUnet only reports the ones added while it runs through set_wakeup
+    detail::setDriverWakeup([this] {
+        if(!in_do_work_)
+            armTimer(0);
+    });
+    GNUNET_SCHEDULER_add_now([] (void* cls) {
+        auto self = static_cast<EpollDriver*>(cls);
+        self->started_ = true;
+        detail::startScheduler(self->cfg_, self->start_);
+    }, this);
+}
+
+EpollDriver::~EpollDriver()
+{
+    if(!done()) {
+        if(started_)
+            gnunetpp::shutdown();
+        else
+            GNUNET_SCHEDULER_shutdown();
+        pollfd pfd{epoll_fd_, POLLIN, 0};
+        while(!done()) {
+            poll(&pfd, 1, -1);
+            run();
+        }
+    }
+    detail::setDriverWakeup({});
+    GNUNET_SCHEDULER_driver_done(handle_);
+    GNUNET_CONFIGURATION_destroy(cfg_);
+    close(timer_fd_);
+    close(epoll_fd_);
+}
+
+bool EpollDriver::done() const
+{
+    return fds_.empty() && !wakeup_armed_;
+}
+
+void EpollDriver::run()
+{
+    epoll_event events[64];
+    int num_events = epoll_wait(epoll_fd_, events, 64, 0);
+    for(int i = 0; i < num_events; i++) {
+        int fd = events[i].data.fd;
+        if(fd == timer_fd_) {
+            uint64_t expirations;
+            [[maybe_unused]] auto len = read(timer_fd_, &expirations, sizeof(expirations));
+            continue;
+        }
+        auto it = fds_.find(fd);
+        if(it == fds_.end())
+            continue;
+        int happened = 0;
+        if(events[i].events & EPOLLIN)
+            happened |= GNUNET_SCHEDULER_ET_IN;
+        if(events[i].events & EPOLLOUT)
+            happened |= GNUNET_SCHEDULER_ET_OUT;
+        if(events[i].events & EPOLLPRI)
+            happened |= GNUNET_SCHEDULER_ET_PRI;
+        if(events[i].events & EPOLLHUP)
+            happened |= GNUNET_SCHEDULER_ET_HUP;
+        if(events[i].events & EPOLLERR)
+            happened |= GNUNET_SCHEDULER_ET_ERR;
+        markReady(it->second, happened);
+    }
+    if(always_ready_ != 0) {
+        for(auto& [fd, entry] : fds_) {
+            if(entry.always_ready)
+                markReady(entry, GNUNET_SCHEDULER_ET_IN | GNUNET_SCHEDULER_ET_OUT);
+        }
+    }
+
+    // GNUnet yields after a while when lots of tasks are ready. Come back right after
+    // the application had its turn
+    in_do_work_ = true;
+    bool more = GNUNET_SCHEDULER_do_work(handle_) == GNUNET_YES;
+    in_do_work_ = false;
+    if(more || always_ready_ != 0)
+        armTimer(0);
+}
+
+void EpollDriver::markReady(FdEntry& entry, int events)
+{
+    for(auto& registration : entry.registrations) {
+        // Errors and hangups are reported whatever the task waits for, like poll() does
+        int et = events & (registration.requested | GNUNET_SCHEDULER_ET_HUP | GNUNET_SCHEDULER_ET_ERR);
+        if(et == 0)
+            continue;
+        registration.fdi->et = static_cast<GNUNET_SCHEDULER_EventType>(et);
+        GNUNET_SCHEDULER_task_ready(registration.task, registration.fdi);
+    }
+}
+
+int EpollDriver::onAdd(void* cls, GNUNET_SCHEDULER_Task* task, GNUNET_SCHEDULER_FdInfo* fdi)
+{
+    auto self = static_cast<EpollDriver*>(cls);
+    int fd = fdi->sock;
+    if(fd < 0)
+        return GNUNET_SYSERR;
+    self->fds_[fd].registrations.push_back({task, fdi, static_cast<int>(fdi->et)});
+    self->task_fds_[task].push_back(fd);
+    self->updateEpoll(fd);
+    return GNUNET_OK;
+}
+
+int EpollDriver::onDel(void* cls, GNUNET_SCHEDULER_Task* task)
+{
+    auto self = static_cast<EpollDriver*>(cls);
+    auto it = self->task_fds_.find(task);
+    if(it == self->task_fds_.end())
+        return GNUNET_SYSERR;
+    auto fds = std::move(it->second);
+    self->task_fds_.erase(it);
+    for(int fd : fds) {
+        auto& registrations = self->fds_[fd].registrations;
+        std::erase_if(registrations, [task] (const Registration& registration) {
+            return registration.task == task;
+        });
+        self->updateEpoll(fd);
+    }
+    return GNUNET_OK;
+}
+
+void EpollDriver::onSetWakeup(void* cls, GNUNET_TIME_Absolute dt)
+{
+    auto self = static_cast<EpollDriver*>(cls);
+    if(dt.abs_value_us == GNUNET_TIME_UNIT_FOREVER_ABS.abs_value_us) {
+        itimerspec spec{};
+        timerfd_settime(self->timer_fd_, 0, &spec, nullptr);
+        self->wakeup_armed_ = false;
+        return;
+    }
+    self->armTimer(GNUNET_TIME_absolute_get_remaining(dt).rel_value_us);
+}
+
+void EpollDriver::armTimer(uint64_t delay_us)
+{
+    itimerspec spec{};
+    spec.it_value.tv_sec = delay_us / 1000000;
+    // A zero it_value disarms the timer
+    spec.it_value.tv_nsec = std::max<uint64_t>(delay_us % 1000000 * 1000, 1);
+    timerfd_settime(timer_fd_, 0, &spec, nullptr);
+    wakeup_armed_ = true;
+}
+
+void EpollDriver::updateEpoll(int fd)
+{
+    auto& entry = fds_[fd];
+    if(entry.registrations.empty()) {
+        if(entry.in_epoll)
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+        if(entry.always_ready)
+            always_ready_--;
+        fds_.erase(fd);
+        return;
+    }
+    if(entry.always_ready)
+        return;
+
+    epoll_event event{};
+    event.data.fd = fd;
+    for(auto& registration : entry.registrations) {
+        if(registration.requested & GNUNET_SCHEDULER_ET_IN)
+            event.events |= EPOLLIN;
+        if(registration.requested & GNUNET_SCHEDULER_ET_OUT)
+            event.events |= EPOLLOUT;
+        if(registration.requested & GNUNET_SCHEDULER_ET_PRI)
+            event.events |= EPOLLPRI;
+    }
+    if(epoll_ctl(epoll_fd_, entry.in_epoll ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event) == 0) {
+        entry.in_epoll = true;
+        return;
+    }
+    if(errno == EPERM) {
+        entry.always_ready = true;
+        always_ready_++;
+        armTimer(0);
+    }
+    else
+        GNUNET_assert(0 && "epoll_ctl failed");
+}
+
+}
+
+#endif
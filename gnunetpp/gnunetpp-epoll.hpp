@@ -0,0 +1,112 @@
+#pragma once
+
+#ifdef __linux__
+
+#include <gnunet/gnunet_util_lib.h>
+
+#include "inner/Function.hpp"
+#include "inner/NonCopyable.hpp"
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gnunetpp
+{
+/**
+ * @brief Runs GNUnet inside an event loop owned by the application instead of on its own
+ * thread with gnunetpp::run().
+ *
+ * GNUnet is driven through GNUNET_SCHEDULER_driver_init(). Everything GNUnet waits on
+ * (sockets, its timeout) is collected in an internal epoll instance whose fd the
+ * application adds to its own epoll set (or poll/select). Whenever that fd is readable,
+ * call run(). GNUnet then runs on the application's thread, so callbacks from the
+ * application's reactor may call into gnunetpp directly, without queue() and a wakeup.
+ *
+ * @code
+ * EpollDriver driver(service);
+ * epoll_event ev{EPOLLIN, {.ptr = &driver}};
+ * epoll_ctl(app_epoll, EPOLL_CTL_ADD, driver.fd(), &ev);
+ * while(!driver.done()) {
+ *     int n = epoll_wait(app_epoll, events, max_events, -1);
+ *     for(...) if(events[i].data.ptr == &driver) driver.run(); else ...;
+ * }
+ * @endcode
+ */
+struct EpollDriver : public NonCopyable
+{
+    /**
+     * @brief Starts GNUnet. `f` is called from the first run()
+     *
+     * @param f Callback to call when GNUnet is started
+     * @param service_name name used for logging
+     * @param config_file GNUnet configuration to load. Empty for the default one
+     */
+    explicit EpollDriver(std::function<void(const GNUNET_CONFIGURATION_Handle*)> f
+        , const std::string& service_name = "gnunetpp", const std::string& config_file = "");
+
+    /**
+     * @brief Shuts GNUnet down if it is still running and runs its loop until it is done
+     */
+    ~EpollDriver();
+
+    /**
+     * @brief The fd to add to the application's event loop. Readable whenever run() has work
+     */
+    int fd() const
+    {
+        return epoll_fd_;
+    }
+
+    /**
+     * @brief Runs the GNUnet tasks that are ready. Never blocks
+     */
+    void run();
+
+    /**
+     * @brief True once GNUnet has nothing left to wait on, ie. after gnunetpp::shutdown()
+     */
+    bool done() const;
+
+protected:
+    struct Registration
+    {
+        GNUNET_SCHEDULER_Task* task;
+        GNUNET_SCHEDULER_FdInfo* fdi;
+        // What GNUnet asked for. fdi->et is overwritten with what happened
+        int requested;
+    };
+
+    struct FdEntry
+    {
+        std::vector<Registration> registrations;
+        bool in_epoll = false;
+        // epoll refuses regular files. Like select() we treat them as always ready
+        bool always_ready = false;
+    };
+
+    static int onAdd(void* cls, GNUNET_SCHEDULER_Task* task, GNUNET_SCHEDULER_FdInfo* fdi);
+    static int onDel(void* cls, GNUNET_SCHEDULER_Task* task);
+    static void onSetWakeup(void* cls, GNUNET_TIME_Absolute dt);
+
+    void updateEpoll(int fd);
+    void armTimer(uint64_t delay_us);
+    void markReady(FdEntry& entry, int events);
+
+    GNUNET_SCHEDULER_Driver driver_;
+    GNUNET_SCHEDULER_Handle* handle_ = nullptr;
+    GNUNET_CONFIGURATION_Handle* cfg_ = nullptr;
+    int epoll_fd_ = -1;
+    int timer_fd_ = -1;
+    bool wakeup_armed_ = false;
+    bool started_ = false;
+    bool in_do_work_ = false;
+    size_t always_ready_ = 0;
+    std::unordered_map<int, FdEntry> fds_;
+    std::unordered_map<GNUNET_SCHEDULER_Task*, std::vector<int>> task_fds_;
+    Function<void(const GNUNET_CONFIGURATION_Handle*)> start_;
+};
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include "gnunetpp-fs.hpp"
 #include "gnunetpp-identity.hpp"
+#include "inner/Instrumentation.hpp"
 
 #include <stdexcept>
 #include <iostream>
@@ -22,6 +23,8 @@ void* fs_callback_trampoline(void *cls, const struct GNUNET_FS_ProgressInfo *inf
     // HCAK: 
     if(info->status == GNUNET_FS_STATUS_DOWNLOAD_SUSPEND)
         return nullptr;
+    gnunetpp::detail::CallbackScope scope(gnunetpp::detail::CallbackSite::FS);
+    gnunetpp::detail::ResumeBatch batch;
     auto pack = reinterpret_cast<detail::FSCallbackData*>(cls);
     pack->fn(info);
     return nullptr;
@@ -30,7 +33,7 @@ void* fs_callback_trampoline(void *cls, const struct GNUNET_FS_ProgressInfo *inf
 GNUNET_FS_Handle* makeHandle(const GNUNET_CONFIGURATION_Handle* cfg, FSCallbackFunctor callback)
 {
     FSCallbackData* data = new FSCallbackData;
-    data->fn = callback;
+    data->fn = std::move(callback);
     GNUNET_FS_Handle* fs_handle = GNUNET_FS_start(cfg, "gnunetpp-fs", &fs_callback_trampoline
         , data, GNUNET_FS_FLAGS_NONE, GNUNET_FS_OPTIONS_END);
     if (!fs_handle) {
@@ -46,7 +49,7 @@ GNUNET_FS_Handle* makeHandle(const GNUNET_CONFIGURATION_Handle* cfg, FSCallbackF
 GNUNET_FS_Handle* makeHandle(const GNUNET_CONFIGURATION_Handle* cfg, FSCallbackFunctor callback, unsigned download_parallelism, unsigned request_parallelism)
 {
     FSCallbackData* data = new FSCallbackData;
-    data->fn = callback;
+    data->fn = std::move(callback);
     GNUNET_FS_Handle* fs_handle = GNUNET_FS_start(cfg, "gnunetpp-fs", &fs_callback_trampoline
         , data, GNUNET_FS_FLAGS_NONE, GNUNET_FS_OPTIONS_DOWNLOAD_PARALLELISM, download_parallelism
         , GNUNET_FS_OPTIONS_REQUEST_PARALLELISM, request_parallelism
@@ -147,13 +150,23 @@ static int publish_inspector (void *cls, GNUNET_FS_FileInformation *fi, uint64_t
 GNUNET_FS_SearchContext* search(
     const GNUNET_CONFIGURATION_Handle* cfg,
     const std::vector<std::string>& keywords,
-    std::function<bool(const std::string_view, const std::string_view)> fn,
+    Function<bool(const std::string_view, const std::string_view)> fn,
     std::chrono::microseconds timeout,
     GNUNET_FS_SearchOptions options,
-    unsigned anonymity_level)
+    unsigned anonymity_level,
+    std::stop_token stop)
 {
+    if(stop.stop_requested())
+        throw OperationCancelled();
     auto fs_handle = detail::makeHandle(cfg, [fn=std::move(fn)](const GNUNET_FS_ProgressInfo * info){
+        // The search is over or about to be stopped, a stop request has nothing left to do
+        auto forget_stop = [fsh=info->fsh]() {
+            auto it = detail::g_fs_handlers.find(fsh);
+            if(it != detail::g_fs_handlers.end())
+                it->second->on_stop.reset();
+        };
         if(info->status == GNUNET_FS_STATUS_SEARCH_STOPPED) {
+            forget_stop();
             scheduler::queue([fsh=info->fsh](){
                 auto it = detail::g_fs_handlers.find(fsh);
                 assert(it != detail::g_fs_handlers.end());
@@ -170,6 +183,7 @@ GNUNET_FS_SearchContext* search(
         }
         else if(info->status == GNUNET_FS_STATUS_SEARCH_ERROR) {
             std::cerr << "GNUNet++: FS  Search Error: " << info->value.search.specifics.error.message << std::endl;
+            forget_stop();
             auto it = detail::g_fs_handlers.find(info->fsh);
             assert(it != detail::g_fs_handlers.end());
             assert(it->second->fs = info->fsh);
@@ -187,6 +201,7 @@ GNUNET_FS_SearchContext* search(
         GNUNET_free_nz(filename);
         GNUNET_free_nz(uri);
         if(keep_running == false) {
+            forget_stop();
             auto it = detail::g_fs_handlers.find(info->fsh);
             assert(it != detail::g_fs_handlers.end());
             assert(it->second->fs = info->fsh);
@@ -215,9 +230,18 @@ GNUNET_FS_SearchContext* search(
 
     TaskID timeout_task = scheduler::runLater(timeout, [fs_handle, search, pack](){
         pack->timeout_task = 0;
+        pack->on_stop.reset();
         GNUNET_FS_search_stop(search);
     }, true);
     pack->timeout_task = timeout_task;
+    if(stop.stop_possible()) {
+        pack->on_stop.emplace(std::move(stop), [pack]() {
+            scheduler::cancel(pack->timeout_task);
+            pack->timeout_task = 0;
+            // Reports SEARCH_STOPPED right away, which releases this callback
+            GNUNET_FS_search_stop(pack->sc);
+        });
+    }
 
     GNUNET_FS_uri_destroy(uri);
     return search;
@@ -237,8 +261,11 @@ GNUNET_FS_DownloadContext* download(
     DownloadCallbackFunctor fn,
     unsigned anonymity_level,
     unsigned download_parallelism,
-    unsigned request_parallelism)
+    unsigned request_parallelism,
+    std::stop_token stop)
 {
+    if(stop.stop_requested())
+        throw OperationCancelled();
     char** error_msg = NULL;
     auto gnet_uri = GNUNET_FS_uri_parse(uri.c_str(), error_msg);
     if(gnet_uri == NULL)
@@ -262,12 +289,19 @@ GNUNET_FS_DownloadContext* download(
                 GNUNET_FS_stop(fsh);
                 delete pack;
             };
+        auto forget_stop = [fsh=info->fsh]() {
+            auto it = detail::g_fs_handlers.find(fsh);
+            if(it != detail::g_fs_handlers.end())
+                it->second->on_stop.reset();
+        };
         if(info->status == GNUNET_FS_STATUS_DOWNLOAD_STOPPED) {
+            forget_stop();
             fn(DownloadStatus::Cancelled, "Download cancelled", 0, 0);
             scheduler::queue(safe_cleanup);
             return;
         }
         else if(info->status == GNUNET_FS_STATUS_DOWNLOAD_ERROR) {
+            forget_stop();
             fn(DownloadStatus::Error, "Download error: " + std::string(info->value.download.specifics.error.message), 0, 0);
             scheduler::queue(safe_cleanup);
         }
@@ -278,6 +312,7 @@ GNUNET_FS_DownloadContext* download(
             fn(DownloadStatus::Progress, filename, downloaded, total_size);
         }
         else if(info->status == GNUNET_FS_STATUS_DOWNLOAD_COMPLETED) {
+            forget_stop();
             fn(DownloadStatus::Completed, "Download completed", 0, 0);
             scheduler::queue(safe_cleanup);
         }
@@ -290,8 +325,15 @@ GNUNET_FS_DownloadContext* download(
     GNUNET_FS_DownloadOptions options = GNUNET_FS_DOWNLOAD_OPTION_RECURSIVE;
     GNUNET_FS_DownloadContext* download = GNUNET_FS_download_start(fs_handle, gnet_uri, NULL, filename.c_str(), NULL, 0
         , GNUNET_FS_uri_chk_get_file_size(gnet_uri), anonymity_level, options, NULL, NULL);
-    detail::g_fs_handlers[fs_handle]->dc = download;
+    auto pack = detail::g_fs_handlers[fs_handle];
+    pack->dc = download;
     GNUNET_FS_uri_destroy(gnet_uri);
+    if(stop.stop_possible() && download != NULL) {
+        pack->on_stop.emplace(std::move(stop), [pack]() {
+            // Reports DOWNLOAD_STOPPED right away, which releases this callback
+            GNUNET_FS_download_stop(pack->dc, GNUNET_NO);
+        });
+    }
     return download;
 }
 
@@ -345,7 +387,6 @@ void publish(
             assert(it != detail::g_fs_handlers.end());
             assert(it->second->fs = info->fsh);
             auto pack = it->second;
-            auto fn = pack->fn;
             std::cerr << "GNUNet++ publish error: " << info->value.publish.specifics.error.message << std::endl;
             if(cb)
                 cb(PublishResult::Error, "", "");
@@ -415,6 +456,7 @@ Task<std::pair<std::string, std::string>> publish(
             const std::string& next_id,
             GNUNET_FS_BlockOptions block_options)
         {
+            describe("FS publish", [&] { return filename; });
             publish(cfg, filename, keywords, [this](PublishResult result, const std::string& uri, const std::string& namespace_uri){
                 if(result == PublishResult::Success)
                     this->setValue(std::make_pair(uri, namespace_uri));
@@ -491,6 +533,7 @@ Task<> unindex(const GNUNET_CONFIGURATION_Handle* cfg, const std::string& filena
     struct UnindexAwaiter : public EagerAwaiter<> {
         UnindexAwaiter(const GNUNET_CONFIGURATION_Handle* cfg, const std::string& filename)
         {
+            describe("FS unindex", [&] { return filename; });
             unindex(cfg, filename, [this](bool success, const std::string& message){
                 if(success)
                     setValue();
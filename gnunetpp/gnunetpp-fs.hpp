@@ -13,6 +13,7 @@
 #include <chrono>
 #include <memory>
 #include <map>
+#include <optional>
 
 namespace gnunetpp::FS
 {
@@ -21,10 +22,10 @@ enum class PublishResult
     Success,
     Error
 };
-using FSCallbackFunctor = std::function<void(const GNUNET_FS_ProgressInfo *)>;
-using ScanCallbackFunctor = std::function<void(GNUNET_FS_DirScanner*, const std::string&, bool, GNUNET_FS_DirScannerProgressUpdateReason)>;
-using PublishCallbackFunctor = std::function<void(PublishResult, const std::string&, const std::string&)>;
-using UnindexCallbackFunctor = std::function<void(bool, const std::string&)>;
+using FSCallbackFunctor = Function<void(const GNUNET_FS_ProgressInfo *)>;
+using ScanCallbackFunctor = Function<void(GNUNET_FS_DirScanner*, const std::string&, bool, GNUNET_FS_DirScannerProgressUpdateReason)>;
+using PublishCallbackFunctor = Function<void(PublishResult, const std::string&, const std::string&)>;
+using UnindexCallbackFunctor = Function<void(bool, const std::string&)>;
 namespace detail
 {
 struct FSCallbackData
@@ -35,6 +36,7 @@ struct FSCallbackData
     GNUNET_FS_DownloadContext* dc;
     GNUNET_FS_UnindexContext* uc;
     TaskID timeout_task;
+    std::optional<StopCallback> on_stop;
 };
 struct ScanCallbackData
 {
@@ -57,15 +59,17 @@ static GNUNET_FS_BlockOptions default_block_options = { { 0LL }, 1, 365, 1 };
  * @param timeout how long to wait for results
  * @param options search options
  * @param anonymity_level the anonymity level to use for the search (> 1 uses GAP for anonymity)
+ * @param stop stops the search when stopped
  * @return GNUNET_FS_SearchContext* handle to the operation. Can be used to cancel the search.
  */
 GNUNET_FS_SearchContext* search(
     const GNUNET_CONFIGURATION_Handle* cfg,
     const std::vector<std::string>& keywords,
-    std::function<bool(const std::string_view, const std::string_view)> fn,
+    Function<bool(const std::string_view, const std::string_view)> fn,
     std::chrono::microseconds timeout = std::chrono::seconds(30),
     GNUNET_FS_SearchOptions options = GNUNET_FS_SEARCH_OPTION_NONE,
-    unsigned anonymity_level = 1);
+    unsigned anonymity_level = 1,
+    std::stop_token stop = {});
 
 enum class DownloadStatus
 {
@@ -76,7 +80,7 @@ enum class DownloadStatus
     Cancelled
 };
 
-using DownloadCallbackFunctor = std::function<void(DownloadStatus, const std::string&, size_t, size_t)>;
+using DownloadCallbackFunctor = Function<void(DownloadStatus, const std::string&, size_t, size_t)>;
 
 /**
  * @brief Downloads a file from the File Share.
@@ -88,6 +92,8 @@ using DownloadCallbackFunctor = std::function<void(DownloadStatus, const std::st
  * @param anonymity_level the anonymity level to use for the download (> 1 uses GAP for anonymity)
  * @param download_parallelism Number of parallel downloads to use
  * @param request_parallelism Number of requests to send in parallel
+ * @param stop stops the download when stopped, `fn` gets DownloadStatus::Cancelled. Data
+ * downloaded so far is kept
  * @return GNUNET_FS_DownloadContext* handle to the operation. Can be used to cancel the download.
  */
 GNUNET_FS_DownloadContext* download(
@@ -97,7 +103,8 @@ GNUNET_FS_DownloadContext* download(
     DownloadCallbackFunctor fn,
     unsigned anonymity_level = 1,
     unsigned download_parallelism = 16,
-    unsigned request_parallelism = 4092);
+    unsigned request_parallelism = 4092,
+    std::stop_token stop = {});
 
 /**
  * @brief Publishes a file to the File Share.
@@ -16,6 +16,7 @@ struct GnsCallbackPack
     GNUNET_GNS_LookupWithTldRequest* lr = nullptr;
     TaskID timeout_id = 0;
     uint32_t record_type = GNUNET_GNSRECORD_TYPE_ANY;
+    std::optional<StopCallback> on_stop;
 };
 
 static void process_lookup_result (void *cls,
@@ -47,6 +48,7 @@ static void process_lookup_result (void *cls,
 
         results.emplace_back(std::move(type_string), std::move(rd_string));
     }
+    pack->on_stop.reset();
     pack->cb(std::move(results));
 
     scheduler::cancel(pack->timeout_id);
@@ -72,13 +74,17 @@ void GNS::shutdown()
     gns = nullptr;
 }
 
-void GNS::lookup(const std::string &name, std::chrono::milliseconds timeout, GnsCallback cb,
-    GnsErrorCallback err_cb, uint32_t record_type, bool dns_compatability_check, GNUNET_GNS_LocalOptions options)
+// Starts a lookup. Without `timeout` it only ends with a result or through `stop`
+static void startLookup(GNUNET_GNS_Handle* gns, const std::string &name, std::optional<std::chrono::milliseconds> timeout
+    , GnsCallback cb, GnsErrorCallback err_cb, uint32_t record_type, bool dns_compatability_check
+    , GNUNET_GNS_LocalOptions options, std::stop_token stop)
 {
     std::string lookup_name = name;
 
     if(gns == nullptr)
         throw std::runtime_error("GNS service not connected");
+    if(stop.stop_requested())
+        throw OperationCancelled();
     if(dns_compatability_check) {
         if(GNUNET_DNSPARSER_check_name(name.c_str()) != GNUNET_OK)
             throw std::runtime_error("Name not valid with DNS");
@@ -91,44 +97,73 @@ void GNS::lookup(const std::string &name, std::chrono::milliseconds timeout, Gns
 
     auto pack = new GnsCallbackPack;
     auto lr = GNUNET_GNS_lookup_with_tld(gns, lookup_name.c_str(), record_type, options, process_lookup_result, pack);
-    auto timeout_id = scheduler::runLater(timeout, [pack]() {
-        pack->err_cb("Timeout");
-        GNUNET_GNS_lookup_with_tld_cancel(pack->lr);
-        delete pack;
-    }, true);
+    if(timeout) {
+        pack->timeout_id = scheduler::runLater(*timeout, [pack]() {
+            pack->on_stop.reset();
+            pack->err_cb("Timeout");
+            GNUNET_GNS_lookup_with_tld_cancel(pack->lr);
+            delete pack;
+        }, true);
+    }
     pack->cb = std::move(cb);
     pack->err_cb = std::move(err_cb);
     pack->record_type = record_type;
     pack->lr = lr;
-    pack->timeout_id = timeout_id;
+    if(stop.stop_possible()) {
+        pack->on_stop.emplace(std::move(stop), [pack]() {
+            GNUNET_GNS_lookup_with_tld_cancel(pack->lr);
+            scheduler::cancel(pack->timeout_id);
+            auto err_cb = std::move(pack->err_cb);
+            delete pack;
+            err_cb("Cancelled");
+        });
+    }
+}
+
+void GNS::lookup(const std::string &name, std::chrono::milliseconds timeout, GnsCallback cb,
+    GnsErrorCallback err_cb, uint32_t record_type, bool dns_compatability_check, GNUNET_GNS_LocalOptions options,
+    std::stop_token stop)
+{
+    startLookup(gns, name, timeout, std::move(cb), std::move(err_cb), record_type, dns_compatability_check, options
+        , std::move(stop));
 }
 
 void GNS::lookup(const std::string &name, std::chrono::milliseconds timeout, GnsCallback cb,
-    GnsErrorCallback err_cb, const std::string_view record_type, bool dns_compatability_check, GNUNET_GNS_LocalOptions options)
+    GnsErrorCallback err_cb, const std::string_view record_type, bool dns_compatability_check, GNUNET_GNS_LocalOptions options,
+    std::stop_token stop)
 {
     uint32_t type = GNUNET_GNSRECORD_typename_to_number(record_type.data());
     if(type == UINT32_MAX)
         throw std::runtime_error("Invalid record type");
-    lookup(name, timeout, std::move(cb), std::move(err_cb), type, dns_compatability_check, options);
+    lookup(name, timeout, std::move(cb), std::move(err_cb), type, dns_compatability_check, options, std::move(stop));
 }
 
 Task<std::vector<std::pair<std::string, std::string>>> GNS::lookup(const std::string &name, std::chrono::milliseconds timeout,
     uint32_t record_type, bool dns_compatability, GNUNET_GNS_LocalOptions options)
 {
-    struct RecordAwaiter : public EagerAwaiter<std::vector<std::pair<std::string, std::string>>>
+    using Records = std::vector<std::pair<std::string, std::string>>;
+    struct RecordAwaiter : public EagerAwaiter<Records>
     {
-        RecordAwaiter(GNS& gns, const std::string& name, std::chrono::milliseconds timeout,
-            uint32_t record_type, bool dns_compatability, GNUNET_GNS_LocalOptions options)
+        RecordAwaiter(GNUNET_GNS_Handle* gns, const std::string& name, uint32_t record_type, bool dns_compatability,
+            GNUNET_GNS_LocalOptions options, std::stop_token stop)
         {
-            gns.lookup(name, timeout, [this](std::vector<std::pair<std::string, std::string>> results) {
+            describe("GNS lookup", [&] { return name; });
+            startLookup(gns, name, std::nullopt, [this](Records results) {
                 setValue(std::move(results));
-            }, [this](const std::string& err){
-                auto exception = std::make_exception_ptr(std::runtime_error(err));
-                setException(exception);
-            }, record_type, dns_compatability, options);
+            }, [this, stop](const std::string& err){
+                if(stop.stop_requested())
+                    setException(std::make_exception_ptr(OperationCancelled()));
+                else
+                    setException(std::make_exception_ptr(std::runtime_error(err)));
+            }, record_type, dns_compatability, options, stop);
         }
     };
-    co_return co_await RecordAwaiter(*this, name, timeout, record_type, dns_compatability, options);
+    // The timeout stops the lookup through its stop token, like any other cancellation
+    auto lookupRecords = [&]() -> Task<Records> {
+        auto stop = co_await currentStopToken();
+        co_return co_await RecordAwaiter(gns, name, record_type, dns_compatability, options, std::move(stop));
+    };
+    co_return co_await scheduler::withTimeout(lookupRecords(), timeout);
 }
 
 Task<std::vector<std::pair<std::string, std::string>>> GNS::lookup(const std::string &name, std::chrono::milliseconds timeout,
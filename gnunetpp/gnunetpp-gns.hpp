@@ -11,8 +11,8 @@
 namespace gnunetpp
 {
 
-using GnsCallback = std::function<void(const std::vector<std::pair<std::string, std::string>> &)>;
-using GnsErrorCallback = std::function<void(const std::string &)>;
+using GnsCallback = Function<void(const std::vector<std::pair<std::string, std::string>> &)>;
+using GnsErrorCallback = Function<void(const std::string &)>;
 struct GNS : public Service
 {
 
@@ -32,6 +32,7 @@ struct GNS : public Service
      * @param cb Callback to call when the lookup is completed.
      * @param record_type The type of record to lookup. Defaults to ANY.
      * @param dns_compatability_check If true, the record must also be a valid format for DNS.
+     * @param stop Cancels the lookup when stopped. `err_cb` is called with "Cancelled"
      * 
      * @note dns_compatability_check doesn't mean GNS will lookup the record in DNS, it just means
      * that the name must also conform to DNS standards (ex, each label must be less than 63
@@ -42,13 +43,15 @@ struct GNS : public Service
                 , GnsErrorCallback err_cb
                 , uint32_t record_type = GNUNET_GNSRECORD_TYPE_ANY
                 , bool dns_compatability_check = true
-                , GNUNET_GNS_LocalOptions options = GNUNET_GNS_LO_DEFAULT);
+                , GNUNET_GNS_LocalOptions options = GNUNET_GNS_LO_DEFAULT
+                , std::stop_token stop = {});
     void lookup(const std::string &name, std::chrono::milliseconds timeout
                 , GnsCallback cb
                 , GnsErrorCallback err_cb
                 , const std::string_view record_type
                 , bool dns_compatability_check = true
-                , GNUNET_GNS_LocalOptions options = GNUNET_GNS_LO_DEFAULT);
+                , GNUNET_GNS_LocalOptions options = GNUNET_GNS_LO_DEFAULT
+                , std::stop_token stop = {});
     
     /**
      * @brief Lookup a name in the GNS. The coroutine version.
@@ -56,7 +59,9 @@ struct GNS : public Service
      * @param name Domain name to lookup (e.g. "gnunet.org")
      * @param timeout Timeout for the lookup
      * @param record_type The type of record to lookup. Defaults to ANY.
-     * @return Task<std::vector<std::string>> awiat to get the result
+     * @return Task<std::vector<std::string>> awiat to get the result. Throws
+     * scheduler::TimeoutError when it takes longer than `timeout` and OperationCancelled
+     * when the awaiting task is stopped
      */
     [[nodiscard]]
     Task<std::vector<std::pair<std::string, std::string>>> lookup(const std::string &name
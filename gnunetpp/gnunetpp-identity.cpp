@@ -119,6 +119,7 @@ Task<const GNUNET_IDENTITY_PrivateKey*> IdentityService::createIdentity(const st
     {
         IdentityCreateAwaiter(IdentityService* identity, const std::string& name, GNUNET_IDENTITY_KeyType type)
         {
+            describe("Identity create", [&] { return name; });
             identity->createIdentity(name, [this](const GNUNET_IDENTITY_PrivateKey* sk, const std::string& err){
                 if(err.empty()) {
                     setValue(sk);
@@ -144,6 +145,7 @@ Task<> IdentityService::deleteIdentity(const std::string& name)
     {
         IdentityDeleteAwaiter(IdentityService* identity, const std::string& name)
         {
+            describe("Identity delete", [&] { return name; });
             identity->deleteIdentity(name, [this](const std::string& err){
                 if(err.empty()) {
                     setValue();
@@ -170,6 +172,7 @@ Task<std::optional<Ego>> getEgo(const GNUNET_CONFIGURATION_Handle* cfg
     {
         EgoLookupAwaiter(const GNUNET_CONFIGURATION_Handle* cfg, const std::string& name)
         {
+            describe("Ego lookup", [&] { return name; });
             auto handle = getEgo(cfg, name, [this](std::optional<Ego> ego){
                 setValue(ego);
             });
@@ -195,6 +198,7 @@ void getIdentities(const GNUNET_CONFIGURATION_Handle* cfg, std::function<void(co
 GeneratorWrapper<std::pair<std::string, Ego>> getIdentities(const GNUNET_CONFIGURATION_Handle *cfg)
 {
     auto awaiter = std::make_unique<QueuedAwaiter<std::pair<std::string, Ego>>>();
+    awaiter->describe("Identity list");
     getIdentities(cfg, [awaiter=awaiter.get()](const std::string& name, GNUNET_IDENTITY_Ego* ego){
         if(name != "")
             awaiter->addValue(std::make_pair(name, Ego(ego)));
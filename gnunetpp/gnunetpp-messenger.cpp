@@ -161,6 +161,7 @@ Task<> Messenger::waitForInit()
     struct Awaiter : public EagerAwaiter<>
     {
         Awaiter(Messenger* messenger) : messenger(messenger) {
+            describe("Messenger init");
             if(messenger->identity_set)
                 setValue();
             messenger->init_cbs.push_back([this] () {
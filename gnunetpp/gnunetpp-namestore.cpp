@@ -32,6 +32,8 @@ void Namestore::shutdown()
 struct LookupCallbackPack
 {
     std::function<void(std::vector<GNSRecord>)> cb;
+    GNUNET_NAMESTORE_QueueEntry* qe = nullptr;
+    std::optional<StopCallback> on_stop;
 };
 
 static void lookup_callback(void *cls,
@@ -76,6 +78,7 @@ static void lookup_callback(void *cls,
             records.push_back(std::move(record));
         }
     }
+    pack->on_stop.reset();
     pack->cb(std::move(records));
     delete pack;
 }
@@ -84,12 +87,16 @@ static void lookup_error_callback(void *cls)
 {
     GNUNET_assert(NULL != cls);
     auto pack = (LookupCallbackPack*)cls;
+    pack->on_stop.reset();
     pack->cb(std::vector<GNSRecord>());
     delete pack;
 }
 
-void Namestore::lookup(const GNUNET_IDENTITY_PrivateKey& zone, const std::string& label, std::function<void(std::vector<GNSRecord>)> cb)
+void Namestore::lookup(const GNUNET_IDENTITY_PrivateKey& zone, const std::string& label, std::function<void(std::vector<GNSRecord>)> cb
+    , std::stop_token stop)
 {
+    if(stop.stop_requested())
+        throw OperationCancelled();
     auto pack = new LookupCallbackPack();
     pack->cb = std::move(cb);
     auto entry = GNUNET_NAMESTORE_records_lookup(handle, &zone, label.c_str(), lookup_error_callback, pack, lookup_callback, pack);
@@ -97,6 +104,15 @@ void Namestore::lookup(const GNUNET_IDENTITY_PrivateKey& zone, const std::string
         delete pack;
         throw std::runtime_error("GNUNET_NAMESTORE_records_lookup returned NULL");
     }
+    pack->qe = entry;
+    if(stop.stop_possible()) {
+        pack->on_stop.emplace(std::move(stop), [pack]() {
+            GNUNET_NAMESTORE_cancel(pack->qe);
+            auto cb = std::move(pack->cb);
+            delete pack;
+            cb({});
+        });
+    }
 }
 
 struct StoreCallbackPack
@@ -156,15 +172,20 @@ Task<std::vector<GNSRecord>> Namestore::lookup(GNUNET_IDENTITY_PrivateKey zone,
 {
     struct LookupAwaiter : public EagerAwaiter<std::vector<GNSRecord>>
     {
-        LookupAwaiter(Namestore* ns, const GNUNET_IDENTITY_PrivateKey& zone, const std::string& label)
+        LookupAwaiter(Namestore* ns, const GNUNET_IDENTITY_PrivateKey& zone, const std::string& label, std::stop_token stop)
         {
-            ns->lookup(zone, label, [this](std::vector<GNSRecord> records) {
-                this->setValue(std::move(records));
-            });
+            describe("Namestore lookup", [&] { return label; });
+            ns->lookup(zone, label, [this, stop](std::vector<GNSRecord> records) {
+                if(stop.stop_requested())
+                    this->setException(std::make_exception_ptr(OperationCancelled()));
+                else
+                    this->setValue(std::move(records));
+            }, stop);
         }
     };
 
-    co_return co_await LookupAwaiter(this, zone, label);
+    auto stop = co_await currentStopToken();
+    co_return co_await LookupAwaiter(this, zone, label, std::move(stop));
 }
 
 Task<bool> Namestore::store(GNUNET_IDENTITY_PrivateKey zone, const std::string label, const std::string value, std::string type
@@ -175,6 +196,7 @@ Task<bool> Namestore::store(GNUNET_IDENTITY_PrivateKey zone, const std::string l
         StoreAwaiter(Namestore* ns, const GNUNET_IDENTITY_PrivateKey& zone, const std::string& label, const std::string& value, std::string type
         , std::chrono::seconds experation, bool publish)
         {
+            describe("Namestore store", [&] { return label; });
             uint64_t usec = std::chrono::duration_cast<std::chrono::microseconds>(experation).count();
             std::vector<GNSRecord> records;
             GNSRecord record;
@@ -198,6 +220,7 @@ Task<> Namestore::remove(GNUNET_IDENTITY_PrivateKey zone, const std::string labe
     {
         RemoveAwaiter(Namestore* ns, const GNUNET_IDENTITY_PrivateKey& zone, const std::string& label)
         {
+            describe("Namestore remove", [&] { return label; });
             ns->store(zone, label, {}, [this](bool success) {
                 this->setValue();
             });
@@ -32,8 +32,14 @@ struct Namestore : public Service
      * @param zone the zone to lookup the label under
      * @param label the label to lookup
      * @param cb a callback that is called with the records
+     * @param stop cancels the lookup when stopped. `cb` is called without records
+    */
+    void lookup(const GNUNET_IDENTITY_PrivateKey& zone, const std::string& label, std::function<void(std::vector<GNSRecord>)> cb
+        , std::stop_token stop = {});
+    /**
+     * @brief Lookup records for a given label. The coroutine version, throws OperationCancelled
+     * when the awaiting task is stopped
     */
-    void lookup(const GNUNET_IDENTITY_PrivateKey& zone, const std::string& label, std::function<void(std::vector<GNSRecord>)> cb);
     Task<std::vector<GNSRecord>> lookup(GNUNET_IDENTITY_PrivateKey zone, const std::string label);
     /**
      * @brief Store records for a given label under a given zone (ego/identity)
@@ -9,17 +9,21 @@ struct EstimateAwaiter : public CallbackAwaiter<>
 {
     EstimateAwaiter(NSE* nse) : nse(nse) {}
 
+    bool await_ready() const
+    {
+        return nse->estimate_.has_value();
+    }
+
     void await_suspend(std::coroutine_handle<> handle)
     {
-        if (nse->estimate_)
-            handle.resume();
-        else {
-            nse->observers_single_shot_.push_back([handle] (auto) {
-                handle.resume();
-            });
-        }
+        pending_.track(handle);
+        nse->observers_single_shot_.push_back([this, handle] (auto) {
+            pending_.untrack();
+            detail::resumeFromCallback(handle);
+        });
     }
     NSE* nse = nullptr;
+    detail::PendingOperation pending_{"NSE estimate"};
 };
 
 static void handle_estimate(void *cls,
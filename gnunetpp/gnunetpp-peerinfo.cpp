@@ -65,6 +65,7 @@ Task<std::set<GNUNET_PeerIdentity>> PeerInfo::peers()
         PeerInfoAwaiter(PeerInfo& pi)
             : pi(pi)
         {
+            describe("PeerInfo peers");
             pi.peers([this](const std::set<GNUNET_PeerIdentity> peers) {
                 setValue(peers);
             }, [this](const std::string_view err) {
@@ -95,6 +96,7 @@ Task<> PeerInfo::addPeer(std::shared_ptr<GNUNET_HELLO_Message> hello)
         PeerInfoAwaiter(PeerInfo& pi, std::shared_ptr<GNUNET_HELLO_Message> hello)
             : hello(std::move(hello))
         {
+            describe("PeerInfo add peer");
             pi.addPeer(this->hello, [this]() {
                 setValue();
             });
@@ -154,6 +156,7 @@ Task<std::shared_ptr<GNUNET_HELLO_Message>> gnunetpp::helloMessage(const GNUNET_
     {
         HelloAwaiter(const GNUNET_CONFIGURATION_Handle* cfg, GNUNET_TRANSPORT_AddressClass ac)
         {
+            describe("HELLO message");
             gnunetpp::helloMessage(cfg, ac, [this](std::shared_ptr<GNUNET_HELLO_Message> hello) {
                 if(hello) {
                     setValue(hello);
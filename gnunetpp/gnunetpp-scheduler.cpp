@@ -2,137 +2,959 @@
 #include <gnunet/gnunet_core_service.h>
 
 #include "inner/Infra.hpp"
-#include "inner/UniqueData.hpp"
+#include "inner/SlotMap.hpp"
+#include "inner/TimingWheel.hpp"
+#include "inner/ThreadPool.hpp"
+#include "inner/Watchdog.hpp"
 
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <bit>
+#include <algorithm>
 #include <cassert>
 #include <mutex>
+#include <shared_mutex>
 #include <random>
+#include <cstring>
 
 #include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <iostream>
 
 static std::mutex g_scheduler_mutex;
 
+namespace gnunetpp::detail
+{
+struct FdWaiter;
+
+// Shared by FdWatch and the GNUnet tasks it registers. Heap allocated so moving the watch
+// doesn't invalidate the task closures
+struct FdWatchState
+{
+    enum Direction
+    {
+        Read,
+        Write
+    };
+
+    struct Registration
+    {
+        // Created on first wait, reused for every following one
+        GNUNET_NETWORK_FDSet* fds = nullptr;
+        GNUNET_SCHEDULER_Task* task = nullptr;
+        FdWaiter* waiter = nullptr;
+    };
+
+    FdWatchState(int fd, GNUNET_SCHEDULER_Priority priority) : fd(fd), priority(priority) {}
+    ~FdWatchState();
+
+    void wait(Direction direction, FdWaiter* waiter);
+    void cancelWait(Direction direction);
+    // Resumes all waiters with OperationCancelled. The state may be gone afterwards
+    void cancelAll();
+
+    template <Direction direction>
+    static void onReady(void* cls);
+    static void onShutdown(void* cls);
+
+    int fd;
+    GNUNET_SCHEDULER_Priority priority;
+    std::array<Registration, 2> registrations;
+    GNUNET_SCHEDULER_Task* shutdown_task = nullptr;
+    bool shut_down = false;
+};
+
+struct FdWaiter : public CallbackAwaiter<>
+{
+    FdWaiter(FdWatchState* state, FdWatchState::Direction direction, std::stop_token stop)
+        : state_(state), direction_(direction), stop_(std::move(stop)) {}
+
+    // The awaiting coroutine was destroyed while waiting
+    ~FdWaiter()
+    {
+        if(state_ != nullptr)
+            state_->cancelWait(direction_);
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        GNUNET_assert(inMainThread());
+        if(stop_.stop_requested() || state_->shut_down) {
+            state_ = nullptr;
+            setException(std::make_exception_ptr(OperationCancelled()));
+            return false;
+        }
+        if(state_->registrations[direction_].waiter != nullptr) {
+            state_ = nullptr;
+            setException(std::make_exception_ptr(std::runtime_error(direction_ == FdWatchState::Read
+                ? "Another coroutine is already waiting for the fd to become readable"
+                : "Another coroutine is already waiting for the fd to become writable")));
+            return false;
+        }
+        handle_ = handle;
+        state_->wait(direction_, this);
+        pending_.describe(direction_ == FdWatchState::Read ? "fd readable" : "fd writable", [this] {
+            return std::to_string(state_->fd);
+        });
+        pending_.track(handle);
+        if(stop_.stop_possible()) {
+            on_stop_.emplace(stop_, [this] {
+                state_->cancelWait(direction_);
+                state_ = nullptr;
+                pending_.untrack();
+                setException(std::make_exception_ptr(OperationCancelled()));
+                handle_.resume();
+            });
+        }
+        return true;
+    }
+
+    void ready()
+    {
+        state_ = nullptr;
+        on_stop_.reset();
+        pending_.untrack();
+        CallbackScope scope(CallbackSite::Resume);
+        handle_.resume();
+    }
+
+    void cancelled()
+    {
+        state_ = nullptr;
+        on_stop_.reset();
+        pending_.untrack();
+        setException(std::make_exception_ptr(OperationCancelled()));
+        handle_.resume();
+    }
+
+    FdWatchState* state_;
+    FdWatchState::Direction direction_;
+    std::stop_token stop_;
+    std::coroutine_handle<> handle_;
+    std::optional<StopCallback> on_stop_;
+    PendingOperation pending_;
+};
+
+FdWatchState::~FdWatchState()
+{
+    if(shutdown_task != nullptr)
+        GNUNET_SCHEDULER_cancel(shutdown_task);
+    for(auto& registration : registrations) {
+        if(registration.fds != nullptr)
+            GNUNET_NETWORK_fdset_destroy(registration.fds);
+        registration.fds = nullptr;
+    }
+    cancelAll();
+}
+
+void FdWatchState::wait(Direction direction, FdWaiter* waiter)
+{
+    // GNUnet doesn't run select tasks on shutdown but waits for them to finish
+    if(shutdown_task == nullptr)
+        shutdown_task = GNUNET_SCHEDULER_add_shutdown(&FdWatchState::onShutdown, this);
+    auto& registration = registrations[direction];
+    if(registration.fds == nullptr) {
+        registration.fds = GNUNET_NETWORK_fdset_create();
+        GNUNET_NETWORK_fdset_set_native(registration.fds, fd);
+    }
+    registration.waiter = waiter;
+    if(direction == Read)
+        registration.task = GNUNET_SCHEDULER_add_select(priority, GNUNET_TIME_UNIT_FOREVER_REL, registration.fds, nullptr
+            , &FdWatchState::onReady<Read>, this);
+    else
+        registration.task = GNUNET_SCHEDULER_add_select(priority, GNUNET_TIME_UNIT_FOREVER_REL, nullptr, registration.fds
+            , &FdWatchState::onReady<Write>, this);
+}
+
+void FdWatchState::cancelWait(Direction direction)
+{
+    auto& registration = registrations[direction];
+    if(registration.task != nullptr)
+        GNUNET_SCHEDULER_cancel(registration.task);
+    registration.task = nullptr;
+    registration.waiter = nullptr;
+}
+
+void FdWatchState::cancelAll()
+{
+    std::array<FdWaiter*, 2> waiters{};
+    for(size_t i = 0; i < registrations.size(); i++) {
+        waiters[i] = registrations[i].waiter;
+        cancelWait(static_cast<Direction>(i));
+    }
+    // Resuming may destroy the watch. Don't touch `this` from here on
+    for(auto waiter : waiters) {
+        if(waiter != nullptr)
+            waiter->cancelled();
+    }
+}
+
+template <FdWatchState::Direction direction>
+void FdWatchState::onReady(void* cls)
+{
+    auto state = static_cast<FdWatchState*>(cls);
+    auto& registration = state->registrations[direction];
+    registration.task = nullptr;
+    std::exchange(registration.waiter, nullptr)->ready();
+}
+
+void FdWatchState::onShutdown(void* cls)
+{
+    auto state = static_cast<FdWatchState*>(cls);
+    state->shutdown_task = nullptr;
+    state->shut_down = true;
+    state->cancelAll();
+}
+
+// Virtual time, see scheduler::enableVirtualTime(). The random generator is seeded by the
+// user so simulated runs repeat exactly
+static std::atomic<bool> g_virtual_time{false};
+static std::atomic<uint64_t> g_virtual_now{0};
+static std::atomic<uint64_t> g_virtual_seed{0};
+static std::mutex g_virtual_rng_mutex;
+static std::mt19937_64 g_virtual_rng;
+
+std::chrono::microseconds jitterDelay(std::chrono::microseconds delay, double fraction)
+{
+    fraction = std::clamp(fraction, 0.0, 1.0);
+    if(delay.count() <= 0 || fraction == 0.0)
+        return delay;
+    std::uniform_real_distribution<double> dist(1.0 - fraction, 1.0);
+    if(g_virtual_time.load(std::memory_order_relaxed)) {
+        std::lock_guard lock(g_virtual_rng_mutex);
+        return std::chrono::microseconds(static_cast<int64_t>(delay.count() * dist(g_virtual_rng)));
+    }
+    thread_local std::mt19937_64 rng{std::random_device{}()};
+    return std::chrono::microseconds(static_cast<int64_t>(delay.count() * dist(rng)));
+}
+}
+
 namespace gnunetpp::scheduler
 {
 
+static GNUNET_SCHEDULER_Priority toGnunet(Priority priority)
+{
+    switch(priority) {
+        case Priority::Idle: return GNUNET_SCHEDULER_PRIORITY_IDLE;
+        case Priority::Background: return GNUNET_SCHEDULER_PRIORITY_BACKGROUND;
+        case Priority::Default: return GNUNET_SCHEDULER_PRIORITY_DEFAULT;
+        case Priority::High: return GNUNET_SCHEDULER_PRIORITY_HIGH;
+        case Priority::UI: return GNUNET_SCHEDULER_PRIORITY_UI;
+        case Priority::Urgent: return GNUNET_SCHEDULER_PRIORITY_URGENT;
+    }
+    GNUNET_assert(0 && "invalid priority");
+    return GNUNET_SCHEDULER_PRIORITY_DEFAULT;
+}
+static_assert(priority_count == GNUNET_SCHEDULER_PRIORITY_COUNT - 2, "Priority is out of sync with GNUNET_SCHEDULER_Priority");
+
 struct TaskData
 {
-    GNUNET_SCHEDULER_Task* handle;
-    std::function<void()> fn;
+    detail::TimerNode timer;
+    Function<void()> fn;
     bool repeat = false;
     bool run_on_shutdown = false;
+    std::chrono::microseconds delay{0};
+    RepeatOptions options;
+    // when the task is next due, in microseconds on the steady clock
+    uint64_t due = 0;
+    // when the timer was put into the wheel, relative to other timers
+    uint64_t armed = 0;
+    // ID handed out by runDelay() if the task was added from another thread
+    TaskID reserved = 0;
 };
 
-static detail::UniqueData<TaskData> g_tasks;
-static void timer_callback_trampoline(void* cls)
+// Only touched on the GNUnet thread, timers don't pay for a lock
+static detail::SlotMap<TaskData> g_tasks;
+
+// Tasks added from other threads get a reserved ID right away, the GNUnet thread puts them
+// into g_tasks later. Reserved IDs have an even generation, which a live handle never has
+static std::mutex g_reservation_mutex;
+static uint32_t g_next_reservation = 0;
+// Reserved but not in g_tasks yet. Cancelling one removes it from here so it's never added
+static std::unordered_set<TaskID> g_pending_reservations;
+// Reserved ID to handle in g_tasks. Only touched on the GNUnet thread
+static std::unordered_map<TaskID, TaskID> g_reserved_tasks;
+
+static bool isReservation(TaskID id)
+{
+    return id != 0 && (id >> 32) % 2 == 0;
+}
+
+static TaskID reserveTask()
+{
+    std::lock_guard lock(g_reservation_mutex);
+    uint64_t generation = 2 * (g_next_reservation++ % 0x7fffffff + 1);
+    TaskID id = generation << 32;
+    g_pending_reservations.insert(id);
+    return id;
+}
+
+static void removeTask(TaskID id)
+{
+    auto data = g_tasks.get(id);
+    if(data->reserved != 0)
+        g_reserved_tasks.erase(data->reserved);
+    g_tasks.remove(id);
+}
+
+// All timers share one wheel driven by a single GNUnet task that is armed for the
+// nearest deadline. Only touched from the GNUnet thread. The wheel task itself is
+// urgent. It runs urgent and default timers right away and hands the others to the
+// inbox of their priority, so the priority of a timer decides when it runs relative to
+// other ready work.
+static constexpr std::chrono::microseconds g_tick{1000};
+// Simulated time that passed while virtual time was on, so the clock never goes back
+static std::atomic<uint64_t> g_clock_offset{0};
+static uint64_t realNowUs()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+static uint64_t nowUs()
+{
+    if(detail::g_virtual_time.load(std::memory_order_relaxed))
+        return detail::g_virtual_now.load(std::memory_order_relaxed);
+    return realNowUs() + g_clock_offset.load(std::memory_order_relaxed);
+}
+static detail::TimingWheel g_wheel{nowUs() / g_tick.count()};
+static GNUNET_SCHEDULER_Task* g_wheel_task = nullptr;
+static uint64_t g_wheel_armed_tick = 0;
+static bool g_in_wheel_tick = false;
+static uint64_t g_arm_count = 0;
+
+// Rounds up so timers never fire early. With slack the tick is aligned to a coarser
+// boundary within the slack, so timers due around the same time share one wakeup
+static uint64_t deadlineTick(uint64_t due, std::chrono::microseconds slack)
+{
+    uint64_t tick = (due + g_tick.count() - 1) / g_tick.count();
+    uint64_t slack_ticks = slack.count() / g_tick.count();
+    if(slack_ticks > 1) {
+        uint64_t granularity = std::bit_floor(slack_ticks);
+        tick = (tick + granularity - 1) / granularity * granularity;
+    }
+    return tick;
+}
+
+static void onWheelTick(void*);
+static void onVirtualTick(void*);
+static void rearmWheel()
 {
-    auto start = std::chrono::steady_clock::now();
-    TaskID id = reinterpret_cast<TaskID>(cls);
-    auto& data = g_tasks[id];
-    data.fn();
-    if(data.repeat) {
-        auto end = std::chrono::steady_clock::now();
-        auto diff = end - start;
-        auto next_trigger_time = std::chrono::duration_cast<std::chrono::milliseconds>(diff);
-        GNUNET_TIME_Relative delay{(uint64_t)next_trigger_time.count()};
-        data.handle = GNUNET_SCHEDULER_add_delayed(delay, &timer_callback_trampoline, cls);
+    // The tick handler re-arms once it's done expiring timers
+    if(g_in_wheel_tick)
+        return;
+    auto next = g_wheel.nextDeadline();
+    if(!next) {
+        if(g_wheel_task != nullptr)
+            GNUNET_SCHEDULER_cancel(g_wheel_task);
+        g_wheel_task = nullptr;
+        return;
+    }
+    if(g_wheel_task != nullptr && g_wheel_armed_tick <= *next)
+        return;
+    if(g_wheel_task != nullptr)
+        GNUNET_SCHEDULER_cancel(g_wheel_task);
+
+    g_wheel_armed_tick = *next;
+    if(detail::g_virtual_time.load(std::memory_order_relaxed))
+        g_wheel_task = GNUNET_SCHEDULER_add_with_priority(GNUNET_SCHEDULER_PRIORITY_IDLE, onVirtualTick, nullptr);
+    else {
+        uint64_t now = nowUs();
+        uint64_t at = *next * g_tick.count();
+        GNUNET_TIME_Relative delay{at > now ? at - now : 0};
+        g_wheel_task = GNUNET_SCHEDULER_add_delayed_with_priority(delay, GNUNET_SCHEDULER_PRIORITY_URGENT, onWheelTick, nullptr);
+    }
+    detail::wakeDriver();
+}
+
+static void insertTimer(TaskData& data)
+{
+    data.armed = g_arm_count++;
+    g_wheel.insert(&data.timer, deadlineTick(data.due, data.options.slack));
+}
+
+// When a repeating task that just ran is due next
+static uint64_t nextDue(const TaskData& data)
+{
+    uint64_t now = nowUs();
+    uint64_t interval = std::max<uint64_t>(data.delay.count(), 1);
+    if(data.options.mode == RepeatMode::FixedDelay)
+        return now + data.delay.count();
+
+    uint64_t due = data.due + interval;
+    if(due <= now && data.options.overrun == OverrunPolicy::Skip)
+        due += ((now - due) / interval + 1) * interval;
+    return due;
+}
+
+static void fireTask(TaskID id)
+{
+    auto data = g_tasks.get(id);
+    if(data == nullptr)
+        return;
+    if(detail::instrumentationEnabled()) {
+        uint64_t now = nowUs();
+        detail::recordLoopLag(now > data->due ? (now - data->due) * 1000 : 0);
+    }
+    // fn may cancel its own task which destroys the slot, keep it alive on the stack
+    auto fn = std::move(data->fn);
+    {
+        detail::CallbackScope scope(detail::CallbackSite::Timer);
+        detail::ResumeBatch batch;
+        fn();
+    }
+
+    // Stale handle means the task got cancelled while running
+    data = g_tasks.get(id);
+    if(data == nullptr)
+        return;
+    if(data->repeat) {
+        data->fn = std::move(fn);
+        data->due = nextDue(*data);
+        insertTimer(*data);
+        // Timers handed to a priority inbox run after the wheel tick is over
+        rearmWheel();
     }
     else
-        g_tasks.remove(id);
+        removeTask(id);
+}
+
+// Expired timers that run at a priority of their own, collected over one wheel tick
+using TimerBatches = std::array<std::vector<TaskID>, priority_count>;
+
+static void dispatchTimer(TaskID id, size_t& fired, TimerBatches& batches)
+{
+    auto priority = g_tasks.get(id)->options.priority;
+    // Default is what plain runLater(), sleep() and service timeouts use. Don't make every
+    // one of them take a trip through the inbox
+    if(priority == Priority::Urgent || priority == Priority::Default) {
+        fireTask(id);
+        fired++;
+    }
+    else
+        batches[static_cast<size_t>(priority)].push_back(id);
+}
+
+static void postTimerBatches(TimerBatches& batches)
+{
+    for(size_t i = 0; i < batches.size(); i++) {
+        if(batches[i].empty())
+            continue;
+        detail::postToMainThread([ids = std::move(batches[i])] {
+            for(auto id : ids)
+                fireTask(id);
+            detail::recordBatch(ids.size());
+        }, toGnunet(static_cast<Priority>(i)));
+    }
 }
 
-static TaskID runDelay(std::chrono::microseconds delay, std::function<void()> fn, bool repeat, bool run_on_shutdown)
+static void onWheelTick(void*)
+{
+    g_wheel_task = nullptr;
+    g_in_wheel_tick = true;
+    size_t fired = 0;
+    TimerBatches batches;
+    if(!detail::g_virtual_time.load(std::memory_order_relaxed)) {
+        g_wheel.advance(nowUs() / g_tick.count(), [&fired, &batches] (detail::TimerNode* node) {
+            dispatchTimer(node->cookie, fired, batches);
+        });
+    }
+    else {
+        // The order timers leave the wheel in depends on where the clock started. Put
+        // them in deadline order, timers due on the same tick in the order they were armed.
+        // A seed shuffles the latter
+        std::vector<TaskID> expired;
+        g_wheel.advance(nowUs() / g_tick.count(), [&expired] (detail::TimerNode* node) {
+            expired.push_back(node->cookie);
+        });
+        auto key = [] (TaskID id) {
+            auto data = g_tasks.get(id);
+            return std::make_pair(data->timer.deadline, data->armed);
+        };
+        std::sort(expired.begin(), expired.end(), [&key] (TaskID a, TaskID b) {
+            return key(a) < key(b);
+        });
+        if(detail::g_virtual_seed.load(std::memory_order_relaxed) != 0) {
+            std::lock_guard lock(detail::g_virtual_rng_mutex);
+            for(auto begin = expired.begin(); begin != expired.end();) {
+                auto deadline = g_tasks.get(*begin)->timer.deadline;
+                auto end = std::find_if(begin, expired.end(), [deadline] (TaskID id) {
+                    return g_tasks.get(id)->timer.deadline != deadline;
+                });
+                std::shuffle(begin, end, detail::g_virtual_rng);
+                begin = end;
+            }
+        }
+        for(auto id : expired) {
+            // An urgent timer that ran before may have cancelled it
+            if(g_tasks.get(id) != nullptr)
+                dispatchTimer(id, fired, batches);
+        }
+    }
+    g_in_wheel_tick = false;
+    postTimerBatches(batches);
+    detail::recordBatch(fired);
+    rearmWheel();
+}
+
+// Runs once nothing else is ready. Nobody is waiting for real time to pass, so jump to the
+// next deadline right away
+static void onVirtualTick(void* cls)
+{
+    uint64_t at = g_wheel_armed_tick * g_tick.count();
+    if(at > detail::g_virtual_now.load(std::memory_order_relaxed))
+        detail::g_virtual_now.store(at, std::memory_order_relaxed);
+    onWheelTick(cls);
+}
+
+static void armTask(TaskID id)
+{
+    auto data = g_tasks.get(id);
+    if(data == nullptr)
+        return;
+    data->timer.cookie = id;
+    insertTimer(*data);
+    rearmWheel();
+}
+
+static TaskID runDelay(std::chrono::microseconds delay, Function<void()> fn, bool repeat, bool run_on_shutdown
+    , RepeatOptions options)
 {
     using namespace std::chrono;
     GNUNET_assert(delay.count() >= 0);
-    GNUNET_TIME_Relative time{(uint64_t)delay.count()};
-
-    auto [id, data] = g_tasks.add({nullptr, std::move(fn), repeat, run_on_shutdown});
-    static_assert(sizeof(TaskID) == sizeof(void*));
-    g_scheduler_mutex.lock();
-    auto handle = GNUNET_SCHEDULER_add_delayed(time,timer_callback_trampoline , reinterpret_cast<void*>(id));
-    g_scheduler_mutex.unlock();
-    data.handle = handle;
-    wakeUp();
-    return id;
+
+    // Take the due time now so the hop to the GNUnet thread doesn't delay the timer.
+    // FixedRate tasks are anchored to this point
+    uint64_t due = nowUs() + delay.count();
+    TaskData data{{}, std::move(fn), repeat, run_on_shutdown, delay, options, due};
+    if(inMainThread()) {
+        auto id = g_tasks.add(std::move(data)).first;
+        armTask(id);
+        return id;
+    }
+    // Neither the tasks nor the wheel are thread safe. Add and arm it on the GNUnet thread
+    auto reserved = reserveTask();
+    data.reserved = reserved;
+    queue([reserved, data = std::move(data)] () mutable {
+        {
+            std::lock_guard lock(g_reservation_mutex);
+            // Cancelled before it got here
+            if(g_pending_reservations.erase(reserved) == 0)
+                return;
+        }
+        auto id = g_tasks.add(std::move(data)).first;
+        g_reserved_tasks.emplace(reserved, id);
+        armTask(id);
+    });
+    return reserved;
 }
 
-TaskID runLater(std::chrono::microseconds delay, std::function<void()> fn, bool run_on_shutdown)
+TaskID runLater(std::chrono::microseconds delay, Function<void()> fn, bool run_on_shutdown
+    , std::chrono::microseconds slack, Priority priority)
 {
-    return runDelay(delay, std::move(fn), false, run_on_shutdown);
+    return runDelay(delay, std::move(fn), false, run_on_shutdown, RepeatOptions{.slack = slack, .priority = priority});
 }
 
-TaskID runEvery(std::chrono::microseconds delay, std::function<void()> fn)
+TaskID runEvery(std::chrono::microseconds delay, Function<void()> fn, RepeatOptions options)
 {
-    return runDelay(delay, std::move(fn), true, false);
+    return runDelay(delay, std::move(fn), true, false, options);
 }
 
-void runOnShutdown(std::function<void()> fn)
+void runOnShutdown(Function<void()> fn)
 {
     std::lock_guard lock{g_scheduler_mutex};
     GNUNET_SCHEDULER_add_shutdown([] (void *cls) {
-        auto fn = reinterpret_cast<std::function<void()>*>(cls);
+        auto fn = reinterpret_cast<Function<void()>*>(cls);
         (*fn)();
         delete fn;
-    }, new std::function<void()>(std::move(fn)));
+    }, new Function<void()>(std::move(fn)));
 }
 
-void queue(std::function<void()> fn)
+void queue(Function<void()> fn, Priority priority)
 {
-    std::lock_guard lock{g_scheduler_mutex};
-    GNUNET_SCHEDULER_add_now([] (void *cls) {
-        auto fn = reinterpret_cast<std::function<void()>*>(cls);
-        (*fn)();
-        delete fn;
-    }, new std::function<void()>(std::move(fn)));
-    wakeUp();
+    detail::postToMainThread(std::move(fn), toGnunet(priority));
+}
+
+QueueStats queueStats(Priority priority)
+{
+    auto stats = detail::inboxStats(toGnunet(priority));
+    return {stats.depth, stats.max_depth, stats.posted};
+}
+
+Task<> yield(Priority priority)
+{
+    struct YieldAwaiter : public CallbackAwaiter<>
+    {
+        YieldAwaiter(Priority priority) : priority_(priority) {}
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            queue([handle] {
+                detail::CallbackScope scope(detail::CallbackSite::Resume);
+                handle.resume();
+            }, priority_);
+        }
+        Priority priority_;
+    };
+    co_await YieldAwaiter(priority);
 }
 
 Task<> sleep(std::chrono::microseconds delay)
 {
     struct TimerAwaiter : public CallbackAwaiter<>
     {
-        TimerAwaiter(std::chrono::microseconds delay) : delay_(delay) {}
+        TimerAwaiter(std::chrono::microseconds delay, std::stop_token stop) : delay_(delay), stop_(std::move(stop)) {}
 
-        void await_suspend(std::coroutine_handle<> handle)
+        bool await_suspend(std::coroutine_handle<> handle)
         {
-            runLater(delay_, [handle] () mutable {
+            if(stop_.stop_requested()) {
+                setException(std::make_exception_ptr(OperationCancelled()));
+                return false;
+            }
+            id_ = runLater(delay_, [this, handle] () mutable {
+                on_stop_.reset();
+                pending_.untrack();
+                detail::CallbackScope scope(detail::CallbackSite::Resume);
                 handle.resume();
             }, false);
+            pending_.describe("sleep", [this] { return std::to_string(delay_.count()) + "us"; });
+            pending_.track(handle);
+            if(stop_.stop_possible()) {
+                on_stop_.emplace(stop_, [this, handle] () {
+                    cancel(id_);
+                    pending_.untrack();
+                    setException(std::make_exception_ptr(OperationCancelled()));
+                    handle.resume();
+                });
+            }
+            return true;
         }
         std::chrono::microseconds delay_;
+        std::stop_token stop_;
+        TaskID id_ = 0;
+        std::optional<StopCallback> on_stop_;
+        detail::PendingOperation pending_{"sleep"};
     };
-    co_await TimerAwaiter(delay);
+    auto stop = co_await currentStopToken();
+    co_await TimerAwaiter(delay, std::move(stop));
 }
 
 void cancel(TaskID id)
 {
-    auto& data = g_tasks[id];
-    std::lock_guard lock{g_scheduler_mutex};
-    GNUNET_SCHEDULER_cancel(data.handle);
-    g_tasks.remove(id);
+    if(!inMainThread()) {
+        queue([id] { cancel(id); });
+        return;
+    }
+    if(isReservation(id)) {
+        auto it = g_reserved_tasks.find(id);
+        if(it == g_reserved_tasks.end()) {
+            // Either gone already or not added yet. Make sure it never is
+            std::lock_guard lock(g_reservation_mutex);
+            g_pending_reservations.erase(id);
+            return;
+        }
+        id = it->second;
+    }
+    auto data = g_tasks.get(id);
+    // Already fired or cancelled
+    if(data == nullptr)
+        return;
+    g_wheel.remove(&data->timer);
+    removeTask(id);
+    // Don't keep the event loop alive for timers that no longer exist
+    if(g_wheel.empty())
+        rearmWheel();
 }
 
 void cancelAll()
 {
-    std::vector<TaskID> ids;
-    for(auto& [id, data] : g_tasks) {
-        if(data.run_on_shutdown)
-            data.fn();
-        GNUNET_SCHEDULER_cancel(data.handle);
-        ids.push_back(id);
+    for(auto id : g_tasks.handles()) {
+        auto data = g_tasks.get(id);
+        if(data == nullptr)
+            continue;
+        g_wheel.remove(&data->timer);
+        Function<void()> fn;
+        if(data->run_on_shutdown)
+            fn = std::move(data->fn);
+        removeTask(id);
+        if(fn)
+            fn();
     }
 
-    std::lock_guard lock{g_scheduler_mutex};
-    for(auto id : ids)
-        g_tasks.remove(id);
-    
     // some tasks may add new tasks, so we need to cancel them too
-    for(auto& [id, data] : g_tasks)
-        GNUNET_SCHEDULER_cancel(data.handle);
+    for(auto id : g_tasks.handles()) {
+        auto data = g_tasks.get(id);
+        g_wheel.remove(&data->timer);
+        removeTask(id);
+    }
+    rearmWheel();
+    // The watchdog's heartbeat timer is gone too. Don't let it mistake that for a stall
+    detail::g_heartbeat.last_beat.store(0, std::memory_order_relaxed);
+}
+
+static void switchClock(bool enable, uint64_t seed)
+{
+    {
+        std::lock_guard lock(detail::g_virtual_rng_mutex);
+        detail::g_virtual_rng.seed(seed);
+    }
+    detail::g_virtual_seed.store(seed, std::memory_order_relaxed);
+    if(enable == detail::g_virtual_time.load(std::memory_order_relaxed))
+        return;
+    uint64_t now = nowUs();
+    uint64_t real = realNowUs();
+    if(enable)
+        detail::g_virtual_now.store(now, std::memory_order_relaxed);
+    else if(now > real + g_clock_offset.load(std::memory_order_relaxed))
+        g_clock_offset.store(now - real, std::memory_order_relaxed);
+    detail::g_virtual_time.store(enable, std::memory_order_relaxed);
+
+    // The armed wheel task waits on the other clock
+    if(g_wheel_task != nullptr)
+        GNUNET_SCHEDULER_cancel(g_wheel_task);
+    g_wheel_task = nullptr;
+    rearmWheel();
+}
+
+void enableVirtualTime(bool enable, uint64_t seed)
+{
+    // The wheel task can only be re-armed from the GNUnet thread
+    if(inMainThread())
+        switchClock(enable, seed);
+    else
+        queue([enable, seed] { switchClock(enable, seed); });
+}
+
+void advanceVirtualTime(std::chrono::microseconds delta)
+{
+    GNUNET_assert(inMainThread());
+    GNUNET_assert(detail::g_virtual_time.load(std::memory_order_relaxed));
+    GNUNET_assert(delta.count() >= 0);
+    detail::g_virtual_now.fetch_add(delta.count(), std::memory_order_relaxed);
+}
+
+std::chrono::steady_clock::time_point now()
+{
+    return std::chrono::steady_clock::time_point(std::chrono::microseconds(nowUs()));
+}
+
+void setDeferredResume(bool enable)
+{
+    detail::g_defer_resumes.store(enable, std::memory_order_relaxed);
+}
+
+void setAutoYield(std::chrono::microseconds budget)
+{
+    int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(budget).count();
+    detail::g_auto_yield_budget_ns.store(std::max<int64_t>(ns, 0), std::memory_order_relaxed);
+}
+
+YieldStats yieldStats()
+{
+    return {detail::g_yields.load(std::memory_order_relaxed), detail::g_forced_yields.load(std::memory_order_relaxed)};
+}
+
+void enableInstrumentation(bool enable)
+{
+    detail::g_instrumentation.enabled.store(enable, std::memory_order_relaxed);
+}
+
+static Histogram snapshot(const detail::AtomicHistogram& histogram)
+{
+    Histogram result;
+    result.buckets.reserve(histogram.buckets.size());
+    for(auto& bucket : histogram.buckets)
+        result.buckets.push_back(bucket.load(std::memory_order_relaxed));
+    result.count = histogram.count.load(std::memory_order_relaxed);
+    result.total = histogram.total.load(std::memory_order_relaxed);
+    result.max = histogram.max.load(std::memory_order_relaxed);
+    return result;
+}
+
+uint64_t Histogram::quantile(double q) const
+{
+    if(count == 0)
+        return 0;
+    uint64_t rank = std::min<uint64_t>(count - 1, std::clamp(q, 0.0, 1.0) * count);
+    uint64_t seen = 0;
+    for(size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if(seen <= rank)
+            continue;
+        if(i == 0)
+            return 0;
+        if(i >= 64)
+            return max;
+        return std::min(max, (uint64_t{1} << i) - 1);
+    }
+    return max;
+}
+
+InstrumentationStats instrumentationStats()
+{
+    auto& data = detail::g_instrumentation;
+    InstrumentationStats stats;
+    stats.enabled = detail::instrumentationEnabled();
+    stats.loop_lag_ns = snapshot(data.loop_lag);
+    for(size_t i = 0; i < data.callbacks.size(); i++)
+        stats.callbacks.push_back({detail::callbackSiteName(static_cast<detail::CallbackSite>(i)), snapshot(data.callbacks[i])});
+    stats.batch_size = snapshot(data.batch_size);
+    for(size_t i = 0; i < stats.queues.size(); i++)
+        stats.queues[i] = queueStats(static_cast<Priority>(i));
+    return stats;
+}
+
+void resetInstrumentation()
+{
+    auto& data = detail::g_instrumentation;
+    data.loop_lag.reset();
+    for(auto& histogram : data.callbacks)
+        histogram.reset();
+    data.batch_size.reset();
+}
+
+void enableOperationTracking(bool enable)
+{
+    detail::g_pending_registry.enabled.store(enable, std::memory_order_relaxed);
+}
+
+static PendingOperationInfo describe(const detail::PendingOperation& op, std::chrono::steady_clock::time_point now)
+{
+    return {op.kind, op.target, now - op.since, op.coroutine};
+}
+
+std::vector<PendingOperationInfo> pendingOperations()
+{
+    auto& registry = detail::g_pending_registry;
+    auto now = std::chrono::steady_clock::now();
+    std::vector<PendingOperationInfo> result;
+    std::lock_guard lock(registry.mutex);
+    result.reserve(registry.count);
+    for(auto op = registry.head; op != nullptr; op = op->next)
+        result.push_back(describe(*op, now));
+    return result;
+}
+
+std::optional<PendingOperationInfo> oldestPendingOperation()
+{
+    auto& registry = detail::g_pending_registry;
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard lock(registry.mutex);
+    // Operations are appended as they suspend, so the head is the oldest
+    if(registry.head == nullptr)
+        return std::nullopt;
+    return describe(*registry.head, now);
+}
+
+static std::mutex g_watchdog_mutex;
+static std::unique_ptr<detail::Watchdog> g_watchdog;
+static TaskID g_heartbeat_task = 0;
+// Kept so the statistics outlive the watchdog
+static detail::Watchdog::Stats g_watchdog_stats;
+
+static void stopWatchdogLocked()
+{
+    if(g_watchdog == nullptr)
+        return;
+    cancel(g_heartbeat_task);
+    g_watchdog_stats = g_watchdog->stats();
+    g_watchdog.reset();
+    detail::g_heartbeat.last_beat.store(0, std::memory_order_relaxed);
+}
+
+void startWatchdog(WatchdogOptions options)
+{
+    using namespace std::chrono;
+    std::lock_guard lock{g_watchdog_mutex};
+    stopWatchdogLocked();
+    milliseconds interval = options.interval;
+    if(interval.count() == 0)
+        interval = std::max(options.threshold / 4, milliseconds(1));
+    g_watchdog = std::make_unique<detail::Watchdog>(detail::Watchdog::Options{options.threshold, interval
+        , options.capture_backtrace, options.max_reports});
+    // Urgent so it runs as soon as the loop is free again
+    g_heartbeat_task = runEvery(interval, [] {
+        detail::g_heartbeat.last_beat.store(detail::instrumentationNow(), std::memory_order_release);
+    }, {.mode = RepeatMode::FixedDelay, .priority = Priority::Urgent});
+}
+
+void stopWatchdog()
+{
+    std::lock_guard lock{g_watchdog_mutex};
+    stopWatchdogLocked();
+}
+
+WatchdogStats watchdogStats()
+{
+    std::lock_guard lock{g_watchdog_mutex};
+    auto stats = g_watchdog != nullptr ? g_watchdog->stats() : g_watchdog_stats;
+    WatchdogStats result;
+    result.running = g_watchdog != nullptr;
+    result.checks = stats.checks;
+    result.stalls = stats.stalls;
+    for(size_t i = 0; i < stats.stalls_by_site.size(); i++) {
+        auto site = static_cast<detail::CallbackSite>(i);
+        result.stalls_by_site.emplace_back(site == detail::CallbackSite::Count ? "event loop" : detail::callbackSiteName(site)
+            , stats.stalls_by_site[i]);
+    }
+    result.longest = stats.longest;
+    for(auto& stall : stats.recent) {
+        auto site = stall.site == detail::CallbackSite::Count ? "event loop" : detail::callbackSiteName(stall.site);
+        result.recent.push_back({site, stall.duration, stall.detected_at, std::move(stall.backtrace)});
+    }
+    return result;
+}
+
+// Submitters share the lock, replacing the pool takes it exclusively. No job can reach a
+// pool after it was stopped
+static std::shared_mutex g_offload_mutex;
+static OffloadOptions g_offload_options;
+static std::unique_ptr<detail::ThreadPool> g_offload_pool;
+// Replaced pools still running their queued jobs. Joined once they are done, or at exit
+static std::vector<std::unique_ptr<detail::ThreadPool>> g_retired_offload_pools;
+
+static void submitOffload(Function<void()> job)
+{
+    {
+        std::shared_lock lock{g_offload_mutex};
+        if(g_offload_pool != nullptr) {
+            g_offload_pool->submit(std::move(job));
+            return;
+        }
+    }
+    std::unique_lock lock{g_offload_mutex};
+    if(g_offload_pool == nullptr) {
+        size_t threads = g_offload_options.threads;
+        if(threads == 0)
+            threads = std::thread::hardware_concurrency();
+        g_offload_pool = std::make_unique<detail::ThreadPool>(threads, g_offload_options.collect_stats);
+    }
+    g_offload_pool->submit(std::move(job));
+}
+
+void configureOffload(OffloadOptions options)
+{
+    std::unique_lock lock{g_offload_mutex};
+    g_offload_options = options;
+    // Destroying a pool waits for its queued jobs. Let the old one finish them in the
+    // background and only join pools that are already done
+    std::erase_if(g_retired_offload_pools, [](const auto& pool) { return pool->finished(); });
+    if(g_offload_pool == nullptr)
+        return;
+    g_offload_pool->stop();
+    g_retired_offload_pools.push_back(std::move(g_offload_pool));
+}
+
+OffloadStats offloadStats()
+{
+    std::shared_lock lock{g_offload_mutex};
+    if(g_offload_pool == nullptr)
+        return {};
+    auto stats = g_offload_pool->stats();
+    return {g_offload_pool->size(), stats.submitted, stats.completed, stats.stolen
+        , stats.total_wait, stats.total_run, stats.max_run};
 }
 
 static bool running = true;
@@ -143,64 +965,203 @@ void shutdown()
     running = false;
 }
 
-struct ReadLineCallbackPack
+static std::unique_ptr<FdReader> g_stdin_reader;
+// FdReader takes one read at a time. Readers queue up here instead
+static async_mutex g_stdin_mutex;
+// Bumped on shutdown, so readers still queued on the mutex don't open a new reader
+static size_t g_stdin_generation = 0;
+
+// Next line of stdin, std::nullopt once it is closed
+static Task<std::optional<std::string>> readStdinLine()
 {
-    std::function<void(const std::string&, bool)> fn;
-    GNUNET_SCHEDULER_Task* task;
-    GNUNET_SCHEDULER_Task* shutdown_task;
-};
+    co_await runOnMainThread();
+    auto generation = g_stdin_generation;
+    auto guard = co_await g_stdin_mutex.scoped_lock();
+    if(generation != g_stdin_generation)
+        throw OperationCancelled();
+    if(g_stdin_reader == nullptr) {
+        g_stdin_reader = std::make_unique<FdReader>(0);
+        // The reader's watch doesn't survive the scheduler
+        runOnShutdown([] {
+            g_stdin_generation++;
+            g_stdin_reader.reset();
+        });
+    }
+    auto line = co_await g_stdin_reader->readLine();
+    if(!line.has_value())
+        co_return std::nullopt;
+    std::string result;
+    result.reserve(line->size() + 1);
+    result.append(*line);
+    if(g_stdin_reader->lineTerminated())
+        result.push_back('\n');
+    co_return result;
+}
 
 void readStdin(std::function<void(const std::string&, bool)> fn)
 {
-    std::lock_guard lock{g_scheduler_mutex};
-    auto rs = GNUNET_NETWORK_fdset_create();
-    GNUNET_NETWORK_fdset_set_native(rs, 0);
-
-    auto pack = new ReadLineCallbackPack{std::move(fn), nullptr, nullptr};
-    pack->shutdown_task = GNUNET_SCHEDULER_add_shutdown([] (void* cls) {
-        auto pack = reinterpret_cast<ReadLineCallbackPack*>(cls);
-        GNUNET_SCHEDULER_cancel(pack->task);
-        delete pack;
-    }, pack);
-
-    auto task = GNUNET_SCHEDULER_add_select(GNUNET_SCHEDULER_PRIORITY_DEFAULT, GNUNET_TIME_UNIT_FOREVER_REL, rs, nullptr
-    , [] (void* cls) {
-        auto pack = reinterpret_cast<ReadLineCallbackPack*>(cls);
-        GNUNET_SCHEDULER_cancel(pack->shutdown_task);
-        char buf[1024];
-        auto len = read(0, buf, sizeof(buf));
-        if(len < 0)
-            GNUNET_assert(0 && "failed to read from stdin");
-        if(len == 0) {
-            pack->fn("", false);
-            delete pack;
-            return;
+    async_run([fn = std::move(fn)]() -> Task<> {
+        std::optional<std::string> line;
+        try {
+            line = co_await readStdinLine();
+        }
+        catch(const OperationCancelled&) {
+            // GNUnet shut down while waiting. Nobody is left to hand a line to
+            co_return;
         }
-        std::string line{buf, static_cast<size_t>(len)};
-        pack->fn(line, true);
-        delete pack;
-    }, pack);
-    pack->task = task;
-    GNUNET_NETWORK_fdset_destroy(rs);
-    wakeUp();
+        if(line.has_value())
+            fn(*line, true);
+        else
+            fn("", false);
+    });
 }
 
 Task<std::string> readStdin()
 {
-    struct ReadLineAwaiter : public CallbackAwaiter<std::string>
-    {
-        void await_suspend(std::coroutine_handle<> handle)
-        {
-            gnunetpp::scheduler::readStdin([handle, this] (const std::string& line, bool success) {
-                if(!success)
-                    setException(std::make_exception_ptr(std::runtime_error("failed to read from stdin")));
-                else
-                    setValue(line);
-                handle.resume();
-            });
+    auto line = co_await readStdinLine();
+    if(!line.has_value())
+        throw std::runtime_error("failed to read from stdin");
+    co_return std::move(*line);
+}
+
+Task<> readable(int fd)
+{
+    co_await runOnMainThread();
+    FdWatch watch(fd);
+    co_await watch.readable();
+}
+
+Task<> writable(int fd)
+{
+    co_await runOnMainThread();
+    FdWatch watch(fd);
+    co_await watch.writable();
+}
+
+FdWatch::FdWatch(int fd, Priority priority)
+    : state_(std::make_unique<detail::FdWatchState>(fd, toGnunet(priority)))
+{
+}
+
+FdWatch::~FdWatch() = default;
+FdWatch::FdWatch(FdWatch&&) = default;
+FdWatch& FdWatch::operator=(FdWatch&&) = default;
+
+Task<> FdWatch::readable()
+{
+    GNUNET_assert(state_ != nullptr);
+    auto stop = co_await currentStopToken();
+    co_await detail::FdWaiter(state_.get(), detail::FdWatchState::Read, std::move(stop));
+}
+
+Task<> FdWatch::writable()
+{
+    GNUNET_assert(state_ != nullptr);
+    auto stop = co_await currentStopToken();
+    co_await detail::FdWaiter(state_.get(), detail::FdWatchState::Write, std::move(stop));
+}
+
+int FdWatch::fd() const
+{
+    return state_->fd;
+}
+
+FdReader::FdReader(int fd, size_t max_record)
+    : watch_(fd)
+    , max_record_(max_record)
+{
+    int flags = fcntl(fd, F_GETFL);
+    blocking_ = flags == -1 || (flags & O_NONBLOCK) == 0;
+}
+
+std::optional<std::optional<std::string_view>> FdReader::tryRead(bool records)
+{
+    using Result = std::optional<std::optional<std::string_view>>;
+    if(lease_ != 0) {
+        buffer_.consume(std::exchange(lease_, 0));
+        scanned_ = 0;
+    }
+    if(!records) {
+        size_t end = buffer_.find('\n', scanned_);
+        line_terminated_ = end != detail::RingBuffer::npos;
+        if(end == detail::RingBuffer::npos && eof_ && !buffer_.empty())
+            end = buffer_.size();
+        if(end != detail::RingBuffer::npos) {
+            lease_ = std::min(end + 1, buffer_.size());
+            auto line = buffer_.peek(end);
+            if(!line.empty() && line.back() == '\r')
+                line.remove_suffix(1);
+            return Result(std::in_place, line);
         }
-    };
-    co_return co_await ReadLineAwaiter();
+        if(eof_)
+            return Result(std::in_place);
+        if(buffer_.size() >= max_record_)
+            throw std::runtime_error("Line longer than " + std::to_string(max_record_) + " bytes");
+        scanned_ = buffer_.size();
+        return std::nullopt;
+    }
+
+    if(buffer_.size() >= sizeof(uint32_t)) {
+        uint32_t length = 0;
+        for(size_t i = 0; i < sizeof(uint32_t); i++)
+            length = (length << 8) | static_cast<uint8_t>(buffer_[i]);
+        if(length > max_record_)
+            throw std::runtime_error("Record longer than " + std::to_string(max_record_) + " bytes");
+        if(buffer_.size() >= sizeof(uint32_t) + length) {
+            lease_ = sizeof(uint32_t) + length;
+            return Result(std::in_place, buffer_.peek(lease_).substr(sizeof(uint32_t)));
+        }
+    }
+    if(eof_) {
+        if(buffer_.empty())
+            return Result(std::in_place);
+        throw std::runtime_error("Stream ended within a record");
+    }
+    return std::nullopt;
+}
+
+Task<std::optional<std::string_view>> FdReader::readLine()
+{
+    while(true) {
+        if(auto line = tryRead(false))
+            co_return *line;
+        co_await fill();
+    }
+}
+
+Task<std::optional<std::string_view>> FdReader::readRecord()
+{
+    while(true) {
+        if(auto record = tryRead(true))
+            co_return *record;
+        co_await fill();
+    }
+}
+
+Task<> FdReader::fill()
+{
+    if(buffer_.full())
+        buffer_.reserve(buffer_.capacity());
+    while(true) {
+        if(blocking_)
+            co_await watch_.readable();
+        auto space = buffer_.writable();
+        auto len = read(watch_.fd(), space.data(), space.size());
+        if(len > 0) {
+            buffer_.commit(len);
+            co_return;
+        }
+        if(len == 0) {
+            eof_ = true;
+            co_return;
+        }
+        if(errno == EINTR)
+            continue;
+        if(errno != EAGAIN && errno != EWOULDBLOCK)
+            throw std::runtime_error(std::string("Failed to read: ") + strerror(errno));
+        if(!blocking_)
+            co_await watch_.readable();
+    }
 }
 
 Task<> waitUntilShutdown()
@@ -225,18 +1186,32 @@ void wakeUp()
         detail::notifyWakeup();
 }
 
-Task<> runOnMainThread()
+Task<> runOnMainThread(Priority priority)
 {
     struct MainThreadAwaiter : public CallbackAwaiter<>
     {
+        MainThreadAwaiter(Priority priority) : priority_(priority) {}
+
+        bool await_ready() const
+        {
+            return inMainThread();
+        }
+
         void await_suspend(std::coroutine_handle<> handle)
         {
-            run([handle]{
+            queue([handle]{
+                detail::CallbackScope scope(detail::CallbackSite::Resume);
                 handle.resume();
-            });
+            }, priority_);
         }
+        Priority priority_;
     };
-    co_await MainThreadAwaiter();
+    co_await MainThreadAwaiter(priority);
+}
+
 }
 
+void gnunetpp::detail::submitOffload(Function<void()> job)
+{
+    scheduler::submitOffload(std::move(job));
 }
@@ -2,8 +2,19 @@
 
 #include <functional>
 #include <chrono>
+#include <type_traits>
+#include <array>
+#include <string>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <string_view>
 
 #include "inner/coroutine.hpp"
+#include "inner/Function.hpp"
+#include "inner/Instrumentation.hpp"
+#include "inner/NonCopyable.hpp"
+#include "inner/RingBuffer.hpp"
 
 namespace gnunetpp
 {
@@ -11,42 +22,122 @@ using TaskID = size_t;
 
 // HACK: I don't want to include inner/Infa.hpp here, for better compile times
 bool inMainThread();
+
+namespace detail
+{
+// Runs `job` on the offload thread pool. See scheduler::offload()
+void submitOffload(Function<void()> job);
+// Picks a random delay in [delay * (1 - fraction), delay]. See scheduler::retry()
+std::chrono::microseconds jitterDelay(std::chrono::microseconds delay, double fraction);
+struct FdWatchState;
+}
 }
 
 namespace gnunetpp::scheduler
 {
+/**
+ * @brief Priority classes of the GNUnet scheduler. When several tasks are ready the
+ * one with the highest priority runs first, so a flood of low priority work can't
+ * delay network I/O and user facing work
+ */
+enum class Priority
+{
+    // Only runs when nothing else is ready
+    Idle,
+    Background,
+    Default,
+    High,
+    UI,
+    Urgent
+};
+
+// Number of Priority values. GNUNET_SCHEDULER_PRIORITY_COUNT without KEEP and SHUTDOWN,
+// which aren't priorities tasks can be queued with
+inline constexpr size_t priority_count = static_cast<size_t>(Priority::Urgent) + 1;
+
+/**
+ * @brief How a repeating task is re-armed after it ran
+ */
+enum class RepeatMode
+{
+    // Runs are anchored to the time the task was created: start + n * interval. Time
+    // spent in the callback does not shift later runs
+    FixedRate,
+    // The next run is `interval` after the previous run finished
+    FixedDelay
+};
+
+/**
+ * @brief What a FixedRate task does when it falls behind (callback or event loop too slow)
+ */
+enum class OverrunPolicy
+{
+    // Drop the missed runs and continue at the next point on the original schedule
+    Skip,
+    // Run the missed runs back to back until the task is on schedule again
+    CatchUp
+};
+
+struct RepeatOptions
+{
+    RepeatMode mode = RepeatMode::FixedRate;
+    OverrunPolicy overrun = OverrunPolicy::Skip;
+    // How late the task may run. Lets the scheduler batch timers into fewer wakeups
+    std::chrono::microseconds slack{0};
+    Priority priority = Priority::Default;
+};
+
 /**
  * @brief Run a function after a delay
  * 
  * @param delay delay in seconds
  * @param fn function to run
  * @param run_on_shutdown if true, the function will run at shutdown even if it hasn't timed out yet
+ * @param slack how late the function may run. Lets the scheduler batch timers into fewer wakeups
+ * @param priority priority the function runs at once the delay is over. Default and Urgent
+ * timers run straight from the timer tick, the others once their priority's turn comes
  * @return TaskID Handle to the task
  */
-TaskID runLater(std::chrono::microseconds delay, std::function<void()> fn, bool run_on_shutdown = false);
+TaskID runLater(std::chrono::microseconds delay, Function<void()> fn, bool run_on_shutdown = false
+    , std::chrono::microseconds slack = std::chrono::microseconds(0), Priority priority = Priority::Default);
 
 /**
  * @brief Run a function every `delay` seconds
  * 
  * @param delay delay in seconds
  * @param fn function to run
+ * @param options fixed-rate or fixed-delay scheduling, overrun handling, timer slack and priority
  * @return TaskID Handle to the task
  */
-TaskID runEvery(std::chrono::microseconds delay, std::function<void()> fn);
+TaskID runEvery(std::chrono::microseconds delay, Function<void()> fn, RepeatOptions options = {});
 
 /**
  * @brief Register a function to run on shutdown
  * 
  * @param fn function to run
  */
-void runOnShutdown(std::function<void()> fn);
+void runOnShutdown(Function<void()> fn);
 
 /**
  * @brief Run a function immediately after the main thread enters the scheduler
  * 
  * @param fn function to run
+ * @param priority priority the function runs at
  */
-void queue(std::function<void()> fn);
+void queue(Function<void()> fn, Priority priority = Priority::Default);
+
+struct QueueStats
+{
+    // Functions queued but not ran yet. Stays high when the priority is starved
+    size_t depth = 0;
+    size_t max_depth = 0;
+    size_t queued = 0;
+};
+
+/**
+ * @brief Queue depth of one priority. Counts queue(), expired timers and resumed coroutines
+ */
+QueueStats queueStats(Priority priority);
 
 /**
  * @brief Run a function immediately if the current thread is the scheduler thread, otherwise queue it
@@ -66,11 +157,21 @@ void run(Fn&& fn)
  * @brief Resumes execution after a delay
  * 
  * @param delay delay in seconds
- * @return Task<> await on this to resume execution after the delay
+ * @return Task<> await on this to resume execution after the delay. Throws OperationCancelled
+ * as soon as the awaiting task is stopped
  */
 [[nodiscard]]
 Task<> sleep(std::chrono::microseconds delay);
 
+/**
+ * @brief Lets other ready work run, then resumes the awaiting coroutine at `priority`
+ *
+ * @param priority priority to resume at. Lower priorities only resume once nothing more
+ * important is ready
+ */
+[[nodiscard]]
+Task<> yield(Priority priority = Priority::Default);
+
 /**
  * @brief Cancel a task
  * 
@@ -84,17 +185,300 @@ void cancel(TaskID id);
  */
 void cancelAll();
 
+/**
+ * @brief Drive timers from a simulated clock. Off by default
+ *
+ * With virtual time on, the clock only moves when the GNUnet thread has nothing else ready
+ * to run and then jumps straight to the next timer. runLater(), runEvery(), sleep() and
+ * everything built on them, such as DHT and GNS search timeouts or withTimeout(), fire in
+ * deadline order as fast as the CPU allows. Timeouts enforced inside GNUnet services and
+ * work arriving from other threads or the network don't hold the clock back.
+ *
+ * Runs are deterministic for a given `seed`, which decides the jitter of retry(). Timers due
+ * on the same tick fire in the order they were armed. A non-zero seed shuffles them, so
+ * different seeds try different interleavings.
+ *
+ * The clock is process wide. Turning it on makes every timer in the process, including
+ * those of unrelated code running on the GNUnet thread, fire early in real time.
+ *
+ * Switching back to real time keeps the clock monotonic, now() then runs ahead of the
+ * steady clock by the simulated time.
+ */
+void enableVirtualTime(bool enable = true, uint64_t seed = 0);
+
+/**
+ * @brief Moves the virtual clock forward by `delta`, as if the running callback kept the
+ * GNUnet thread busy that long. Timers that became due fire once the callback returned.
+ * Only on the GNUnet thread while virtual time is on
+ */
+void advanceVirtualTime(std::chrono::microseconds delta);
+
+/**
+ * @brief Current time of the clock timers are scheduled on. The steady clock, or the
+ * simulated clock while virtual time is on
+ */
+std::chrono::steady_clock::time_point now();
+
 /**
  * @brief Shutdown the scheduler
  */
 void shutdown();
 
 /**
- * @brief Asynchronously read a line from stdin
+ * @brief Asynchronously read a line from stdin. The line is passed with its trailing newline
+ * if it had one, "\r\n" is passed as "\n". The bool is false once stdin is closed. A read
+ * still pending when GNUnet shuts down is dropped without calling `fn`. Other read errors
+ * are not reported through `fn`, they terminate like any exception escaping async_run()
  */
 void readStdin(std::function<void(const std::string&, bool)> fn);
+/**
+ * @brief Asynchronously read a line from stdin, with its trailing newline like the
+ * callback version. Concurrent calls are served one after another in call order. Throws
+ * std::runtime_error once stdin is closed, and OperationCancelled when GNUnet shuts down
+ * while the read is pending
+ */
 Task<std::string> readStdin();
 
+/**
+ * @brief Resumes once `fd` is readable. The fd is registered with GNUnet for this one wait,
+ * use FdWatch to wait on the same fd repeatedly. Resumes on the GNUnet thread. Throws
+ * OperationCancelled when the awaiting task is stopped or GNUnet shuts down
+ */
+[[nodiscard]]
+Task<> readable(int fd);
+
+/**
+ * @brief Resumes once `fd` is writable. See readable()
+ */
+[[nodiscard]]
+Task<> writable(int fd);
+
+/**
+ * @brief Persistent readiness registration of a file descriptor (socket, pipe, eventfd...)
+ *
+ * The fdsets handed to GNUnet are created once and reused. GNUnet's select is level
+ * triggered, so the fd is only registered while a coroutine waits on it: a readable fd
+ * nobody waits on doesn't wake the event loop. Each wait resumes once, read or write
+ * until EAGAIN before waiting again. One reader and one writer may wait at the same time.
+ * Only use on the GNUnet thread. Waiters are resumed with OperationCancelled when their
+ * task is stopped, GNUnet shuts down or the watch is destroyed.
+ *
+ * @code
+ * FdWatch watch(fd);
+ * while(true) {
+ *     co_await watch.readable();
+ *     while((n = read(fd, buf, sizeof(buf))) > 0) ...
+ * }
+ * @endcode
+ */
+struct FdWatch : public NonCopyable
+{
+    /**
+     * @brief Watch `fd`. The fd is not owned and must outlive the watch
+     *
+     * @param fd native file descriptor, preferably non-blocking
+     * @param priority priority waiters are resumed at
+     */
+    explicit FdWatch(int fd, Priority priority = Priority::Default);
+    ~FdWatch();
+    FdWatch(FdWatch&&);
+    FdWatch& operator=(FdWatch&&);
+
+    [[nodiscard]]
+    Task<> readable();
+    [[nodiscard]]
+    Task<> writable();
+
+    int fd() const;
+
+protected:
+    std::unique_ptr<detail::FdWatchState> state_;
+};
+
+/**
+ * @brief Buffered reader splitting a stream into lines or length-prefixed records.
+ *
+ * Reads as much as is available into a growable ring buffer and hands out views into it,
+ * so nothing is allocated per line. A view stays valid until the next read from the same
+ * reader. Blocking fds are only read after they are readable, non-blocking fds are read
+ * until EAGAIN. Only use on the GNUnet thread, one read at a time.
+ *
+ * @code
+ * FdReader reader(fd);
+ * auto lines = reader.lines();
+ * for(auto it = co_await lines.begin(); it != lines.end(); co_await ++it)
+ *     std::cout << *it << std::endl;
+ * @endcode
+ */
+struct FdReader : public NonCopyable
+{
+    /**
+     * @param fd native file descriptor to read from. Not owned
+     * @param max_record longest line or record accepted, reading throws beyond that
+     */
+    explicit FdReader(int fd, size_t max_record = 1 << 20);
+
+    /**
+     * @brief Next line without its "\n" or "\r\n". The last line doesn't need to be terminated
+     *
+     * @return std::nullopt once the fd is at EOF and everything has been read
+     */
+    [[nodiscard]]
+    Task<std::optional<std::string_view>> readLine();
+
+    /**
+     * @brief Next record prefixed with its length as 32 bit big endian integer
+     *
+     * @return std::nullopt once the fd is at EOF and everything has been read. Throws if
+     * the stream ends within a record
+     */
+    [[nodiscard]]
+    Task<std::optional<std::string_view>> readRecord();
+
+    /**
+     * @brief Whether the line last returned by readLine() ended with a newline. Only the
+     * last line of the stream can lack one
+     */
+    bool lineTerminated() const
+    {
+        return line_terminated_;
+    }
+
+    // Reads the next line or record. Completes without a coroutine frame when it is already
+    // buffered, so iterating costs no allocation per element
+    struct ReadAwaiter
+    {
+        bool await_ready()
+        {
+            value_ = reader_->tryRead(records_);
+            if(value_.has_value())
+                return true;
+            task_.emplace(records_ ? reader_->readRecord() : reader_->readLine());
+            return false;
+        }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+        {
+            return typename Task<std::optional<std::string_view>>::awaiter(task_->coro_).await_suspend(handle);
+        }
+        std::optional<std::string_view> result()
+        {
+            if(value_.has_value())
+                return *value_;
+            return typename Task<std::optional<std::string_view>>::awaiter(task_->coro_).await_resume();
+        }
+
+        FdReader* reader_;
+        bool records_;
+        std::optional<std::optional<std::string_view>> value_;
+        std::optional<Task<std::optional<std::string_view>>> task_;
+    };
+
+    struct iterator_type;
+
+    // Returned by `++it`
+    struct IncrementAwaiter : public ReadAwaiter
+    {
+        iterator_type& await_resume()
+        {
+            it_.value = result();
+            return it_;
+        }
+
+        iterator_type& it_;
+    };
+
+    // Returned by Range::begin()
+    struct BeginAwaiter : public ReadAwaiter
+    {
+        iterator_type await_resume()
+        {
+            return {result(), reader_, records_};
+        }
+    };
+
+    struct iterator_type
+    {
+        std::string_view operator*() const
+        {
+            return *value;
+        }
+        const std::string_view* operator->() const
+        {
+            return &*value;
+        }
+        /**
+         * @brief Awaits the next element into this iterator
+         */
+        IncrementAwaiter operator++()
+        {
+            return IncrementAwaiter{{parent, records}, *this};
+        }
+        bool operator==(const iterator_type& other) const
+        {
+            return parent == other.parent && value.has_value() == other.value.has_value();
+        }
+        bool operator!=(const iterator_type& other) const
+        {
+            return !(*this == other);
+        }
+
+        std::optional<std::string_view> value;
+        FdReader* parent;
+        bool records;
+    };
+
+    /**
+     * @brief Asynchronous range over what readLine() or readRecord() return
+     */
+    struct Range
+    {
+        BeginAwaiter begin()
+        {
+            return BeginAwaiter{{reader, records}};
+        }
+        iterator_type end()
+        {
+            return {std::nullopt, reader, records};
+        }
+
+        FdReader* reader;
+        bool records;
+    };
+
+    Range lines()
+    {
+        return {this, false};
+    }
+
+    Range records()
+    {
+        return {this, true};
+    }
+
+    int fd() const
+    {
+        return watch_.fd();
+    }
+
+protected:
+    // Next line or record if it is buffered or the stream ended. std::nullopt if more has to
+    // be read first
+    std::optional<std::optional<std::string_view>> tryRead(bool records);
+    Task<> fill();
+
+    FdWatch watch_;
+    detail::RingBuffer buffer_;
+    size_t max_record_;
+    // Bytes handed out by the last read, dropped at the start of the next one
+    size_t lease_ = 0;
+    // How far the buffer has been searched for a newline without finding one
+    size_t scanned_ = 0;
+    bool line_terminated_ = false;
+    bool blocking_;
+    bool eof_ = false;
+};
+
 /**
  * @brief Asynchronously wait until shutdown
  * 
@@ -109,6 +493,438 @@ void wakeUp();
 
 /**
  * @brief Run on GNUnet main thread
+ *
+ * @param priority priority to resume at when coming from another thread
 */
-Task<> runOnMainThread();
+Task<> runOnMainThread(Priority priority = Priority::Default);
+
+/**
+ * @brief Defer resuming coroutines woken by GNUnet callbacks until the callback returned.
+ * Off by default, when coroutines resume right inside the callback.
+ *
+ * Coroutines that issue their next request as soon as they resume then do so from a
+ * shallow stack, outside GNUnet's message handlers. Everything woken during one callback
+ * runs back to back afterwards.
+ */
+void setDeferredResume(bool enable = true);
+
+/**
+ * @brief Gives up the GNUnet thread if the current time slice ran for longer than
+ * `budget`. The awaiting coroutine then resumes from a new GNUnet task, after network
+ * callbacks that became ready meanwhile. Otherwise continues right away.
+ *
+ * A slice starts whenever gnunetpp gets the GNUnet thread, ie. a timer, queued function
+ * or service callback runs, and is timed from the first check in it. Cheap enough to call
+ * once per element when walking large result sets:
+ *
+ * @code
+ * for(auto it = co_await results.begin(); it != results.end(); co_await ++it) {
+ *     process(*it);
+ *     co_await scheduler::yieldIfExpired(5ms);
+ * }
+ * @endcode
+ *
+ * Doesn't yield on other threads than the GNUnet thread
+ */
+[[nodiscard]]
+inline detail::YieldIfExpiredAwaiter yieldIfExpired(std::chrono::microseconds budget)
+{
+    return {budget};
+}
+
+/**
+ * @brief Makes coroutines give up the GNUnet thread automatically once the current time
+ * slice ran for longer than `budget`. Checked whenever a coroutine awaits an operation that
+ * already completed, such as the next queued DHT result. 0 turns it off, which is the default
+ */
+void setAutoYield(std::chrono::microseconds budget);
+
+struct YieldStats
+{
+    // Times yieldIfExpired() gave up the thread
+    uint64_t yields;
+    // Times setAutoYield() made a coroutine give up the thread
+    uint64_t forced_yields;
+};
+
+/**
+ * @brief Counts of time slice yields. Safe to call from any thread
+ */
+YieldStats yieldStats();
+
+struct OffloadOptions
+{
+    // Number of worker threads. 0 means one per hardware thread
+    size_t threads = 0;
+    // Measure queueing and run time of every job. Costs two clock reads per job
+    bool collect_stats = false;
+};
+
+struct OffloadStats
+{
+    size_t threads = 0;
+    size_t submitted = 0;
+    size_t completed = 0;
+    // jobs an idle worker took from another worker's queue
+    size_t stolen = 0;
+    // Below are only collected with OffloadOptions::collect_stats
+    std::chrono::nanoseconds total_wait{0};
+    std::chrono::nanoseconds total_run{0};
+    std::chrono::nanoseconds max_run{0};
+};
+
+/**
+ * @brief Configure the thread pool used by offload(). The pool is started on first use,
+ * calling this afterwards replaces it. Jobs already queued still run on the old pool in the
+ * background. Its threads are joined by a later call once they are done, or at exit
+ */
+void configureOffload(OffloadOptions options);
+
+/**
+ * @brief Statistics of the offload thread pool
+ */
+OffloadStats offloadStats();
+
+struct Histogram
+{
+    // buckets[i] counts values in [2^(i-1), 2^i). buckets[0] counts zeros
+    std::vector<uint64_t> buckets;
+    uint64_t count = 0;
+    uint64_t total = 0;
+    uint64_t max = 0;
+
+    /**
+     * @brief Upper bound of the bucket the `q` quantile falls in. ie. quantile(0.99)
+     * is the p99 rounded up to a power of two
+     */
+    uint64_t quantile(double q) const;
+};
+
+struct CallbackStats
+{
+    std::string site;
+    Histogram duration_ns;
+};
+
+struct InstrumentationStats
+{
+    bool enabled = false;
+    // How late timers ran compared to when they were due
+    Histogram loop_lag_ns;
+    // Time callbacks held the GNUnet thread, per call site
+    std::vector<CallbackStats> callbacks;
+    // Callbacks ran per inbox drain or timer wheel tick
+    Histogram batch_size;
+    // Indexed by Priority
+    std::array<QueueStats, priority_count> queues;
+};
+
+/**
+ * @brief Turn measuring callbacks on the GNUnet thread on or off. Off by default, when off
+ * the cost is a relaxed atomic load per callback
+ */
+void enableInstrumentation(bool enable = true);
+
+/**
+ * @brief Snapshot of the measurements. Safe to call from any thread
+ */
+InstrumentationStats instrumentationStats();
+
+/**
+ * @brief Clears all histograms. Queue depth counters are not affected
+ */
+void resetInstrumentation();
+
+struct PendingOperationInfo
+{
+    // What the coroutine waits for, ie. "DHT get", "GNS lookup" or "sleep"
+    std::string kind;
+    // The key, name or peer of the operation. Empty if it has none
+    std::string target;
+    // How long the coroutine has been suspended on it
+    std::chrono::nanoseconds age{0};
+    // Address of the suspended coroutine frame, to tell operations of one coroutine apart
+    void* coroutine = nullptr;
+};
+
+/**
+ * @brief Turn tracking of operations coroutines are suspended on on or off. Off by default,
+ * when off the cost is a relaxed atomic load per suspension. Only operations started while
+ * tracking is on are described with their target
+ */
+void enableOperationTracking(bool enable = true);
+
+/**
+ * @brief All operations coroutines are currently suspended on, oldest first. Safe to call
+ * from any thread
+ */
+std::vector<PendingOperationInfo> pendingOperations();
+
+/**
+ * @brief The operation that has been pending for the longest. Doesn't walk the pending
+ * operations, so it is cheap enough to poll for latency alerts
+ */
+std::optional<PendingOperationInfo> oldestPendingOperation();
+
+struct WatchdogOptions
+{
+    // A callback holding the GNUnet thread for longer than this is reported
+    std::chrono::milliseconds threshold{100};
+    // How often the watchdog samples the GNUnet thread. 0 means a quarter of the threshold
+    std::chrono::milliseconds interval{0};
+    // Interrupt the GNUnet thread with SIGURG to capture where it is stuck. Replaces the
+    // SIGURG handler while the watchdog runs
+    bool capture_backtrace = false;
+    // How many of the most recent stalls are kept
+    size_t max_reports = 16;
+};
+
+struct StallReport
+{
+    // The callback site, "event loop" if the loop stalled outside of a known callback
+    std::string site;
+    // How long the GNUnet thread was blocked. Updated until the stall ends
+    std::chrono::nanoseconds duration{0};
+    std::chrono::system_clock::time_point detected_at;
+    // Only with WatchdogOptions::capture_backtrace
+    std::vector<std::string> backtrace;
+};
+
+struct WatchdogStats
+{
+    bool running = false;
+    size_t checks = 0;
+    size_t stalls = 0;
+    std::vector<std::pair<std::string, size_t>> stalls_by_site;
+    std::chrono::nanoseconds longest{0};
+    // Oldest first
+    std::vector<StallReport> recent;
+};
+
+/**
+ * @brief Starts a thread that watches for callbacks blocking the GNUnet thread. Replaces
+ * the running watchdog if there is one. The watchdog relies on a heartbeat timer, so it
+ * stops detecting stalls outside known callbacks after cancelAll()
+ */
+void startWatchdog(WatchdogOptions options = {});
+
+/**
+ * @brief Stops the watchdog. Its statistics stay available through watchdogStats()
+ */
+void stopWatchdog();
+
+/**
+ * @brief What the watchdog found so far. Safe to call from any thread
+ */
+WatchdogStats watchdogStats();
+
+/**
+ * @brief Runs a CPU heavy function on the offload thread pool so it doesn't stall the
+ * GNUnet thread. The awaiting coroutine resumes on the GNUnet thread afterwards
+ *
+ * @param fn function to run. Must not touch GNUnet
+ * @return Task<T> the return value of `fn`. Exceptions thrown by `fn` are rethrown
+ */
+template <typename Fn>
+Task<std::invoke_result_t<Fn>> offload(Fn fn)
+{
+    using T = std::invoke_result_t<Fn>;
+    struct OffloadAwaiter : public CallbackAwaiter<T>
+    {
+        OffloadAwaiter(Fn& fn) : fn_(fn) {}
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            pending_.track(handle);
+            detail::submitOffload([this, handle] {
+                try {
+                    if constexpr(std::is_void_v<T>)
+                        fn_();
+                    else
+                        this->setValue(fn_());
+                }
+                catch(...) {
+                    this->setException(std::current_exception());
+                }
+                queue([this, handle] {
+                    pending_.untrack();
+                    detail::CallbackScope scope(detail::CallbackSite::Resume);
+                    handle.resume();
+                });
+            });
+        }
+
+        // The result is moved out, not copied like CallbackAwaiter does
+        decltype(auto) await_resume()
+        {
+            if constexpr(std::is_void_v<T>)
+                CallbackAwaiter<T>::await_resume();
+            else {
+                if(this->exception_)
+                    std::rethrow_exception(this->exception_);
+                return T(std::move(*this->result_));
+            }
+        }
+        Fn& fn_;
+        detail::PendingOperation pending_{"offload"};
+    };
+    co_return co_await OffloadAwaiter(fn);
+}
+
+/**
+ * @brief Thrown by withTimeout() when the task didn't finish in time
+ */
+struct TimeoutError : public std::runtime_error
+{
+    TimeoutError() : std::runtime_error("Operation timed out")
+    {
+    }
+};
+
+/**
+ * @brief Awaits `task`, stopping it once `timeout` has passed
+ *
+ * The timeout is delivered through the task's stop token. Operations that take a stop
+ * token cancel their GNUnet handles when it fires. Work that ignores the token runs
+ * to completion and its result is returned as usual. The task is also stopped when the
+ * awaiting coroutine or the task's own token is stopped.
+ *
+ * @return Task<T> the result of `task`. Throws TimeoutError on timeout and
+ * OperationCancelled when stopped for any other reason
+ */
+template <typename T>
+Task<T> withTimeout(Task<T> task, std::chrono::microseconds timeout)
+{
+    // When the task finishes off the GNUnet thread, cancel() only queues the cancellation
+    // and the timer can still fire after this frame is gone. It shares the state instead
+    struct State
+    {
+        std::stop_source stop;
+        std::atomic<bool> timed_out = false;
+    };
+    auto state = std::make_shared<State>();
+    auto parent = co_await currentStopToken();
+    StopCallback forward_parent(parent, [state] { state->stop.request_stop(); });
+    auto own = task.coro_ ? task.coro_.promise().stop_token_ : std::stop_token{};
+    StopCallback forward_own(own, [state] { state->stop.request_stop(); });
+    task.setStopToken(state->stop.get_token());
+
+    TaskID timer = runLater(timeout, [state] {
+        state->timed_out = true;
+        state->stop.request_stop();
+    });
+    std::exception_ptr error;
+    try {
+        if constexpr(std::is_void_v<T>) {
+            co_await std::move(task);
+            cancel(timer);
+            co_return;
+        }
+        else {
+            auto result = co_await std::move(task);
+            cancel(timer);
+            co_return result;
+        }
+    }
+    catch(...) {
+        error = std::current_exception();
+    }
+    bool timed_out = state->timed_out;
+    if(!timed_out)
+        cancel(timer);
+    try {
+        std::rethrow_exception(error);
+    }
+    catch(const OperationCancelled&) {
+        if(timed_out)
+            throw TimeoutError();
+        throw;
+    }
+}
+
+struct RetryPolicy
+{
+    // Attempts in total, including the first one
+    size_t max_attempts = 3;
+    // Wait before the second attempt. Multiplied by `multiplier` after every further failure
+    std::chrono::microseconds initial_delay = std::chrono::milliseconds(100);
+    std::chrono::microseconds max_delay = std::chrono::seconds(10);
+    double multiplier = 2.0;
+    // Fraction of each delay that is randomized so that peers don't retry in lockstep
+    double jitter = 0.5;
+    // Gives up once this much time has passed since the first attempt. 0 for no limit
+    std::chrono::microseconds deadline{0};
+    // Timeout of each attempt, see withTimeout(). 0 for no limit
+    std::chrono::microseconds attempt_timeout{0};
+    // Whether a failure is worth retrying. Everything but cancellation is by default
+    std::function<bool(const std::exception_ptr&)> retry_on;
+};
+
+/**
+ * @brief Calls `fn` and awaits the task it returns until it succeeds, waiting with
+ * exponential backoff between attempts
+ *
+ * @code
+ * auto value = co_await retry({.max_attempts = 5, .attempt_timeout = 2s}, [&] {
+ *     return datastore->getOne(key);
+ * });
+ * @endcode
+ *
+ * @return the result of the first successful attempt. Rethrows the last failure once the
+ * policy gives up. Stopping the awaiting coroutine throws OperationCancelled right away
+ */
+template <typename Fn>
+auto retry(RetryPolicy policy, Fn fn) -> Task<await_result_t<std::invoke_result_t<Fn &>>>
+{
+    using R = await_result_t<std::invoke_result_t<Fn &>>;
+    auto started = now();
+    auto delay = policy.initial_delay;
+    for(size_t attempt = 1;; attempt++) {
+        auto timeout = policy.attempt_timeout;
+        if(policy.deadline.count() != 0) {
+            auto left = policy.deadline - std::chrono::duration_cast<std::chrono::microseconds>(now() - started);
+            if(timeout.count() == 0 || left < timeout)
+                timeout = std::max(left, std::chrono::microseconds(1));
+        }
+
+        std::exception_ptr error;
+        try {
+            auto task = fn();
+            if(timeout.count() == 0) {
+                if constexpr(std::is_void_v<R>) {
+                    co_await std::move(task);
+                    co_return;
+                }
+                else
+                    co_return co_await std::move(task);
+            }
+            if constexpr(std::is_void_v<R>) {
+                co_await withTimeout(std::move(task), timeout);
+                co_return;
+            }
+            else
+                co_return co_await withTimeout(std::move(task), timeout);
+        }
+        catch(const OperationCancelled&) {
+            // Stopped from outside. A timed out attempt throws TimeoutError instead
+            throw;
+        }
+        catch(...) {
+            error = std::current_exception();
+        }
+
+        if(attempt >= policy.max_attempts || (policy.retry_on && !policy.retry_on(error)))
+            std::rethrow_exception(error);
+        auto wait = detail::jitterDelay(std::min(delay, policy.max_delay), policy.jitter);
+        if(policy.deadline.count() != 0 && now() + wait - started >= policy.deadline)
+            std::rethrow_exception(error);
+        co_await sleep(wait);
+        // Clamp in floating point, converting an out of range double is undefined
+        double next = delay.count() * policy.multiplier;
+        if(next >= static_cast<double>(policy.max_delay.count()))
+            delay = policy.max_delay;
+        else
+            delay = std::chrono::microseconds(static_cast<std::chrono::microseconds::rep>(next));
+    }
+}
 }
\ No newline at end of file
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <new>
+
+namespace gnunetpp::detail
+{
+/**
+ * @brief Per-thread free lists for coroutine frames, one per power of two size class.
+ *
+ * Coroutine frames are short lived and come in a handful of sizes. Recycling them
+ * avoids a malloc/free pair per coroutine call. Frames freed on another thread than
+ * they were allocated on simply move to that thread's lists. Each list is capped so
+ * a burst doesn't pin memory forever. Frames bigger than the largest class go
+ * straight to the global allocator.
+ *
+ * Define GNUNETPP_NO_FRAME_POOL to disable pooling.
+ */
+struct FramePool
+{
+    static constexpr size_t min_class_bits = 6;
+    static constexpr size_t num_classes = 6;
+    static constexpr size_t max_frame_size = size_t{1} << (min_class_bits + num_classes - 1);
+    static constexpr size_t max_cached_per_class = 256;
+
+    static void* allocate(size_t size)
+    {
+        size_t cls = sizeClass(size);
+        if(cls == num_classes)
+            return ::operator new(size);
+        // Always allocate the full class size, the frame may end up in another
+        // thread's list when freed
+        FramePool* pool = local();
+        if(pool == nullptr || pool->lists_[cls].head == nullptr)
+            return ::operator new(classSize(cls));
+        FreeList& list = pool->lists_[cls];
+        Block* block = list.head;
+        list.head = block->next;
+        list.count--;
+        return block;
+    }
+
+    static void deallocate(void* ptr, size_t size) noexcept
+    {
+        size_t cls = sizeClass(size);
+        FramePool* pool = local();
+        if(cls == num_classes || pool == nullptr || pool->lists_[cls].count == max_cached_per_class) {
+            ::operator delete(ptr);
+            return;
+        }
+        FreeList& list = pool->lists_[cls];
+        list.head = new (ptr) Block{list.head};
+        list.count++;
+    }
+
+    ~FramePool()
+    {
+        destroyed() = true;
+        for(auto& list : lists_) {
+            while(list.head != nullptr) {
+                Block* next = list.head->next;
+                ::operator delete(list.head);
+                list.head = next;
+            }
+        }
+    }
+
+protected:
+    struct Block
+    {
+        Block* next;
+    };
+
+    struct FreeList
+    {
+        Block* head = nullptr;
+        size_t count = 0;
+    };
+
+    static constexpr size_t classSize(size_t cls)
+    {
+        return size_t{1} << (min_class_bits + cls);
+    }
+
+    // Index of the smallest class that fits `size`, num_classes if none does
+    static constexpr size_t sizeClass(size_t size)
+    {
+        for(size_t cls = 0; cls < num_classes; cls++) {
+            if(size <= classSize(cls))
+                return cls;
+        }
+        return num_classes;
+    }
+
+    // Frames can be freed by thread_local and static destructors after this thread's
+    // pool is gone. Those fall back to the global allocator
+    static bool& destroyed()
+    {
+        static thread_local bool flag = false;
+        return flag;
+    }
+
+    static FramePool* local()
+    {
+        if(destroyed())
+            return nullptr;
+        static thread_local FramePool pool;
+        return &pool;
+    }
+
+    std::array<FreeList, num_classes> lists_;
+};
+
+/**
+ * @brief Inherit from this in a promise_type to allocate the coroutine frames from the FramePool
+ */
+struct PooledFrame
+{
+#ifndef GNUNETPP_NO_FRAME_POOL
+    static void* operator new(size_t size)
+    {
+        return FramePool::allocate(size);
+    }
+
+    static void operator delete(void* ptr, size_t size) noexcept
+    {
+        FramePool::deallocate(ptr, size);
+    }
+#endif
+};
+
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace gnunetpp
+{
+template <typename Signature, size_t InlineSize = 6 * sizeof(void*)>
+struct Function;
+
+namespace detail
+{
+template <typename T>
+struct IsStdFunction : std::false_type {};
+template <typename Signature>
+struct IsStdFunction<std::function<Signature>> : std::true_type {};
+}
+
+/**
+ * @brief Move-only replacement for std::function with inline storage.
+ *
+ * Callables up to `InlineSize` bytes that are nothrow movable are stored inside the
+ * Function itself, so capturing lambdas don't allocate. Anything larger goes to the
+ * heap. Being move-only it can hold lambdas capturing unique_ptr and the like.
+ *
+ * Like std::function, calling through a const Function calls the target as non-const.
+ */
+template <typename R, typename ... Args, size_t InlineSize>
+struct Function<R(Args...), InlineSize>
+{
+    Function() noexcept = default;
+    Function(std::nullptr_t) noexcept {}
+
+    template <typename F, typename D = std::decay_t<F>>
+        requires (!std::is_same_v<D, Function> && std::is_invocable_r_v<R, D&, Args...>)
+    Function(F&& fn)
+    {
+        // Empty std::function and null function pointers convert to an empty Function
+        if constexpr(std::is_pointer_v<D> || std::is_member_pointer_v<D> || detail::IsStdFunction<D>::value) {
+            if(fn == nullptr)
+                return;
+        }
+        if constexpr(storedInline<D>())
+            new (storage_) D(std::forward<F>(fn));
+        else
+            *reinterpret_cast<D**>(storage_) = new D(std::forward<F>(fn));
+        ops_ = &opsFor<D>;
+    }
+
+    Function(Function&& other) noexcept
+    {
+        moveFrom(other);
+    }
+
+    Function& operator=(Function&& other) noexcept
+    {
+        if(this != &other) {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    Function& operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+
+    template <typename F>
+        requires (!std::is_same_v<std::decay_t<F>, Function>)
+    Function& operator=(F&& fn)
+    {
+        Function tmp(std::forward<F>(fn));
+        reset();
+        moveFrom(tmp);
+        return *this;
+    }
+
+    Function(const Function&) = delete;
+    Function& operator=(const Function&) = delete;
+
+    ~Function()
+    {
+        reset();
+    }
+
+    R operator()(Args ... args) const
+    {
+        if(ops_ == nullptr)
+            throw std::bad_function_call();
+        return ops_->invoke(const_cast<unsigned char*>(storage_), std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return ops_ != nullptr;
+    }
+
+    friend bool operator==(const Function& fn, std::nullptr_t) noexcept
+    {
+        return !fn;
+    }
+
+    void reset() noexcept
+    {
+        if(ops_ != nullptr)
+            ops_->destroy(storage_);
+        ops_ = nullptr;
+    }
+
+    /**
+     * @brief True if callables of type F are stored without a heap allocation
+     */
+    template <typename F>
+    static constexpr bool storedInline()
+    {
+        return sizeof(F) <= InlineSize && alignof(F) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible_v<F>;
+    }
+
+protected:
+    struct Ops
+    {
+        R (*invoke)(void* storage, Args&& ... args);
+        // Move constructs into `to` and destroys `from`
+        void (*relocate)(void* from, void* to) noexcept;
+        void (*destroy)(void* storage) noexcept;
+    };
+
+    template <typename D>
+    static D* target(void* storage)
+    {
+        if constexpr(storedInline<D>())
+            return std::launder(reinterpret_cast<D*>(storage));
+        else
+            return *reinterpret_cast<D**>(storage);
+    }
+
+    template <typename D>
+    static constexpr Ops opsFor = {
+        [] (void* storage, Args&& ... args) -> R {
+            return std::invoke(*target<D>(storage), std::forward<Args>(args)...);
+        },
+        [] (void* from, void* to) noexcept {
+            if constexpr(storedInline<D>()) {
+                D* fn = target<D>(from);
+                new (to) D(std::move(*fn));
+                fn->~D();
+            }
+            else
+                *reinterpret_cast<D**>(to) = *reinterpret_cast<D**>(from);
+        },
+        [] (void* storage) noexcept {
+            if constexpr(storedInline<D>())
+                target<D>(storage)->~D();
+            else
+                delete target<D>(storage);
+        }
+    };
+
+    void moveFrom(Function& other) noexcept
+    {
+        if(other.ops_ == nullptr)
+            return;
+        other.ops_->relocate(other.storage_, storage_);
+        ops_ = other.ops_;
+        other.ops_ = nullptr;
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[InlineSize];
+    const Ops* ops_ = nullptr;
+};
+
+}
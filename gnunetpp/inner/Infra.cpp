@@ -1,7 +1,12 @@
 #include "Infra.hpp"
+#include "MPSCQueue.hpp"
+#include "Wakeup.hpp"
+#include "Instrumentation.hpp"
 
 #include <mutex>
+#include <atomic>
 #include <set>
+#include <cstdint>
 #include <cassert>
 #include <memory>
 #include <random>
@@ -10,32 +15,170 @@
 
 #include <gnunetpp-scheduler.hpp>
 
-static int g_notify_fds[2] = {-1, -1};
-
 namespace gnunetpp
 {
 namespace detail
 {
 thread_local std::mt19937_64 g_rng(std::random_device{}());
 static std::thread::id g_scheduler_thread_id;
+static pthread_t g_scheduler_thread;
+static Wakeup g_wakeup;
 void notifyWakeup()
 {
-    if(g_notify_fds[1] != -1)
-        write(g_notify_fds[1], "1", 1);
+    g_wakeup.notify();
+}
+
+// One inbox per GNUnet priority. KEEP and SHUTDOWN are never posted to
+struct Inbox
+{
+    MPSCQueue<Function<void()>> queue;
+    // Set by the first post after a drain. Cleared by the drain itself. Posts that
+    // see it already set know a drain is coming and skip the wakeup.
+    std::atomic<bool> drain_pending{false};
+    // Only touched on the GNUnet thread. A drain task is waiting in GNUnet's queue
+    bool drain_scheduled = false;
+    std::atomic<size_t> depth{0};
+    std::atomic<size_t> max_depth{0};
+    std::atomic<size_t> posted{0};
+};
+static Inbox g_inboxes[GNUNET_SCHEDULER_PRIORITY_COUNT];
+
+static void scheduleDrain(GNUNET_SCHEDULER_Priority priority);
+
+static void drainInbox(GNUNET_SCHEDULER_Priority priority)
+{
+    auto& inbox = g_inboxes[priority];
+    inbox.drain_scheduled = false;
+    // Clear before draining so anything posted while we run re-arms the wakeup
+    inbox.drain_pending.store(false);
+    size_t ran = 0;
+    try {
+        ran = inbox.queue.drain([&inbox](Function<void()>& fn) {
+            inbox.depth.fetch_sub(1, std::memory_order_relaxed);
+            CallbackScope scope(CallbackSite::Inbox);
+            ResumeBatch batch;
+            fn();
+        });
+    }
+    catch(...) {
+        // The callbacks after the one that threw stay queued. Nothing else would come back
+        // for them until the next post
+        inbox.drain_pending.store(true);
+        scheduleDrain(priority);
+        throw;
+    }
+    recordBatch(ran);
+}
+
+static void onDrainInbox(void* cls)
+{
+    drainInbox(static_cast<GNUNET_SCHEDULER_Priority>(reinterpret_cast<uintptr_t>(cls)));
+}
+
+// Lets GNUnet run the drain at the inbox's priority, in order with its other tasks
+static void scheduleDrain(GNUNET_SCHEDULER_Priority priority)
+{
+    auto& inbox = g_inboxes[priority];
+    if(inbox.drain_scheduled)
+        return;
+    inbox.drain_scheduled = true;
+    GNUNET_SCHEDULER_add_with_priority(priority, onDrainInbox, reinterpret_cast<void*>(static_cast<uintptr_t>(priority)));
+    wakeDriver();
+}
+
+void postToMainThread(Function<void()> fn, GNUNET_SCHEDULER_Priority priority)
+{
+    GNUNET_assert(priority > GNUNET_SCHEDULER_PRIORITY_KEEP && priority < GNUNET_SCHEDULER_PRIORITY_SHUTDOWN);
+    auto& inbox = g_inboxes[priority];
+    size_t depth = inbox.depth.fetch_add(1, std::memory_order_relaxed) + 1;
+    size_t max_depth = inbox.max_depth.load(std::memory_order_relaxed);
+    while(depth > max_depth && !inbox.max_depth.compare_exchange_weak(max_depth, depth, std::memory_order_relaxed)) {}
+    inbox.posted.fetch_add(1, std::memory_order_relaxed);
+
+    inbox.queue.push(std::move(fn));
+    if(inbox.drain_pending.exchange(true))
+        return;
+
+    if(inMainThread())
+        scheduleDrain(priority);
+    else if(g_wakeup.isOpen())
+        notifyWakeup();
+    else {
+        // Scheduler not running (yet or anymore). installNotifyFds() picks up
+        // whatever is in the inbox when the loop starts
+        inbox.drain_pending.store(false);
+    }
+}
+
+static void onDrainResumes(void*)
+{
+    CallbackScope scope(CallbackSite::Resume);
+    drainResumes();
+}
+
+// Deferred resumptions outside any ResumeBatch get a GNUnet task of their own
+static bool scheduleResumeDrain()
+{
+    if(!inMainThread())
+        return false;
+    GNUNET_SCHEDULER_add_now(onDrainResumes, nullptr);
+    wakeDriver();
+    return true;
+}
+
+static void onResumeYielded(void* cls)
+{
+    CallbackScope scope(CallbackSite::Resume);
+    ResumeBatch batch;
+    std::coroutine_handle<>::from_address(cls).resume();
+}
+
+static bool rescheduleCoroutine(std::coroutine_handle<> handle)
+{
+    if(!inMainThread())
+        return false;
+    GNUNET_SCHEDULER_add_now(onResumeYielded, handle.address());
+    wakeDriver();
+    return true;
+}
+
+static Function<void()> g_driver_wakeup;
+void setDriverWakeup(Function<void()> fn)
+{
+    g_driver_wakeup = std::move(fn);
+}
+
+void wakeDriver()
+{
+    if(g_driver_wakeup)
+        g_driver_wakeup();
+}
+
+pthread_t schedulerThread()
+{
+    return g_scheduler_thread;
+}
+
+InboxStats inboxStats(GNUNET_SCHEDULER_Priority priority)
+{
+    auto& inbox = g_inboxes[priority];
+    return {inbox.depth.load(std::memory_order_relaxed), inbox.max_depth.load(std::memory_order_relaxed)
+        , inbox.posted.load(std::memory_order_relaxed)};
 }
 
 static GNUNET_SCHEDULER_Task* g_select_task = nullptr;
 static GNUNET_NETWORK_FDSet* g_select_fds = nullptr;
 static void onInbountMessages(void*)
 {
-    GNUNET_assert(g_notify_fds[0] != -1);
-    char buf[1024];
-    while(true) {
-        ssize_t len = read(g_notify_fds[0], buf, sizeof(buf));
-        GNUNET_assert(len >= 0);
-        // if there's less data in the pipe then our buffer, we're done reading everything
-        if(len != sizeof(buf))
-            break;
+    GNUNET_assert(g_wakeup.isOpen());
+    g_wakeup.consume();
+    // This task runs at urgent priority already, no need to bounce urgent work
+    if(g_inboxes[GNUNET_SCHEDULER_PRIORITY_URGENT].drain_pending.load())
+        drainInbox(GNUNET_SCHEDULER_PRIORITY_URGENT);
+    for(int i = GNUNET_SCHEDULER_PRIORITY_IDLE; i < GNUNET_SCHEDULER_PRIORITY_URGENT; i++) {
+        auto priority = static_cast<GNUNET_SCHEDULER_Priority>(i);
+        if(g_inboxes[priority].drain_pending.load())
+            scheduleDrain(priority);
     }
 
     g_select_task = GNUNET_SCHEDULER_add_select(GNUNET_SCHEDULER_PRIORITY_URGENT, GNUNET_TIME_UNIT_FOREVER_REL, g_select_fds, nullptr
@@ -44,21 +187,30 @@ static void onInbountMessages(void*)
 
 static void installNotifyFds()
 {
-    GNUNET_assert(g_notify_fds[0] == -1 && g_notify_fds[1] == -1);
-    GNUNET_assert(pipe(g_notify_fds) == 0);
+    GNUNET_assert(!g_wakeup.isOpen());
+    GNUNET_assert(g_wakeup.open());
 
+    // The fdset is reused for every re-registration
     g_select_fds = GNUNET_NETWORK_fdset_create();
-    GNUNET_NETWORK_fdset_set_native(g_select_fds, g_notify_fds[0]);
+    GNUNET_NETWORK_fdset_set_native(g_select_fds, g_wakeup.fd());
     g_select_task = GNUNET_SCHEDULER_add_select(GNUNET_SCHEDULER_PRIORITY_URGENT, GNUNET_TIME_UNIT_FOREVER_REL, g_select_fds, nullptr
         , onInbountMessages, nullptr);
     GNUNET_SCHEDULER_add_shutdown([] (void* cls) {
         GNUNET_SCHEDULER_cancel(g_select_task);
-        close(g_notify_fds[0]);
-        close(g_notify_fds[1]);
-        g_notify_fds[0] = -1;
-        g_notify_fds[1] = -1;
+        g_wakeup.close();
         GNUNET_NETWORK_fdset_destroy(g_select_fds);
+        // Don't drop work that was posted but not yet picked up. Highest priority first
+        for(int i = GNUNET_SCHEDULER_PRIORITY_URGENT; i > GNUNET_SCHEDULER_PRIORITY_KEEP; i--)
+            drainInbox(static_cast<GNUNET_SCHEDULER_Priority>(i));
     }, nullptr);
+
+    for(int i = GNUNET_SCHEDULER_PRIORITY_IDLE; i <= GNUNET_SCHEDULER_PRIORITY_URGENT; i++) {
+        auto priority = static_cast<GNUNET_SCHEDULER_Priority>(i);
+        if(!g_inboxes[priority].queue.empty()) {
+            g_inboxes[priority].drain_pending.store(true);
+            scheduleDrain(priority);
+        }
+    }
 }
 
 }
@@ -87,10 +239,26 @@ void removeAllServices()
 }
 
 static bool g_running = false;
+void detail::startScheduler(const GNUNET_CONFIGURATION_Handle* cfg, const Function<void(const GNUNET_CONFIGURATION_Handle*)>& f)
+{
+    detail::g_scheduler_thread_id = std::this_thread::get_id();
+    detail::g_scheduler_thread = pthread_self();
+    detail::installNotifyFds();
+    detail::g_schedule_resume_drain = detail::scheduleResumeDrain;
+    detail::g_reschedule = detail::rescheduleCoroutine;
+
+    g_running = true;
+    // Needed to make GNUNet react to Ctrl+C
+    scheduler::runOnShutdown([]{
+        shutdown();
+    });
+    f(cfg);
+}
+
 void run(std::function<void(const GNUNET_CONFIGURATION_Handle*)> f, const std::string& service_name)
 {
     GNUNET_assert(!g_running);
-    using CallbackType = std::function<void(const GNUNET_CONFIGURATION_Handle* c)>;
+    using CallbackType = Function<void(const GNUNET_CONFIGURATION_Handle* c)>;
 
     const char* args_dummy = "gnunetpp";
     CallbackType* functor = new CallbackType(std::move(f));
@@ -100,17 +268,9 @@ void run(std::function<void(const GNUNET_CONFIGURATION_Handle*)> f, const std::s
     auto r = GNUNET_PROGRAM_run(1, const_cast<char**>(&args_dummy), service_name.c_str(), "no help", options
         , [](void *cls, char *const *args, const char *cfgfile
             , const GNUNET_CONFIGURATION_Handle* c) {
-                detail::installNotifyFds();
-                detail::g_scheduler_thread_id = std::this_thread::get_id();
                 std::unique_ptr<CallbackType> functor{static_cast<CallbackType*>(cls)};
                 assert(functor != nullptr);
-
-                g_running = true;
-                // Needed to make GNUNet react to Ctrl+C
-                scheduler::runOnShutdown([]{
-                    shutdown();
-                });
-                (*functor)(c);
+                detail::startScheduler(c, *functor);
             }
         , functor);
     if(r != GNUNET_OK)
@@ -131,13 +291,11 @@ void shutdown()
     if(!g_running)
         return;
     g_running = false;
-    GNUNET_SCHEDULER_add_now([] (void* d) {
+    detail::postToMainThread([] {
         scheduler::cancelAll();
         removeAllServices();
         scheduler::shutdown();
-    }, NULL);
-    if(!inMainThread())
-        detail::notifyWakeup();
+    });
 }
 
 bool inMainThread()
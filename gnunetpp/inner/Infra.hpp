@@ -1,10 +1,12 @@
 #pragma once
 
 #include <functional>
+#include <pthread.h>
 
 #include <gnunet/gnunet_core_service.h>
 #include "coroutine.hpp"
 #include "NonCopyable.hpp"
+#include "Function.hpp"
 
 namespace gnunetpp
 {
@@ -15,6 +17,57 @@ namespace detail
  * 
  */
 void notifyWakeup();
+
+/**
+ * @brief Posts a function to be ran on the GNUnet thread. Lock-free and safe to
+ * call from any thread. Functions posted between two wakeups are ran in a single
+ * batch. Only the first post after a drain wakes the scheduler up.
+ *
+ * Every priority has its own inbox, drained by a GNUnet task of that priority. So
+ * posted work competes with the rest of GNUnet's tasks at the priority it was posted
+ * with, instead of always jumping the queue.
+ *
+ * @param fn function to run
+ * @param priority GNUnet priority the function runs at
+ */
+void postToMainThread(Function<void()> fn, GNUNET_SCHEDULER_Priority priority = GNUNET_SCHEDULER_PRIORITY_DEFAULT);
+
+/**
+ * @brief Makes the calling thread the GNUnet thread, sets up cross-thread wakeups and
+ * calls `f`. Must run as a task of an already running GNUnet scheduler
+ */
+void startScheduler(const GNUNET_CONFIGURATION_Handle* cfg, const Function<void(const GNUNET_CONFIGURATION_Handle*)>& f);
+
+/**
+ * @brief Installs the wakeup of a loop driven by the application, see EpollDriver. GNUnet
+ * only tells such a driver about timeouts and fds, not about tasks that became ready
+ * outside of GNUNET_SCHEDULER_do_work(). Empty to uninstall
+ */
+void setDriverWakeup(Function<void()> fn);
+
+/**
+ * @brief Lets the installed driver know a task was added to GNUnet. GNUnet thread only
+ */
+void wakeDriver();
+
+/**
+ * @brief pthread handle of the thread running GNUnet. Only valid once the scheduler started
+ */
+pthread_t schedulerThread();
+
+struct InboxStats
+{
+    // Functions posted but not ran yet
+    size_t depth = 0;
+    // Highest depth seen since the program started
+    size_t max_depth = 0;
+    size_t posted = 0;
+};
+
+/**
+ * @brief Queue depth counters of the inbox of one priority
+ */
+InboxStats inboxStats(GNUNET_SCHEDULER_Priority priority);
 }
 
 struct Service : public NonCopyable
@@ -0,0 +1,22 @@
+#include "Instrumentation.hpp"
+
+namespace gnunetpp::detail
+{
+Instrumentation g_instrumentation;
+Heartbeat g_heartbeat;
+
+const char* callbackSiteName(CallbackSite site)
+{
+    switch(site) {
+        case CallbackSite::Timer: return "timer";
+        case CallbackSite::Inbox: return "queue";
+        case CallbackSite::Resume: return "coroutine resume";
+        case CallbackSite::CADET: return "cadet";
+        case CallbackSite::DHT: return "dht";
+        case CallbackSite::FS: return "fs";
+        case CallbackSite::Count: break;
+    }
+    return "unknown";
+}
+
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace gnunetpp::detail
+{
+/**
+ * @brief Places where gnunetpp hands the GNUnet thread to user code
+ */
+enum class CallbackSite
+{
+    Timer,
+    Inbox,
+    Resume,
+    CADET,
+    DHT,
+    FS,
+    Count
+};
+
+const char* callbackSiteName(CallbackSite site);
+
+/**
+ * @brief Lock-free log2 histogram. Bucket `i` counts values in [2^(i-1), 2^i), bucket 0
+ * counts zeros. Written from the GNUnet thread, readable from anywhere
+ */
+struct AtomicHistogram
+{
+    static constexpr size_t num_buckets = 64;
+
+    void record(uint64_t value)
+    {
+        buckets[std::bit_width(value)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(value, std::memory_order_relaxed);
+        uint64_t current = max.load(std::memory_order_relaxed);
+        while(value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+    }
+
+    void reset()
+    {
+        for(auto& bucket : buckets)
+            bucket.store(0, std::memory_order_relaxed);
+        count.store(0, std::memory_order_relaxed);
+        total.store(0, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+    }
+
+    std::array<std::atomic<uint64_t>, num_buckets + 1> buckets{};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> max{0};
+};
+
+struct Instrumentation
+{
+    std::atomic<bool> enabled{false};
+    // How late timers ran compared to when they were due, in nanoseconds
+    AtomicHistogram loop_lag;
+    // Time spent in callbacks, in nanoseconds
+    std::array<AtomicHistogram, static_cast<size_t>(CallbackSite::Count)> callbacks;
+    // Callbacks ran per inbox drain or timer wheel tick
+    AtomicHistogram batch_size;
+};
+
+extern Instrumentation g_instrumentation;
+
+/**
+ * @brief What the GNUnet thread is doing right now. Published for the watchdog, only
+ * written while a watchdog is running
+ */
+struct Heartbeat
+{
+    std::atomic<bool> enabled{false};
+    // Start of the outermost callback running on the GNUnet thread, 0 if none is
+    std::atomic<uint64_t> callback_start{0};
+    // Bumped for every outermost callback so the watchdog can tell them apart
+    std::atomic<uint64_t> sequence{0};
+    std::atomic<CallbackSite> site{CallbackSite::Count};
+    // Last time the event loop got around to run the heartbeat timer, 0 when not running
+    std::atomic<uint64_t> last_beat{0};
+};
+
+extern Heartbeat g_heartbeat;
+
+inline bool instrumentationEnabled()
+{
+    return g_instrumentation.enabled.load(std::memory_order_relaxed);
+}
+
+inline uint64_t instrumentationNow()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// The time the GNUnet thread has been busy with the current GNUnet task as far as gnunetpp
+// can tell. A new slice starts whenever GNUnet calls into gnunetpp, ie. the outermost
+// CallbackScope or ResumeBatch opens. It is timed lazily from the first check, so slices
+// that never check cost nothing
+struct TimeSlice
+{
+    uint64_t epoch = 0;
+    uint64_t timed_epoch = std::numeric_limits<uint64_t>::max();
+    std::chrono::steady_clock::time_point started;
+    // CallbackScopes and ResumeBatches open on this thread
+    size_t depth = 0;
+};
+inline thread_local TimeSlice t_time_slice;
+
+struct TimeSliceScope
+{
+    TimeSliceScope() noexcept
+    {
+        if(t_time_slice.depth++ == 0)
+            t_time_slice.epoch++;
+    }
+    ~TimeSliceScope()
+    {
+        t_time_slice.depth--;
+    }
+    TimeSliceScope(const TimeSliceScope&) = delete;
+    TimeSliceScope& operator=(const TimeSliceScope&) = delete;
+};
+
+/**
+ * @brief Times the callback ran in its scope when instrumentation is enabled and tells the
+ * watchdog about it when one is running. Two relaxed loads when neither is. Starts a new
+ * time slice when it is the outermost scope
+ */
+struct CallbackScope
+{
+    explicit CallbackScope(CallbackSite site)
+        : site_(site)
+    {
+        bool timed = instrumentationEnabled();
+        // Nested scopes are part of the outer callback as far as the watchdog cares
+        beat_ = g_heartbeat.enabled.load(std::memory_order_relaxed)
+            && g_heartbeat.callback_start.load(std::memory_order_relaxed) == 0;
+        if(!timed && !beat_)
+            return;
+        uint64_t now = instrumentationNow();
+        if(timed)
+            start_ = now;
+        if(beat_) {
+            g_heartbeat.site.store(site, std::memory_order_relaxed);
+            g_heartbeat.sequence.fetch_add(1, std::memory_order_relaxed);
+            g_heartbeat.callback_start.store(now, std::memory_order_release);
+        }
+    }
+
+    ~CallbackScope()
+    {
+        if(start_ != 0)
+            g_instrumentation.callbacks[static_cast<size_t>(site_)].record(instrumentationNow() - start_);
+        if(beat_)
+            g_heartbeat.callback_start.store(0, std::memory_order_release);
+    }
+
+    CallbackScope(const CallbackScope&) = delete;
+    CallbackScope& operator=(const CallbackScope&) = delete;
+
+protected:
+    TimeSliceScope slice_;
+    CallbackSite site_;
+    uint64_t start_ = 0;
+    bool beat_ = false;
+};
+
+inline void recordLoopLag(uint64_t lag_ns)
+{
+    if(instrumentationEnabled())
+        g_instrumentation.loop_lag.record(lag_ns);
+}
+
+inline void recordBatch(size_t callbacks)
+{
+    if(instrumentationEnabled() && callbacks != 0)
+        g_instrumentation.batch_size.record(callbacks);
+}
+
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+#include <cstddef>
+
+namespace gnunetpp::detail
+{
+/**
+ * @brief Lock-free multi-producer single-consumer queue
+ *
+ * Producers push onto an intrusive stack with a single CAS. The consumer takes
+ * the entire stack with one atomic exchange and reverses it, so items come out
+ * in FIFO order and a whole batch is drained per call. As the consumer never
+ * pops individual nodes there is no ABA problem.
+ */
+template <typename T>
+struct MPSCQueue
+{
+    MPSCQueue() = default;
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+    ~MPSCQueue()
+    {
+        freeList(head_.exchange(nullptr, std::memory_order_acquire));
+        freeList(pending_);
+    }
+
+    /**
+     * @brief Push an item. Safe to call from any thread
+     */
+    void push(T value)
+    {
+        Node* node = new Node{nullptr, std::move(value)};
+        Node* old_head = head_.load(std::memory_order_relaxed);
+        do {
+            node->next = old_head;
+        } while(!head_.compare_exchange_weak(old_head, node, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    /**
+     * @brief Takes everything currently in the queue and calls `fn` on each item in push order.
+     * Must only be called from the consumer thread. If `fn` throws, the items after the one
+     * it threw on stay queued and come first in the next drain
+     *
+     * @return size_t number of items drained
+     */
+    template <typename Fn>
+    size_t drain(Fn&& fn)
+    {
+        Node* node = head_.exchange(nullptr, std::memory_order_acq_rel);
+
+        // The stack is in LIFO order. Reverse it to get FIFO
+        Node* reversed = nullptr;
+        while(node != nullptr) {
+            Node* next = node->next;
+            node->next = reversed;
+            reversed = node;
+            node = next;
+        }
+
+        // Left over from a drain that threw, older than anything pushed since
+        if(pending_ != nullptr) {
+            Node* tail = pending_;
+            while(tail->next != nullptr)
+                tail = tail->next;
+            tail->next = reversed;
+            reversed = pending_;
+            pending_ = nullptr;
+        }
+        if(reversed == nullptr)
+            return 0;
+
+        struct KeepRest
+        {
+            Node*& pending;
+            Node*& rest;
+            ~KeepRest()
+            {
+                pending = rest;
+            }
+        } keep{pending_, reversed};
+
+        size_t count = 0;
+        while(reversed != nullptr) {
+            Node* current = reversed;
+            reversed = reversed->next;
+            T value = std::move(current->value);
+            delete current;
+            count++;
+            fn(value);
+        }
+        return count;
+    }
+
+    /**
+     * @brief Must only be called from the consumer thread
+     */
+    bool empty() const
+    {
+        return pending_ == nullptr && head_.load(std::memory_order_acquire) == nullptr;
+    }
+
+protected:
+    struct Node
+    {
+        Node* next;
+        T value;
+    };
+
+    static void freeList(Node* node)
+    {
+        while(node != nullptr) {
+            Node* next = node->next;
+            delete node;
+            node = next;
+        }
+    }
+
+    std::atomic<Node*> head_{nullptr};
+    // Consumer only. Items a throwing drain didn't get to, in FIFO order
+    Node* pending_ = nullptr;
+};
+
+}
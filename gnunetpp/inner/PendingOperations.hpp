@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <mutex>
+#include <string>
+
+namespace gnunetpp::detail
+{
+struct PendingOperation;
+
+/**
+ * @brief Every operation a coroutine is suspended on, oldest first. Only filled while
+ * tracking is enabled, see scheduler::enableOperationTracking()
+ */
+struct PendingRegistry
+{
+    std::atomic<bool> enabled{false};
+    std::mutex mutex;
+    PendingOperation* head = nullptr;
+    PendingOperation* tail = nullptr;
+    size_t count = 0;
+};
+
+inline PendingRegistry g_pending_registry;
+
+inline bool operationTrackingEnabled()
+{
+    return g_pending_registry.enabled.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Registry entry of an awaiter. Lives in the awaiter, so tracking doesn't allocate
+ * beyond the description of the target.
+ *
+ * Awaiters call track() when they actually suspend and untrack() before resuming the
+ * coroutine. Untracked on destruction as well, in case the coroutine is destroyed while
+ * suspended.
+ */
+struct PendingOperation
+{
+    explicit PendingOperation(const char* kind = "operation")
+        : kind(kind)
+    {
+    }
+    // Awaiters are only moved before they suspend, so the registry links aren't carried over
+    PendingOperation(PendingOperation&& other) noexcept
+        : kind(other.kind)
+        , target(std::move(other.target))
+    {
+    }
+    PendingOperation& operator=(const PendingOperation&) = delete;
+
+    ~PendingOperation()
+    {
+        untrack();
+    }
+
+    /**
+     * @brief Sets what the operation is about. `target` is only called while tracking is
+     * enabled, so formatting keys and peer ids costs nothing otherwise
+     */
+    template <typename Fn>
+    void describe(const char* what, Fn&& target)
+    {
+        kind = what;
+        if(operationTrackingEnabled())
+            this->target = target();
+    }
+
+    void describe(const char* what)
+    {
+        kind = what;
+    }
+
+    void track(std::coroutine_handle<> handle)
+    {
+        if(!operationTrackingEnabled() || linked)
+            return;
+        auto& registry = g_pending_registry;
+        coroutine = handle.address();
+        since = std::chrono::steady_clock::now();
+        std::lock_guard lock(registry.mutex);
+        prev = registry.tail;
+        next = nullptr;
+        if(registry.tail)
+            registry.tail->next = this;
+        else
+            registry.head = this;
+        registry.tail = this;
+        registry.count++;
+        linked = true;
+    }
+
+    void untrack()
+    {
+        if(!linked)
+            return;
+        auto& registry = g_pending_registry;
+        std::lock_guard lock(registry.mutex);
+        if(prev)
+            prev->next = next;
+        else
+            registry.head = next;
+        if(next)
+            next->prev = prev;
+        else
+            registry.tail = prev;
+        registry.count--;
+        prev = next = nullptr;
+        linked = false;
+    }
+
+    const char* kind;
+    std::string target;
+    std::chrono::steady_clock::time_point since;
+    void* coroutine = nullptr;
+    PendingOperation* prev = nullptr;
+    PendingOperation* next = nullptr;
+    bool linked = false;
+};
+
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string_view>
+
+namespace gnunetpp::detail
+{
+/**
+ * @brief Growable byte ring buffer for input parsing.
+ *
+ * Data is appended at the tail with writable() and commit(), and consumed from the head.
+ * peek() hands out a contiguous view of the oldest bytes, rotating the buffer in the rare
+ * case they wrap around the end. Capacity is a power of two and only grows.
+ *
+ * Not thread safe.
+ */
+struct RingBuffer
+{
+    static constexpr size_t npos = std::string_view::npos;
+
+    explicit RingBuffer(size_t capacity = 4096)
+        : capacity_(std::bit_ceil(std::max<size_t>(capacity, 16)))
+        , data_(std::make_unique<char[]>(capacity_))
+    {
+    }
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+    RingBuffer(RingBuffer&&) = default;
+    RingBuffer& operator=(RingBuffer&&) = default;
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    bool full() const
+    {
+        return size_ == capacity_;
+    }
+
+    char operator[](size_t idx) const
+    {
+        assert(idx < size_);
+        return data_[(head_ + idx) & (capacity_ - 1)];
+    }
+
+    /**
+     * @brief Contiguous free space after the tail. Empty when the buffer is full, may be
+     * shorter than the total free space when it wraps around
+     */
+    std::span<char> writable()
+    {
+        size_t tail = (head_ + size_) & (capacity_ - 1);
+        size_t contiguous = std::min(capacity_ - size_, capacity_ - tail);
+        return {data_.get() + tail, contiguous};
+    }
+
+    /**
+     * @brief Makes `n` bytes written into writable() part of the buffer
+     */
+    void commit(size_t n)
+    {
+        assert(n <= capacity_ - size_);
+        size_ += n;
+    }
+
+    /**
+     * @brief Drops the first `n` bytes
+     */
+    void consume(size_t n)
+    {
+        assert(n <= size_);
+        size_ -= n;
+        // Starting over at the front keeps most data from wrapping
+        head_ = size_ == 0 ? 0 : (head_ + n) & (capacity_ - 1);
+    }
+
+    /**
+     * @brief Grows the buffer so that at least `n` more bytes fit
+     */
+    void reserve(size_t n)
+    {
+        if(capacity_ - size_ >= n)
+            return;
+        size_t capacity = std::bit_ceil(size_ + n);
+        auto data = std::make_unique<char[]>(capacity);
+        copyOut(data.get(), size_);
+        data_ = std::move(data);
+        capacity_ = capacity;
+        head_ = 0;
+    }
+
+    /**
+     * @brief Index of the first `c` at or after `from`, npos if there is none
+     */
+    size_t find(char c, size_t from = 0) const
+    {
+        while(from < size_) {
+            size_t start = (head_ + from) & (capacity_ - 1);
+            size_t len = std::min(size_ - from, capacity_ - start);
+            if(auto found = static_cast<const char*>(memchr(data_.get() + start, c, len)))
+                return from + (found - (data_.get() + start));
+            from += len;
+        }
+        return npos;
+    }
+
+    /**
+     * @brief The first `n` bytes as one contiguous view. Valid until the buffer is modified
+     */
+    std::string_view peek(size_t n)
+    {
+        assert(n <= size_);
+        if(head_ + n > capacity_) {
+            std::rotate(data_.get(), data_.get() + head_, data_.get() + capacity_);
+            head_ = 0;
+        }
+        return {data_.get() + head_, n};
+    }
+
+    /**
+     * @brief Copies the first `n` bytes to `dest` without consuming them
+     */
+    void copyOut(char* dest, size_t n) const
+    {
+        assert(n <= size_);
+        size_t first = std::min(n, capacity_ - head_);
+        memcpy(dest, data_.get() + head_, first);
+        memcpy(dest + first, data_.get(), n - first);
+    }
+
+protected:
+    size_t capacity_;
+    std::unique_ptr<char[]> data_;
+    size_t head_ = 0;
+    size_t size_ = 0;
+};
+
+}
@@ -0,0 +1,292 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace gnunetpp::detail
+{
+/**
+ * @brief Generational-index slot map. O(1) add, lookup and remove.
+ *
+ * Handles are `(generation << 32) | index`. A slot's generation is bumped both when it is
+ * filled and when it is freed, so live slots always have an odd generation. This means
+ * a valid handle is never 0 and a handle to a removed element is detected as stale
+ * instead of aliasing whatever reused the slot.
+ *
+ * Elements are stored in fixed size chunks that never move. References and pointers
+ * stay valid until the element itself is removed.
+ *
+ * Not thread safe. See ConcurrentSlotMap
+ */
+template <typename T, size_t ChunkSize = 256>
+struct SlotMap
+{
+    using Handle = size_t;
+    static_assert(sizeof(Handle) == sizeof(uint64_t));
+    static constexpr Handle invalid_handle = 0;
+
+    SlotMap() = default;
+    SlotMap(const SlotMap&) = delete;
+    SlotMap& operator=(const SlotMap&) = delete;
+    ~SlotMap()
+    {
+        clear();
+    }
+
+    template <typename ... Args>
+    std::pair<Handle, T&> emplace(Args&& ... args)
+    {
+        uint32_t index = acquireSlot();
+        Slot& slot = slotAt(index);
+        new (slot.storage) T(std::forward<Args>(args)...);
+        slot.generation++;
+        assert(slot.generation % 2 == 1);
+        count_++;
+        return {makeHandle(index, slot.generation), *slot.value()};
+    }
+
+    std::pair<Handle, T&> add(T&& data)
+    {
+        return emplace(std::move(data));
+    }
+
+    /**
+     * @brief Returns the element referred to by `handle` or nullptr if the handle is stale
+     */
+    T* get(Handle handle)
+    {
+        Slot* slot = lookup(handle);
+        return slot ? slot->value() : nullptr;
+    }
+
+    const T* get(Handle handle) const
+    {
+        return const_cast<SlotMap*>(this)->get(handle);
+    }
+
+    bool contains(Handle handle) const
+    {
+        return get(handle) != nullptr;
+    }
+
+    /**
+     * @brief Removes the element. Returns false if the handle is stale
+     */
+    bool remove(Handle handle)
+    {
+        Slot* slot = lookup(handle);
+        if(slot == nullptr)
+            return false;
+        release(*slot, indexOf(handle));
+        return true;
+    }
+
+    /**
+     * @brief Moves the element out and removes it. Returns std::nullopt if the handle is stale
+     */
+    std::optional<T> take(Handle handle)
+    {
+        Slot* slot = lookup(handle);
+        if(slot == nullptr)
+            return std::nullopt;
+        std::optional<T> result{std::move(*slot->value())};
+        release(*slot, indexOf(handle));
+        return result;
+    }
+
+    size_t size() const
+    {
+        return count_;
+    }
+
+    bool empty() const
+    {
+        return count_ == 0;
+    }
+
+    /**
+     * @brief Returns handles to all live elements
+     */
+    std::vector<Handle> handles() const
+    {
+        std::vector<Handle> result;
+        result.reserve(count_);
+        for(uint32_t i = 0; i < capacity_; i++) {
+            const Slot& slot = const_cast<SlotMap*>(this)->slotAt(i);
+            if(slot.generation % 2 == 1)
+                result.push_back(makeHandle(i, slot.generation));
+        }
+        return result;
+    }
+
+    void clear()
+    {
+        for(uint32_t i = 0; i < capacity_; i++) {
+            Slot& slot = slotAt(i);
+            if(slot.generation % 2 == 1)
+                release(slot, i);
+        }
+    }
+
+protected:
+    struct Slot
+    {
+        alignas(T) unsigned char storage[sizeof(T)];
+        uint32_t generation = 0;
+        uint32_t next_free = 0;
+
+        T* value()
+        {
+            return std::launder(reinterpret_cast<T*>(storage));
+        }
+    };
+
+    static Handle makeHandle(uint32_t index, uint32_t generation)
+    {
+        return (static_cast<Handle>(generation) << 32) | index;
+    }
+
+    static uint32_t indexOf(Handle handle)
+    {
+        return static_cast<uint32_t>(handle & 0xffffffff);
+    }
+
+    static uint32_t generationOf(Handle handle)
+    {
+        return static_cast<uint32_t>(handle >> 32);
+    }
+
+    Slot& slotAt(uint32_t index)
+    {
+        return chunks_[index / ChunkSize][index % ChunkSize];
+    }
+
+    Slot* lookup(Handle handle)
+    {
+        uint32_t index = indexOf(handle);
+        uint32_t generation = generationOf(handle);
+        if(index >= capacity_ || generation % 2 == 0)
+            return nullptr;
+        Slot& slot = slotAt(index);
+        if(slot.generation != generation)
+            return nullptr;
+        return &slot;
+    }
+
+    uint32_t acquireSlot()
+    {
+        if(free_head_ != no_free_slot) {
+            uint32_t index = free_head_;
+            free_head_ = slotAt(index).next_free;
+            return index;
+        }
+        if(capacity_ % ChunkSize == 0)
+            chunks_.emplace_back(new Slot[ChunkSize]);
+        return capacity_++;
+    }
+
+    void release(Slot& slot, uint32_t index)
+    {
+        slot.value()->~T();
+        slot.generation++;
+        slot.next_free = free_head_;
+        free_head_ = index;
+        count_--;
+    }
+
+    static constexpr uint32_t no_free_slot = 0xffffffff;
+    std::vector<std::unique_ptr<Slot[]>> chunks_;
+    uint32_t capacity_ = 0;
+    uint32_t free_head_ = no_free_slot;
+    size_t count_ = 0;
+};
+
+/**
+ * @brief Mutex protected SlotMap. Safe to add, lookup and remove from any thread.
+ *
+ * Elements are only reachable while holding the lock, through visit() or take(). Nothing
+ * hands out references or pointers that outlive it
+ */
+template <typename T, size_t ChunkSize = 256>
+struct ConcurrentSlotMap
+{
+    using Handle = typename SlotMap<T, ChunkSize>::Handle;
+    static constexpr Handle invalid_handle = SlotMap<T, ChunkSize>::invalid_handle;
+
+    template <typename ... Args>
+    Handle emplace(Args&& ... args)
+    {
+        std::lock_guard l(mtx);
+        return map.emplace(std::forward<Args>(args)...).first;
+    }
+
+    Handle add(T&& data)
+    {
+        std::lock_guard l(mtx);
+        return map.add(std::move(data)).first;
+    }
+
+    bool contains(Handle handle)
+    {
+        std::lock_guard l(mtx);
+        return map.contains(handle);
+    }
+
+    /**
+     * @brief Calls `fn` with the element while holding the lock.
+     *
+     * @return true if the handle was valid and `fn` was called
+     */
+    template <typename Fn>
+    bool visit(Handle handle, Fn&& fn)
+    {
+        std::lock_guard l(mtx);
+        T* data = map.get(handle);
+        if(data == nullptr)
+            return false;
+        fn(*data);
+        return true;
+    }
+
+    bool remove(Handle handle)
+    {
+        std::lock_guard l(mtx);
+        return map.remove(handle);
+    }
+
+    std::optional<T> take(Handle handle)
+    {
+        std::lock_guard l(mtx);
+        return map.take(handle);
+    }
+
+    size_t size()
+    {
+        std::lock_guard l(mtx);
+        return map.size();
+    }
+
+    std::vector<Handle> handles()
+    {
+        std::lock_guard l(mtx);
+        return map.handles();
+    }
+
+    void clear()
+    {
+        std::lock_guard l(mtx);
+        map.clear();
+    }
+protected:
+    std::mutex mtx;
+    SlotMap<T, ChunkSize> map;
+};
+
+}
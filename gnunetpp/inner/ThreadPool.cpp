@@ -0,0 +1,147 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace gnunetpp::detail
+{
+// Index of the worker the current thread is, if any. Lets workers push to their own deque
+static thread_local const ThreadPool* t_pool = nullptr;
+static thread_local size_t t_worker_index = 0;
+
+ThreadPool::ThreadPool(size_t num_threads, bool collect_stats)
+    : collect_stats_(collect_stats)
+{
+    num_threads = std::max<size_t>(num_threads, 1);
+    workers_.reserve(num_threads);
+    for(size_t i = 0; i < num_threads; i++)
+        workers_.push_back(std::make_unique<Worker>());
+    running_ = num_threads;
+    // Start the threads only after every deque exists, workers steal from each other
+    for(size_t i = 0; i < num_threads; i++)
+        workers_[i]->thread = std::thread([this, i] { workerLoop(i); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    stop();
+    for(auto& worker : workers_)
+        worker->thread.join();
+}
+
+void ThreadPool::stop()
+{
+    {
+        std::lock_guard lock(sleep_mtx_);
+        stop_ = true;
+    }
+    sleep_cv_.notify_all();
+}
+
+void ThreadPool::submit(Function<void()> job)
+{
+    size_t index;
+    if(t_pool == this)
+        index = t_worker_index;
+    else
+        index = next_worker_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+
+    Job entry{std::move(job), {}};
+    if(collect_stats_)
+        entry.submitted_at = std::chrono::steady_clock::now();
+    submitted_.fetch_add(1, std::memory_order_relaxed);
+
+    // Count the job before it becomes visible so `pending_` never underflows. Bump it
+    // under the lock so a worker about to sleep can't miss it
+    {
+        std::lock_guard lock(sleep_mtx_);
+        pending_.fetch_add(1);
+    }
+    {
+        std::lock_guard lock(workers_[index]->mtx);
+        workers_[index]->jobs.push_back(std::move(entry));
+    }
+    sleep_cv_.notify_one();
+}
+
+ThreadPool::Stats ThreadPool::stats() const
+{
+    Stats result;
+    result.submitted = submitted_.load(std::memory_order_relaxed);
+    result.completed = completed_.load(std::memory_order_relaxed);
+    result.stolen = stolen_.load(std::memory_order_relaxed);
+    std::lock_guard lock(timing_mtx_);
+    result.total_wait = total_wait_;
+    result.total_run = total_run_;
+    result.max_run = max_run_;
+    return result;
+}
+
+bool ThreadPool::popLocal(size_t index, Job& job)
+{
+    auto& worker = *workers_[index];
+    std::lock_guard lock(worker.mtx);
+    if(worker.jobs.empty())
+        return false;
+    job = std::move(worker.jobs.back());
+    worker.jobs.pop_back();
+    return true;
+}
+
+bool ThreadPool::steal(size_t index, Job& job)
+{
+    for(size_t i = 1; i < workers_.size(); i++) {
+        auto& victim = *workers_[(index + i) % workers_.size()];
+        std::lock_guard lock(victim.mtx);
+        if(victim.jobs.empty())
+            continue;
+        job = std::move(victim.jobs.front());
+        victim.jobs.pop_front();
+        stolen_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::run(Job& job)
+{
+    if(!collect_stats_) {
+        job.fn();
+        completed_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    job.fn();
+    auto end = std::chrono::steady_clock::now();
+    completed_.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard lock(timing_mtx_);
+    total_wait_ += start - job.submitted_at;
+    total_run_ += end - start;
+    max_run_ = std::max<std::chrono::nanoseconds>(max_run_, end - start);
+}
+
+void ThreadPool::workerLoop(size_t index)
+{
+    t_pool = this;
+    t_worker_index = index;
+    while(true) {
+        Job job;
+        if(popLocal(index, job) || steal(index, job)) {
+            pending_.fetch_sub(1);
+            run(job);
+            continue;
+        }
+
+        // Stopping still runs every queued job, coroutines waiting on them would never resume
+        std::unique_lock lock(sleep_mtx_);
+        sleep_cv_.wait(lock, [this] { return stop_ || pending_.load() != 0; });
+        if(stop_ && pending_.load() == 0) {
+            running_.fetch_sub(1);
+            return;
+        }
+    }
+}
+
+}
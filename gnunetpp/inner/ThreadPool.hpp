@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "NonCopyable.hpp"
+#include "Function.hpp"
+
+namespace gnunetpp::detail
+{
+/**
+ * @brief Work-stealing thread pool
+ *
+ * Every worker owns a deque. Jobs submitted from a worker go to its own deque and are
+ * popped LIFO for cache locality. Jobs from other threads are spread round-robin.
+ * Idle workers steal from the front of other workers' deques before going to sleep.
+ */
+struct ThreadPool : public NonCopyable
+{
+    struct Stats
+    {
+        size_t submitted = 0;
+        size_t completed = 0;
+        size_t stolen = 0;
+        // Only collected when `collect_stats` is set
+        std::chrono::nanoseconds total_wait{0};
+        std::chrono::nanoseconds total_run{0};
+        std::chrono::nanoseconds max_run{0};
+    };
+
+    explicit ThreadPool(size_t num_threads, bool collect_stats = false);
+    /**
+     * @brief Runs the jobs still queued, then joins the workers. Blocks until then
+     */
+    ~ThreadPool();
+
+    /**
+     * @brief Queues a job. Safe to call from any thread, including the workers. Not after
+     * stop()
+     */
+    void submit(Function<void()> job);
+
+    /**
+     * @brief Lets the workers exit once the jobs still queued ran. Doesn't wait for them
+     */
+    void stop();
+
+    /**
+     * @brief True once stop() was called and every worker is done
+     */
+    bool finished() const
+    {
+        return running_.load() == 0;
+    }
+
+    size_t size() const
+    {
+        return workers_.size();
+    }
+
+    Stats stats() const;
+
+protected:
+    struct Job
+    {
+        Function<void()> fn;
+        std::chrono::steady_clock::time_point submitted_at;
+    };
+
+    struct Worker
+    {
+        std::mutex mtx;
+        std::deque<Job> jobs;
+        std::thread thread;
+    };
+
+    void workerLoop(size_t index);
+    bool popLocal(size_t index, Job& job);
+    bool steal(size_t index, Job& job);
+    void run(Job& job);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<size_t> next_worker_{0};
+    bool collect_stats_;
+
+    // Sleeping workers wait for `pending_` to become non zero
+    std::mutex sleep_mtx_;
+    std::condition_variable sleep_cv_;
+    std::atomic<size_t> pending_{0};
+    bool stop_ = false;
+    std::atomic<size_t> running_{0};
+
+    std::atomic<size_t> submitted_{0};
+    std::atomic<size_t> completed_{0};
+    std::atomic<size_t> stolen_{0};
+    mutable std::mutex timing_mtx_;
+    std::chrono::nanoseconds total_wait_{0};
+    std::chrono::nanoseconds total_run_{0};
+    std::chrono::nanoseconds max_run_{0};
+};
+
+}
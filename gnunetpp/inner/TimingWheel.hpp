@@ -0,0 +1,294 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <optional>
+
+namespace gnunetpp::detail
+{
+/**
+ * @brief Intrusive timer entry. Embed it in whatever owns the timer
+ */
+struct TimerNode
+{
+    TimerNode* prev = nullptr;
+    TimerNode* next = nullptr;
+    uint64_t deadline = 0;
+    // opaque value for the owner to find itself from the node
+    size_t cookie = 0;
+    // where in the wheel the node currently is
+    uint16_t slot = 0;
+    uint8_t level = 0;
+
+    bool linked() const
+    {
+        return next != nullptr;
+    }
+};
+
+/**
+ * @brief Hierarchical timing wheel. O(1) insert and remove, expires timers in batches.
+ *
+ * Time is measured in ticks. Level 0 has one slot per tick, each level above covers
+ * 256 times the range of the previous one. Timers in higher levels are cascaded down
+ * when the lower level wraps around. Deadlines beyond the range of the top level are
+ * parked in the furthest slot and re-filed every time they cascade.
+ *
+ * Not thread safe.
+ */
+struct TimingWheel
+{
+    static constexpr size_t num_levels = 4;
+    static constexpr size_t slot_bits = 8;
+    static constexpr size_t num_slots = 1 << slot_bits;
+    static constexpr uint64_t slot_mask = num_slots - 1;
+
+    explicit TimingWheel(uint64_t now = 0) : current_(now)
+    {
+        for(auto& level : levels_)
+            for(auto& slot : level)
+                initList(slot);
+        initList(due_);
+    }
+    TimingWheel(const TimingWheel&) = delete;
+    TimingWheel& operator=(const TimingWheel&) = delete;
+
+    /**
+     * @brief Adds a timer that expires at tick `deadline`. Deadlines that already passed
+     * expire on the next call to advance()
+     */
+    void insert(TimerNode* node, uint64_t deadline)
+    {
+        assert(!node->linked());
+        node->deadline = deadline;
+        file(node);
+        size_++;
+    }
+
+    /**
+     * @brief Removes a pending timer. No-op if the timer isn't in the wheel
+     */
+    void remove(TimerNode* node)
+    {
+        if(!node->linked())
+            return;
+        unlink(node);
+        size_--;
+    }
+
+    /**
+     * @brief Moves time forward to `now` and calls `on_expire` for every timer that
+     * expired, in deadline order. `on_expire` may insert and remove timers.
+     *
+     * @return size_t number of expired timers
+     */
+    template <typename Fn>
+    size_t advance(uint64_t now, Fn&& on_expire)
+    {
+        size_t expired = expire(due_, on_expire);
+        while(current_ < now) {
+            if(size_ == 0) {
+                current_ = now;
+                break;
+            }
+
+            // Skip ahead to whatever comes first: the next occupied level 0 slot or
+            // the next cascade. Nothing can expire in between
+            uint64_t next = (current_ | slot_mask) + 1;
+            if(level_size_[0] != 0)
+                next = std::min(next, nextOccupied(0));
+            if(next > now) {
+                current_ = now;
+                break;
+            }
+            current_ = next;
+
+            for(size_t level = 1; level < num_levels; level++) {
+                if((current_ & levelMask(level - 1)) != 0)
+                    break;
+                cascade(level, slotIndex(current_, level));
+            }
+            expired += expire(levels_[0][slotIndex(current_, 0)], on_expire);
+            expired += expire(due_, on_expire);
+        }
+        return expired;
+    }
+
+    /**
+     * @brief Returns the earliest tick at which advance() may expire something. Exact
+     * for timers in level 0, the cascade time (a lower bound) for timers further away.
+     */
+    std::optional<uint64_t> nextDeadline() const
+    {
+        if(size_ == 0)
+            return std::nullopt;
+        if(!isEmpty(due_))
+            return current_;
+        std::optional<uint64_t> result;
+        for(size_t level = 0; level < num_levels; level++) {
+            if(level_size_[level] == 0)
+                continue;
+            uint64_t tick = nextOccupied(level);
+            if(!result || tick < *result)
+                result = tick;
+        }
+        assert(result.has_value() && "TimingWheel size is out of sync with its slots");
+        return result;
+    }
+
+    uint64_t now() const
+    {
+        return current_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+protected:
+    static constexpr uint8_t due_level = 0xff;
+
+    // Sentinel of a circular doubly linked list
+    using List = TimerNode;
+
+    static void initList(List& list)
+    {
+        list.prev = &list;
+        list.next = &list;
+    }
+
+    static bool isEmpty(const List& list)
+    {
+        return list.next == &list;
+    }
+
+    static uint64_t levelMask(size_t level)
+    {
+        return (uint64_t{1} << (slot_bits * (level + 1))) - 1;
+    }
+
+    static size_t slotIndex(uint64_t tick, size_t level)
+    {
+        return (tick >> (level * slot_bits)) & slot_mask;
+    }
+
+    bool occupied(size_t level, size_t slot) const
+    {
+        return !isEmpty(levels_[level][slot]);
+    }
+
+    // Start tick of the first occupied slot of `level` after the current one
+    uint64_t nextOccupied(size_t level) const
+    {
+        size_t shift = level * slot_bits;
+        size_t current_slot = slotIndex(current_, level);
+        for(size_t i = 1; i <= num_slots; i++) {
+            if(occupied(level, (current_slot + i) & slot_mask))
+                return ((current_ >> shift) + i) << shift;
+        }
+        return std::numeric_limits<uint64_t>::max();
+    }
+
+    static void pushBack(List& list, TimerNode* node)
+    {
+        node->prev = list.prev;
+        node->next = &list;
+        list.prev->next = node;
+        list.prev = node;
+    }
+
+    // Puts the node into the right list. Doesn't touch size_
+    void file(TimerNode* node)
+    {
+        if(node->deadline <= current_) {
+            node->level = due_level;
+            pushBack(due_, node);
+            return;
+        }
+        uint64_t delta = node->deadline - current_;
+        uint64_t deadline = node->deadline;
+        size_t level = 0;
+        while(level < num_levels - 1 && delta > levelMask(level))
+            level++;
+        // Too far in the future, park it in the furthest slot. It gets re-filed on cascade
+        if(delta > levelMask(level))
+            deadline = current_ + levelMask(level);
+        size_t slot = slotIndex(deadline, level);
+        node->level = static_cast<uint8_t>(level);
+        node->slot = static_cast<uint16_t>(slot);
+        pushBack(levels_[level][slot], node);
+        level_size_[level]++;
+    }
+
+    void unlink(TimerNode* node)
+    {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        node->prev = nullptr;
+        node->next = nullptr;
+        if(node->level != due_level)
+            level_size_[node->level]--;
+    }
+
+    // Detaches the whole list into `out`, leaving `list` empty
+    void detach(List& list, List& out)
+    {
+        initList(out);
+        if(isEmpty(list))
+            return;
+        out.next = list.next;
+        out.prev = list.prev;
+        out.next->prev = &out;
+        out.prev->next = &out;
+        initList(list);
+    }
+
+    void cascade(size_t level, size_t slot)
+    {
+        List pending;
+        detach(levels_[level][slot], pending);
+        while(!isEmpty(pending)) {
+            TimerNode* node = pending.next;
+            unlink(node);
+            file(node);
+        }
+    }
+
+    template <typename Fn>
+    size_t expire(List& list, Fn& on_expire)
+    {
+        if(isEmpty(list))
+            return 0;
+        // Callbacks may add timers that expire immediately or cancel timers in the
+        // batch. Work from a detached list so both cases stay consistent
+        List batch;
+        detach(list, batch);
+        size_t count = 0;
+        while(!isEmpty(batch)) {
+            TimerNode* node = batch.next;
+            unlink(node);
+            size_--;
+            count++;
+            on_expire(node);
+        }
+        return count;
+    }
+
+    List due_;
+    std::array<std::array<List, num_slots>, num_levels> levels_;
+    std::array<size_t, num_levels> level_size_{};
+    uint64_t current_;
+    size_t size_ = 0;
+};
+
+}
@@ -0,0 +1,70 @@
+#include "Wakeup.hpp"
+
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+namespace gnunetpp::detail
+{
+bool Wakeup::open()
+{
+    if(isOpen())
+        return true;
+#ifdef __linux__
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(fd != -1) {
+        read_fd_ = fd;
+        write_fd_ = fd;
+        return true;
+    }
+#endif
+    // Fallback for systems without eventfd
+    int fds[2];
+    if(pipe(fds) != 0)
+        return false;
+    for(int fd : fds) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    read_fd_ = fds[0];
+    write_fd_ = fds[1];
+    return true;
+}
+
+void Wakeup::close()
+{
+    if(!isOpen())
+        return;
+    ::close(read_fd_);
+    if(write_fd_ != read_fd_)
+        ::close(write_fd_);
+    read_fd_ = -1;
+    write_fd_ = -1;
+    pending_.store(false);
+}
+
+void Wakeup::notify()
+{
+    if(pending_.exchange(true))
+        return;
+    if(write_fd_ == -1)
+        return;
+    // eventfd wants exactly 8 bytes. For the pipe, any data will do
+    uint64_t one = 1;
+    [[maybe_unused]] auto len = write(write_fd_, &one, write_fd_ == read_fd_ ? sizeof(one) : 1);
+}
+
+void Wakeup::consume()
+{
+    // An eventfd resets with one read. The pipe holds at most a few bytes as only
+    // notifies that find the flag cleared write
+    uint64_t buf[8];
+    while(read(read_fd_, buf, sizeof(buf)) > 0 && read_fd_ != write_fd_) {}
+    pending_.store(false);
+}
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+
+#include "NonCopyable.hpp"
+
+namespace gnunetpp::detail
+{
+/**
+ * @brief A file descriptor another thread can poke to wake up an event loop.
+ *
+ * Uses an eventfd on Linux and a non-blocking pipe elsewhere. An atomic pending
+ * flag coalesces notifications: however many threads call notify() between two
+ * consume() calls, only the first one writes to the fd.
+ */
+struct Wakeup : public NonCopyable
+{
+    Wakeup() = default;
+    ~Wakeup()
+    {
+        close();
+    }
+
+    /**
+     * @brief Creates the fds. Returns false if the system refused to
+     */
+    bool open();
+    void close();
+
+    bool isOpen() const
+    {
+        return read_fd_ != -1;
+    }
+
+    /**
+     * @brief The fd to poll for readability
+     */
+    int fd() const
+    {
+        return read_fd_;
+    }
+
+    /**
+     * @brief Wakes the loop up. Safe to call from any thread
+     */
+    void notify();
+
+    /**
+     * @brief Resets the fd. Call from the loop before handling whatever the wakeup was for,
+     * so a notify() racing with the handling triggers another wakeup
+     */
+    void consume();
+
+protected:
+    std::atomic<bool> pending_{false};
+    int read_fd_ = -1;
+    int write_fd_ = -1;
+};
+
+}
@@ -0,0 +1,212 @@
+#include "Watchdog.hpp"
+#include "Infra.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+
+#include <execinfo.h>
+
+namespace gnunetpp::detail
+{
+// Filled by the signal handler on the GNUnet thread. The handler only stores raw return
+// addresses, everything that allocates or takes locks (symbolizing them) runs on the
+// watchdog thread. backtrace() itself is only safe in the handler once libgcc is loaded,
+// which the constructor does up front
+static constexpr int g_max_frames = 64;
+static void* g_frames[g_max_frames];
+static int g_frame_count = 0;
+static struct sigaction g_old_action;
+
+// Who owns g_frames. The handler only writes them if a capture is requested, so a signal
+// arriving after the watchdog gave up can't write while they are being read
+enum CaptureState : int
+{
+    Idle,
+    Requested,
+    Capturing,
+    Captured
+};
+static std::atomic<int> g_capture_state{Idle};
+static_assert(std::atomic<int>::is_always_lock_free, "the signal handler needs a lock-free atomic");
+
+static void onBacktraceSignal(int)
+{
+    int expected = Requested;
+    if(!g_capture_state.compare_exchange_strong(expected, Capturing, std::memory_order_acquire))
+        return;
+    int saved_errno = errno;
+    g_frame_count = backtrace(g_frames, g_max_frames);
+    g_capture_state.store(Captured, std::memory_order_release);
+    errno = saved_errno;
+}
+
+Watchdog::Watchdog(Options options)
+    : options_(options)
+{
+    if(options_.capture_backtrace) {
+        // The first call to backtrace() loads libgcc with dlopen(), which is not safe in a
+        // signal handler. Do it here, the handler only ever makes later calls
+        static bool preloaded = [] {
+            void* frame;
+            return backtrace(&frame, 1) >= 0;
+        }();
+        (void)preloaded;
+        struct sigaction action{};
+        action.sa_handler = onBacktraceSignal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGURG, &action, &g_old_action);
+    }
+    g_heartbeat.enabled.store(true, std::memory_order_relaxed);
+    thread_ = std::thread([this] { run(); });
+}
+
+Watchdog::~Watchdog()
+{
+    {
+        std::lock_guard lock{mutex_};
+        stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+    g_heartbeat.enabled.store(false, std::memory_order_relaxed);
+    if(options_.capture_backtrace)
+        sigaction(SIGURG, &g_old_action, nullptr);
+}
+
+Watchdog::Stats Watchdog::stats() const
+{
+    std::lock_guard lock{mutex_};
+    return stats_;
+}
+
+void Watchdog::run()
+{
+    std::unique_lock lock{mutex_};
+    while(!cv_.wait_for(lock, options_.interval, [this] { return stop_; })) {
+        lock.unlock();
+        check();
+        lock.lock();
+    }
+}
+
+void Watchdog::check()
+{
+    auto& heartbeat = g_heartbeat;
+    uint64_t sequence = heartbeat.sequence.load(std::memory_order_acquire);
+    uint64_t start = heartbeat.callback_start.load(std::memory_order_acquire);
+    CallbackSite site = heartbeat.site.load(std::memory_order_relaxed);
+    // Another callback started while sampling. It can't have been running for long
+    if(sequence != heartbeat.sequence.load(std::memory_order_acquire))
+        return;
+    uint64_t now = instrumentationNow();
+    uint64_t threshold = options_.threshold.count();
+    {
+        std::lock_guard lock{mutex_};
+        stats_.checks++;
+    }
+
+    if(start != 0) {
+        reporting_loop_ = false;
+        uint64_t running = now > start ? now - start : 0;
+        if(running < threshold) {
+            reporting_callback_ = false;
+            return;
+        }
+        if(reporting_callback_ && sequence == reported_sequence_) {
+            updateDuration(running);
+            return;
+        }
+        reporting_callback_ = true;
+        reported_sequence_ = sequence;
+        // The heartbeat timer couldn't run during the callback either. Don't report that
+        // again as a loop stall
+        reported_beat_ = heartbeat.last_beat.load(std::memory_order_acquire);
+        report(site, running);
+        return;
+    }
+
+    reporting_callback_ = false;
+    uint64_t beat = heartbeat.last_beat.load(std::memory_order_acquire);
+    // Scheduler not running
+    if(beat == 0)
+        return;
+    uint64_t silent = now > beat ? now - beat : 0;
+    if(silent < threshold + options_.interval.count()) {
+        reporting_loop_ = false;
+        return;
+    }
+    if(beat == reported_beat_) {
+        if(reporting_loop_)
+            updateDuration(silent);
+        return;
+    }
+    reporting_loop_ = true;
+    reported_beat_ = beat;
+    report(CallbackSite::Count, silent);
+}
+
+void Watchdog::report(CallbackSite site, uint64_t duration_ns)
+{
+    Stall stall;
+    stall.site = site;
+    stall.duration = std::chrono::nanoseconds(duration_ns);
+    stall.detected_at = std::chrono::system_clock::now();
+    if(options_.capture_backtrace)
+        stall.backtrace = captureBacktrace();
+
+    std::lock_guard lock{mutex_};
+    stats_.stalls++;
+    stats_.stalls_by_site[static_cast<size_t>(site)]++;
+    stats_.longest = std::max(stats_.longest, stall.duration);
+    stats_.recent.push_back(std::move(stall));
+    while(stats_.recent.size() > options_.max_reports)
+        stats_.recent.pop_front();
+}
+
+void Watchdog::updateDuration(uint64_t duration_ns)
+{
+    std::lock_guard lock{mutex_};
+    std::chrono::nanoseconds duration(duration_ns);
+    if(!stats_.recent.empty())
+        stats_.recent.back().duration = std::max(stats_.recent.back().duration, duration);
+    stats_.longest = std::max(stats_.longest, duration);
+}
+
+std::vector<std::string> Watchdog::captureBacktrace()
+{
+    g_capture_state.store(Requested, std::memory_order_release);
+    if(pthread_kill(schedulerThread(), SIGURG) != 0) {
+        g_capture_state.store(Idle, std::memory_order_relaxed);
+        return {};
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+    while(g_capture_state.load(std::memory_order_acquire) != Captured) {
+        if(std::chrono::steady_clock::now() >= deadline) {
+            // Withdraw the request. If the handler already started, wait for it to finish
+            int expected = Requested;
+            if(g_capture_state.compare_exchange_strong(expected, Idle))
+                return {};
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    int count = g_frame_count;
+    g_capture_state.store(Idle, std::memory_order_relaxed);
+    if(count <= 0)
+        return {};
+
+    std::vector<std::string> frames;
+    char** symbols = backtrace_symbols(g_frames, count);
+    if(symbols == nullptr)
+        return {};
+    // Skip the signal handler and the signal trampoline
+    for(int i = 2; i < count; i++)
+        frames.emplace_back(symbols[i]);
+    free(symbols);
+    return frames;
+}
+
+}
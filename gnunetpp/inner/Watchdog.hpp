@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "NonCopyable.hpp"
+#include "Instrumentation.hpp"
+
+namespace gnunetpp::detail
+{
+/**
+ * @brief Samples the heartbeat published by CallbackScope and the scheduler from its own
+ * thread and reports callbacks that hold the GNUnet thread for too long.
+ *
+ * A stall is either a callback running longer than the threshold, or the event loop not
+ * getting around to run the heartbeat timer for that long while no known callback is
+ * running. Each stall is reported once and its duration updated until it ends.
+ * Optionally the GNUnet thread is interrupted with SIGURG to capture a backtrace of where
+ * it is stuck. The handler only records return addresses with backtrace(), preloaded so it
+ * doesn't dlopen() libgcc inside the handler. They are symbolized on the watchdog thread.
+ * The application must not use SIGURG itself while this is on. Only one Watchdog may exist
+ * at a time.
+ */
+struct Watchdog : public NonCopyable
+{
+    struct Options
+    {
+        std::chrono::nanoseconds threshold;
+        std::chrono::nanoseconds interval;
+        bool capture_backtrace = false;
+        size_t max_reports = 16;
+    };
+
+    struct Stall
+    {
+        // CallbackSite::Count if the loop stalled outside of a known callback
+        CallbackSite site = CallbackSite::Count;
+        std::chrono::nanoseconds duration{0};
+        std::chrono::system_clock::time_point detected_at;
+        std::vector<std::string> backtrace;
+    };
+
+    struct Stats
+    {
+        size_t checks = 0;
+        size_t stalls = 0;
+        // Indexed by CallbackSite, the last entry counts stalls outside known callbacks
+        std::array<size_t, static_cast<size_t>(CallbackSite::Count) + 1> stalls_by_site{};
+        std::chrono::nanoseconds longest{0};
+        // The most recent stalls, oldest first
+        std::deque<Stall> recent;
+    };
+
+    explicit Watchdog(Options options);
+    ~Watchdog();
+
+    Stats stats() const;
+
+protected:
+    void run();
+    void check();
+    void report(CallbackSite site, uint64_t duration_ns);
+    void updateDuration(uint64_t duration_ns);
+    std::vector<std::string> captureBacktrace();
+
+    Options options_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    Stats stats_;
+    // The stall reported last, to not report the same one again
+    uint64_t reported_sequence_ = 0;
+    uint64_t reported_beat_ = 0;
+    bool reporting_callback_ = false;
+    bool reporting_loop_ = false;
+    std::thread thread_;
+};
+
+}
@@ -8,6 +8,8 @@
 #include <cassert>
 #include <coroutine>
 
+#include "FramePool.hpp"
+
 namespace gnunetpp
 {
 	template<typename T>
@@ -20,7 +22,7 @@ namespace gnunetpp
 		class async_generator_yield_operation;
 		class async_generator_advance_operation;
 
-		class async_generator_promise_base
+		class async_generator_promise_base : public PooledFrame
 		{
 		public:
 
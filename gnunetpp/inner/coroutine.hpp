@@ -1,15 +1,195 @@
 #pragma once
 #include "async_generator.hpp"
-
+#include "FramePool.hpp"
+#include "Function.hpp"
+#include "Instrumentation.hpp"
+#include "PendingOperations.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <variant>
 #include <queue>
 #include <limits>
+#include <stdexcept>
+#include <stop_token>
+#include <tuple>
+#include <vector>
 
 namespace gnunetpp
 {
 
+/**
+ * @brief Thrown by operations that were aborted through their stop token
+ */
+struct OperationCancelled : public std::runtime_error
+{
+    OperationCancelled() : std::runtime_error("Operation cancelled")
+    {
+    }
+};
+
+/**
+ * @brief Runs a function when a stop is requested. Stops are expected to be requested
+ * from the GNUnet thread as the callbacks abort GNUnet operations.
+ */
+using StopCallback = std::stop_callback<Function<void()>>;
+
+namespace detail
+{
+// Tasks without a stop token of their own observe the one of the coroutine awaiting them
+template <typename Promise, typename Parent>
+void inheritStopToken(Promise &promise, std::coroutine_handle<Parent> parent) noexcept
+{
+    if constexpr (requires { parent.promise().stop_token_; }) {
+        if (!promise.stop_token_.stop_possible())
+            promise.stop_token_ = parent.promise().stop_token_;
+    }
+}
+
+// See scheduler::setDeferredResume()
+inline std::atomic<bool> g_defer_resumes{false};
+// Installed by the scheduler. Arranges for drainResumes() to run soon on the calling
+// thread. Returns false if it can't, ie. the caller isn't the GNUnet thread
+inline bool (*g_schedule_resume_drain)() = nullptr;
+
+// Installed by the scheduler. Resumes `handle` from a new GNUnet task so that the GNUnet
+// thread gets to run other ready work first. Returns false if the caller isn't the GNUnet thread
+inline bool (*g_reschedule)(std::coroutine_handle<>) = nullptr;
+
+// How long coroutines may keep the GNUnet thread before giving it up. 0 when off. See
+// scheduler::setAutoYield()
+inline std::atomic<int64_t> g_auto_yield_budget_ns{0};
+inline std::atomic<uint64_t> g_yields{0};
+inline std::atomic<uint64_t> g_forced_yields{0};
+
+// How long the current TimeSlice has been running, see Instrumentation.hpp
+inline std::chrono::nanoseconds sliceElapsed()
+{
+    auto &slice = t_time_slice;
+    auto now = std::chrono::steady_clock::now();
+    if (slice.timed_epoch != slice.epoch) {
+        slice.timed_epoch = slice.epoch;
+        slice.started = now;
+        return std::chrono::nanoseconds(0);
+    }
+    return now - slice.started;
+}
+
+// Whether an awaiter that could continue right away should give up the thread instead
+inline bool autoYieldDue()
+{
+    int64_t budget = g_auto_yield_budget_ns.load(std::memory_order_relaxed);
+    return budget != 0 && g_reschedule != nullptr && sliceElapsed().count() >= budget;
+}
+
+/**
+ * @brief Resumes `handle` from its own GNUnet task. Returns false, and leaves resuming to
+ * the caller, if that isn't possible from this thread
+ */
+inline bool yieldThread(std::coroutine_handle<> handle, bool forced)
+{
+    if (g_reschedule == nullptr || !g_reschedule(handle))
+        return false;
+    (forced ? g_forced_yields : g_yields).fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+// See scheduler::yieldIfExpired()
+struct YieldIfExpiredAwaiter
+{
+    bool await_ready() const
+    {
+        return sliceElapsed() < budget_;
+    }
+    bool await_suspend(std::coroutine_handle<> handle) const
+    {
+        return yieldThread(handle, false);
+    }
+    void await_resume() const noexcept
+    {
+    }
+
+    std::chrono::nanoseconds budget_;
+};
+
+// Coroutines whose resumption was deferred on this thread
+struct ResumeQueue
+{
+    std::vector<std::coroutine_handle<>> pending;
+    size_t batch_depth = 0;
+    bool drain_scheduled = false;
+};
+inline thread_local ResumeQueue t_resume_queue;
+
+/**
+ * @brief Resumes the deferred coroutines. Coroutines woken meanwhile are appended and
+ * resumed by the same loop, so the stack doesn't grow with the number of resumptions
+ */
+inline void drainResumes()
+{
+    auto &queue = t_resume_queue;
+    queue.drain_scheduled = false;
+    queue.batch_depth++;
+    for (size_t i = 0; i < queue.pending.size(); i++) {
+        auto handle = queue.pending[i];
+        handle.resume();
+    }
+    queue.pending.clear();
+    queue.batch_depth--;
+}
+
+/**
+ * @brief Resumes a coroutine waiting on a GNUnet callback. With deferred resumption enabled
+ * the coroutine runs once the outermost ResumeBatch on this thread closes, or from its own
+ * GNUnet task if there is none, instead of on top of the callback's stack
+ */
+inline void resumeFromCallback(std::coroutine_handle<> handle)
+{
+    if (!g_defer_resumes.load(std::memory_order_relaxed)) {
+        // Services that call straight from GNUnet into the awaiter don't open a scope,
+        // this is where their callback starts a new time slice
+        TimeSliceScope slice;
+        handle.resume();
+        return;
+    }
+    auto &queue = t_resume_queue;
+    if (queue.batch_depth == 0 && !queue.drain_scheduled) {
+        if (g_schedule_resume_drain == nullptr || !g_schedule_resume_drain()) {
+            handle.resume();
+            return;
+        }
+        queue.drain_scheduled = true;
+    }
+    queue.pending.push_back(handle);
+}
+
+/**
+ * @brief Marks a callback from GNUnet. Deferred resumptions requested inside run when the
+ * outermost batch closes
+ */
+struct ResumeBatch
+{
+    ResumeBatch() noexcept
+    {
+        t_resume_queue.batch_depth++;
+    }
+    ~ResumeBatch()
+    {
+        auto &queue = t_resume_queue;
+        if (--queue.batch_depth == 0 && !queue.pending.empty())
+            drainResumes();
+    }
+    ResumeBatch(const ResumeBatch &) = delete;
+    ResumeBatch &operator=(const ResumeBatch &) = delete;
+
+    TimeSliceScope slice_;
+};
+}
+
 struct final_awaiter
 {
     bool await_ready() noexcept
@@ -60,8 +240,16 @@ struct [[nodiscard]] Task
         return *this;
     }
 
-    struct promise_type
+    struct promise_type : public detail::PooledFrame
     {
+        promise_type() = default;
+        promise_type(const promise_type&) = delete;
+        ~promise_type()
+        {
+            if (has_value_)
+                value()->~T();
+        }
+
         Task<T> get_return_object()
         {
             return Task<T>{handle_type::from_promise(*this)};
@@ -72,11 +260,13 @@ struct [[nodiscard]] Task
         }
         void return_value(const T &v)
         {
-            value_ = std::make_unique<T>(v);
+            new (value_) T(v);
+            has_value_ = true;
         }
         void return_value(T &&v)
         {
-            value_ = std::make_unique<T>(std::move(v));
+            new (value_) T(std::move(v));
+            has_value_ = true;
         }
 
         auto final_suspend() noexcept
@@ -93,16 +283,21 @@ struct [[nodiscard]] Task
         {
             if (exception_ != nullptr)
                 std::rethrow_exception(exception_);
-            assert(value_ != nullptr);
-            return std::move(*value_);
+            assert(has_value_);
+            return std::move(*value());
         }
 
         T &result() &
         {
             if (exception_ != nullptr)
                 std::rethrow_exception(exception_);
-            assert(value_ != nullptr);
-            return *value_;
+            assert(has_value_);
+            return *value();
+        }
+
+        T *value()
+        {
+            return std::launder(reinterpret_cast<T *>(value_));
         }
 
         void setContinuation(std::coroutine_handle<> handle)
@@ -111,69 +306,58 @@ struct [[nodiscard]] Task
         }
 
         // HACK: GCC has bug disambiguating the forward(&&) and forward(&) overloads
-        // so we need to use a pointer to avoid the ambiguity. Otherwise both 
-        // variant and optional can't be used here to avoid that allocation.
-        std::unique_ptr<T> value_;
+        // so both variant and optional can't be used here. Manage the lifetime of
+        // the value by hand in raw storage instead, which also avoids allocating.
+        alignas(T) unsigned char value_[sizeof(T)];
         std::exception_ptr exception_;
         bool has_value_ = false;
         
         std::coroutine_handle<> continuation_;
+        std::stop_token stop_token_;
     };
 
-    auto operator co_await() const &noexcept
+    /**
+     * @brief Sets the stop token observed by this task and everything it awaits
+     */
+    void setStopToken(std::stop_token token)
+    {
+        coro_.promise().stop_token_ = std::move(token);
+    }
+
+    // Hoisted out of operator co_await() as local classes can't have member templates
+    struct awaiter
     {
-        struct awaiter
+      public:
+        explicit awaiter(handle_type coro) : coro_(coro)
         {
-          public:
-            explicit awaiter(handle_type coro) : coro_(coro)
-            {
-            }
-            bool await_ready() noexcept
-            {
-                return !coro_ || coro_.done();
-            }
-            auto await_suspend(std::coroutine_handle<> handle) noexcept
-            {
-                coro_.promise().setContinuation(handle);
-                return coro_;
-            }
-            T await_resume()
-            {
-                auto &&v = coro_.promise().result();
-                return std::move(v);
-            }
+        }
+        bool await_ready() noexcept
+        {
+            return !coro_ || coro_.done();
+        }
+        template <typename Promise>
+        auto await_suspend(std::coroutine_handle<Promise> handle) noexcept
+        {
+            coro_.promise().setContinuation(handle);
+            detail::inheritStopToken(coro_.promise(), handle);
+            return coro_;
+        }
+        T await_resume()
+        {
+            return std::move(coro_.promise().result());
+        }
+
+      private:
+        handle_type coro_;
+    };
 
-          private:
-            handle_type coro_;
-        };
+    auto operator co_await() const &noexcept
+    {
         return awaiter(coro_);
     }
 
     auto operator co_await() const &&noexcept
     {
-        struct awaiter
-        {
-          public:
-            explicit awaiter(handle_type coro) : coro_(coro)
-            {
-            }
-            bool await_ready() noexcept
-            {
-                return !coro_ || coro_.done();
-            }
-            auto await_suspend(std::coroutine_handle<> handle) noexcept
-            {
-                coro_.promise().setContinuation(handle);
-                return coro_;
-            }
-            T await_resume()
-            {
-                return std::move(coro_.promise().result());
-            }
-
-          private:
-            handle_type coro_;
-        };
         return awaiter(coro_);
     }
     handle_type coro_;
@@ -212,7 +396,7 @@ struct [[nodiscard]] Task<void>
         return *this;
     }
 
-    struct promise_type
+    struct promise_type : public detail::PooledFrame
     {
         Task<> get_return_object()
         {
@@ -244,67 +428,102 @@ struct [[nodiscard]] Task<void>
         }
         std::exception_ptr exception_;
         std::coroutine_handle<> continuation_;
+        std::stop_token stop_token_;
     };
 
-    auto operator co_await() const &noexcept
+    /**
+     * @brief Sets the stop token observed by this task and everything it awaits
+     */
+    void setStopToken(std::stop_token token)
     {
-        struct awaiter
+        coro_.promise().stop_token_ = std::move(token);
+    }
+
+    // Hoisted out of operator co_await() as local classes can't have member templates
+    struct awaiter
+    {
+      public:
+        explicit awaiter(handle_type coro) : coro_(coro)
         {
-          public:
-            explicit awaiter(handle_type coro) : coro_(coro)
-            {
-            }
-            bool await_ready() noexcept
-            {
-                return !coro_ || coro_.done();
-            }
-            auto await_suspend(std::coroutine_handle<> handle) noexcept
-            {
-                coro_.promise().setContinuation(handle);
-                return coro_;
-            }
-            auto await_resume()
-            {
-                coro_.promise().result();
-            }
+        }
+        bool await_ready() noexcept
+        {
+            return !coro_ || coro_.done();
+        }
+        template <typename Promise>
+        auto await_suspend(std::coroutine_handle<Promise> handle) noexcept
+        {
+            coro_.promise().setContinuation(handle);
+            detail::inheritStopToken(coro_.promise(), handle);
+            return coro_;
+        }
+        void await_resume()
+        {
+            coro_.promise().result();
+        }
+
+      private:
+        handle_type coro_;
+    };
 
-          private:
-            handle_type coro_;
-        };
+    auto operator co_await() const &noexcept
+    {
         return awaiter(coro_);
     }
 
     auto operator co_await() const &&noexcept
     {
-        struct awaiter
-        {
-          public:
-            explicit awaiter(handle_type coro) : coro_(coro)
-            {
-            }
-            bool await_ready() noexcept
-            {
-                return false;
-            }
-            auto await_suspend(std::coroutine_handle<> handle) noexcept
-            {
-                coro_.promise().setContinuation(handle);
-                return coro_;
-            }
-            void await_resume()
-            {
-                coro_.promise().result();
-            }
-
-          private:
-            handle_type coro_;
-        };
         return awaiter(coro_);
     }
     handle_type coro_;
 };
 
 
+namespace detail
+{
+struct StopTokenAwaiter
+{
+    bool await_ready() noexcept
+    {
+        return false;
+    }
+    template <typename Promise>
+    bool await_suspend(std::coroutine_handle<Promise> handle) noexcept
+    {
+        if constexpr (requires { handle.promise().stop_token_; })
+            token_ = handle.promise().stop_token_;
+        return false;
+    }
+    std::stop_token await_resume() noexcept
+    {
+        return std::move(token_);
+    }
+
+    std::stop_token token_;
+};
+}
+
+/**
+ * @brief Awaits the stop token of the calling coroutine. Empty if it has none
+ *
+ * Tasks inherit the token of the coroutine awaiting them unless they were given one
+ * with `Task::setStopToken()`.
+ */
+inline auto currentStopToken() noexcept
+{
+    return detail::StopTokenAwaiter{};
+}
+
+/**
+ * @brief Lets `task` be stopped through `token`
+ */
+template <typename T>
+Task<T> withStopToken(Task<T> task, std::stop_token token)
+{
+    task.setStopToken(std::move(token));
+    return task;
+}
+
 // Fires a coroutine and doesn't force waiting nor deallocates upon promise destructs
 // NOTE: AsyncTask is designed to be not awaitable. And kills the entire process
 // if exception escaped.
@@ -337,7 +556,7 @@ struct AsyncTask
         return *this;
     }
 
-    struct promise_type
+    struct promise_type : public detail::PooledFrame
     {
         std::coroutine_handle<> continuation_;
 
@@ -477,70 +696,141 @@ template <typename T = void>
 struct EagerAwaiter : public CallbackAwaiter<T>
 {
     std::coroutine_handle<> handle_ = std::noop_coroutine();
-    void await_suspend(std::coroutine_handle<> handle_) noexcept
+    detail::PendingOperation pending_;
+
+    // Operations that complete before being awaited don't suspend at all, rather than
+    // resuming from inside await_suspend() and growing the stack. Unless the time slice
+    // is used up with automatic yielding on
+    bool await_ready() noexcept
+    {
+        return hasCompleted() && !detail::autoYieldDue();
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle_) noexcept
     {
+        if(hasCompleted())
+            return detail::autoYieldDue() && detail::yieldThread(handle_, true);
+        pending_.track(handle_);
         this->handle_ = handle_;
-        if(CallbackAwaiter<T>::result_.has_value() || CallbackAwaiter<T>::exception_ != nullptr)
-            handle_.resume();
+        return true;
+    }
+
+    /**
+     * @brief Names the operation for scheduler::pendingOperations(). `target` returns the
+     * key, name or peer it is about and is only called while tracking is enabled
+     */
+    template <typename Fn>
+    void describe(const char* kind, Fn&& target)
+    {
+        pending_.describe(kind, std::forward<Fn>(target));
+    }
+
+    void describe(const char* kind)
+    {
+        pending_.describe(kind);
     }
 
     void setValue(const T &v)
     {
         CallbackAwaiter<T>::setValue(v);
-        if(handle_ != std::noop_coroutine())
-            handle_.resume();
+        if(handle_ != std::noop_coroutine()) {
+            pending_.untrack();
+            detail::resumeFromCallback(handle_);
+        }
     }
 
     void setValue(T &&v)
     {
         CallbackAwaiter<T>::setValue(std::move(v));
-        if(handle_ != std::noop_coroutine())
-            handle_.resume();
+        if(handle_ != std::noop_coroutine()) {
+            pending_.untrack();
+            detail::resumeFromCallback(handle_);
+        }
     }
 
     void setException(const std::exception_ptr &e)
     {
         CallbackAwaiter<T>::setException(e);
-        if(handle_ != std::noop_coroutine())
-            handle_.resume();
+        if(handle_ != std::noop_coroutine()) {
+            pending_.untrack();
+            detail::resumeFromCallback(handle_);
+        }
     }
 
     bool hasResult() const noexcept
     {
         return CallbackAwaiter<T>::result_.has_value();
     }
+
+    bool hasCompleted() const noexcept
+    {
+        return CallbackAwaiter<T>::result_.has_value() || CallbackAwaiter<T>::exception_ != nullptr;
+    }
 };
 
 template <>
 struct EagerAwaiter<void> : public CallbackAwaiter<>
 {
     std::coroutine_handle<> handle_ = std::noop_coroutine();
+    detail::PendingOperation pending_;
     bool value_set = false;
-    void await_suspend(std::coroutine_handle<> handle_) noexcept
+
+    bool await_ready() noexcept
+    {
+        return hasCompleted() && !detail::autoYieldDue();
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle_) noexcept
     {
+        if(hasCompleted())
+            return detail::autoYieldDue() && detail::yieldThread(handle_, true);
+        pending_.track(handle_);
         this->handle_ = handle_;
-        if(exception_ != nullptr || value_set)
-            handle_.resume();
+        return true;
+    }
+
+    /**
+     * @brief Names the operation for scheduler::pendingOperations(). `target` returns the
+     * key, name or peer it is about and is only called while tracking is enabled
+     */
+    template <typename Fn>
+    void describe(const char* kind, Fn&& target)
+    {
+        pending_.describe(kind, std::forward<Fn>(target));
+    }
+
+    void describe(const char* kind)
+    {
+        pending_.describe(kind);
     }
 
     void setException(const std::exception_ptr &e)
     {
         CallbackAwaiter<>::setException(e);
-        if(handle_ != std::noop_coroutine())
-            handle_.resume();
+        if(handle_ != std::noop_coroutine()) {
+            pending_.untrack();
+            detail::resumeFromCallback(handle_);
+        }
     }
 
     void setValue()
     {
         value_set = true;
-        if(handle_ != std::noop_coroutine())
-            handle_.resume();
+        if(handle_ != std::noop_coroutine()) {
+            pending_.untrack();
+            detail::resumeFromCallback(handle_);
+        }
     }
     
     bool hasResult() const noexcept
     {
         return value_set;
     }
+
+    bool hasCompleted() const noexcept
+    {
+        return exception_ != nullptr || value_set;
+    }
 };
 
 template <typename T>
@@ -551,6 +841,7 @@ struct QueuedAwaiter
     std::coroutine_handle<> handle_;
     bool finished_ = false;
     mutable std::mutex mtx_;
+    detail::PendingOperation pending_;
 
     void addValue(T&& value)
     {
@@ -561,8 +852,10 @@ struct QueuedAwaiter
             handle = handle_;
             handle_ = nullptr;
         }
-        if(handle)
-            handle.resume();
+        if(handle) {
+            pending_.untrack();
+            detail::resumeFromCallback(handle);
+        }
     }
 
     void addException(std::exception_ptr&& exception)
@@ -574,8 +867,10 @@ struct QueuedAwaiter
             handle = handle_;
             handle_ = nullptr;
         }
-        if(handle)
-            handle.resume();
+        if(handle) {
+            pending_.untrack();
+            detail::resumeFromCallback(handle);
+        }
     }
 
     void finish()
@@ -590,48 +885,78 @@ struct QueuedAwaiter
             handle = handle_;
             handle_ = nullptr;
         }
-        if(handle)
-            handle.resume();
+        if(handle) {
+            pending_.untrack();
+            detail::resumeFromCallback(handle);
+        }
     }
 
     bool await_ready() const noexcept
     {
-        std::lock_guard lock(mtx_);
-        return !queue_.empty();
+        {
+            std::lock_guard lock(mtx_);
+            if(queue_.empty())
+                return false;
+        }
+        return !detail::autoYieldDue();
     }
 
     std::optional<T> await_resume() noexcept(false)
     {
-        auto try_front = [this]() ->std::optional<ElementType> {
-            std::lock_guard lock(mtx_);
-            if(queue_.empty())
-                return std::nullopt;
-            return std::move(queue_.front());
-        };
-        auto front = try_front();
-        assert(front.has_value());
-
+        std::optional<T> item;
+        take(item);
+        return item;
+    }
 
-        if(front->index() == 1)
-            std::rethrow_exception(std::get<1>(*front));
-        else {
-            auto item = std::move(std::get<0>(*front));
-            queue_.pop();
-            return item;
+    /**
+     * @brief Moves the next element into `out`, reusing its storage. Same as await_resume()
+     * but without constructing a new optional per element. Throws queued exceptions, which
+     * stay at the front of the queue
+     */
+    void take(std::optional<T>& out) noexcept(false)
+    {
+        std::unique_lock lock(mtx_);
+        assert(!queue_.empty());
+        auto& front = queue_.front();
+        if(front.index() == 1) {
+            auto exception = std::get<1>(front);
+            lock.unlock();
+            std::rethrow_exception(exception);
         }
+        auto& item = std::get<0>(front);
+        if(item.has_value())
+            out = std::move(*item);
+        else
+            out.reset();
+        queue_.pop();
     }
 
-    void await_suspend(std::coroutine_handle<> handle) noexcept
+    // Doesn't suspend if an element arrived since await_ready(), unless it is time to yield
+    bool await_suspend(std::coroutine_handle<> handle) noexcept
     {
-        bool has_data = false;
         {
             std::lock_guard lock(mtx_);
-            has_data = queue_.size() != 0;
-            if (!has_data)
+            if (queue_.empty()) {
+                pending_.track(handle);
                 handle_ = handle;
+                return true;
+            }
         }
-        if (has_data)
-            handle.resume();
+        return detail::autoYieldDue() && detail::yieldThread(handle, true);
+    }
+
+    /**
+     * @brief Names the operation for scheduler::pendingOperations(), see EagerAwaiter::describe()
+     */
+    template <typename Fn>
+    void describe(const char* kind, Fn&& target)
+    {
+        pending_.describe(kind, std::forward<Fn>(target));
+    }
+
+    void describe(const char* kind)
+    {
+        pending_.describe(kind);
     }
 };
 
@@ -649,6 +974,29 @@ struct GeneratorWrapper
             cleanup();
     }
 
+    struct iterator_type;
+
+    // Returned by `++it`. Waits on the queue directly, so advancing never creates a
+    // coroutine frame of its own
+    struct IncrementAwaiter
+    {
+        bool await_ready() const noexcept
+        {
+            return it.parent->awaiter->await_ready();
+        }
+        bool await_suspend(std::coroutine_handle<> handle) noexcept
+        {
+            return it.parent->awaiter->await_suspend(handle);
+        }
+        iterator_type& await_resume()
+        {
+            it.parent->advance(it);
+            return it;
+        }
+
+        iterator_type& it;
+    };
+
     struct iterator_type
     {
         using value_type = T;
@@ -657,6 +1005,9 @@ struct GeneratorWrapper
         using difference_type = std::ptrdiff_t;
 
         iterator_type(const iterator_type& other) = default;
+        iterator_type(iterator_type&& other) = default;
+        iterator_type& operator=(const iterator_type& other) = default;
+        iterator_type& operator=(iterator_type&& other) = default;
         iterator_type(std::optional<T> val, GeneratorWrapper<T>* parent, size_t idx)
             : value(std::move(val)), parent(parent), idx(idx)
         {
@@ -666,10 +1017,12 @@ struct GeneratorWrapper
         {
             return *value;
         }
-        Task<iterator_type> operator++ ()
+        /**
+         * @brief Awaits the next element, moving it into this iterator. Doesn't allocate
+         */
+        IncrementAwaiter operator++ ()
         {
-            *this = co_await parent->next();
-            co_return *this;
+            return IncrementAwaiter{*this};
         }
         bool operator==(const iterator_type& other) const
         {
@@ -701,18 +1054,38 @@ struct GeneratorWrapper
         size_t idx = 0;
     };
 
-    Task<iterator_type> begin()
+    // Returned by begin() and next(). Like IncrementAwaiter but hands out a new iterator
+    struct NextAwaiter
+    {
+        bool await_ready() const noexcept
+        {
+            return parent->awaiter->await_ready();
+        }
+        bool await_suspend(std::coroutine_handle<> handle) noexcept
+        {
+            return parent->awaiter->await_suspend(handle);
+        }
+        iterator_type await_resume()
+        {
+            iterator_type it{std::nullopt, parent, 0};
+            parent->advance(it);
+            return it;
+        }
+
+        GeneratorWrapper<T>* parent;
+    };
+
+    NextAwaiter begin()
     {
         return next();
     }
 
-    Task<iterator_type> next()
+    /**
+     * @brief Awaits the next element. Prefer `co_await ++it`, which reuses the iterator
+     */
+    NextAwaiter next()
     {
-        auto& ref = *awaiter;
-        auto value = co_await ref;
-        if(!value.has_value())
-            co_return end();
-        co_return iterator_type{std::move(value), this, idx++};
+        return NextAwaiter{this};
     }
 
     iterator_type end()
@@ -720,14 +1093,555 @@ struct GeneratorWrapper
         return iterator_type{std::nullopt, this, std::numeric_limits<size_t>::max()};
     }
 
+    // Moves the element at the front of the queue into `it`
+    void advance(iterator_type& it)
+    {
+        awaiter->take(it.value);
+        it.idx = it.value.has_value() ? idx++ : std::numeric_limits<size_t>::max();
+    }
+
     size_t idx = 0;
     std::unique_ptr<QueuedAwaiter<T>> awaiter;
     std::function<void()> cleanup;
 };
 
-namespace internal
+namespace detail
 {
-template <typename T>
+// A coroutine waiting on an async primitive. Lives in the frame of the suspended
+// coroutine, so waiting doesn't allocate
+struct WaitNode
+{
+    enum State
+    {
+        Idle,
+        Queued,
+        Woken,
+        Cancelled
+    };
+
+    WaitNode* prev = nullptr;
+    WaitNode* next = nullptr;
+    std::coroutine_handle<> handle;
+    State state = Idle;
+};
+
+// Intrusive FIFO of waiters. Guarded by the mutex of the primitive owning it
+struct WaitList
+{
+    bool empty() const noexcept
+    {
+        return head == nullptr;
+    }
+
+    void push(WaitNode* node) noexcept
+    {
+        node->prev = tail;
+        node->next = nullptr;
+        if(tail != nullptr)
+            tail->next = node;
+        else
+            head = node;
+        tail = node;
+    }
+
+    WaitNode* pop() noexcept
+    {
+        auto node = head;
+        if(node != nullptr)
+            remove(node);
+        return node;
+    }
+
+    void remove(WaitNode* node) noexcept
+    {
+        if(node->prev != nullptr)
+            node->prev->next = node->next;
+        else
+            head = node->next;
+        if(node->next != nullptr)
+            node->next->prev = node->prev;
+        else
+            tail = node->prev;
+        node->prev = node->next = nullptr;
+    }
+
+    // Resumes everything in the list. Call without holding the lock
+    void resumeAll()
+    {
+        while(auto node = pop())
+            node->handle.resume();
+    }
+
+    WaitNode* head = nullptr;
+    WaitNode* tail = nullptr;
+};
+
+// Base of the awaiters of the async primitives. Suspends in `list` unless `tryNow` succeeds
+// under the primitive's lock. When the awaiting task is stopped the waiter leaves the list
+// and resumes with OperationCancelled.
+struct StoppableWait : public WaitNode
+{
+    StoppableWait(std::mutex& mutex, WaitList& list) : mutex_(mutex), list_(list)
+    {
+    }
+    StoppableWait(const StoppableWait&) = delete;
+    StoppableWait& operator=(const StoppableWait&) = delete;
+
+    bool await_ready() noexcept
+    {
+        return false;
+    }
+
+    template <typename Promise, typename TryNow>
+    bool suspend(std::coroutine_handle<Promise> awaiting, TryNow&& tryNow)
+    {
+        handle = awaiting;
+        // Registered before the waiter is published. Once it is in the list another thread
+        // may resume it and the awaiter is gone
+        if constexpr (requires { awaiting.promise().stop_token_; }) {
+            auto& token = awaiting.promise().stop_token_;
+            if(token.stop_possible())
+                on_stop_.emplace(token, [this] { cancel(); });
+        }
+        std::lock_guard lock{mutex_};
+        if(state == Cancelled || tryNow())
+            return false;
+        state = Queued;
+        list_.push(this);
+        return true;
+    }
+
+    void throwIfCancelled() const
+    {
+        if(state == Cancelled)
+            throw OperationCancelled();
+    }
+
+    void cancel()
+    {
+        {
+            std::lock_guard lock{mutex_};
+            if(state == Idle)
+                state = Cancelled;
+            if(state != Queued)
+                return;
+            list_.remove(this);
+            state = Cancelled;
+        }
+        handle.resume();
+    }
+
+    std::mutex& mutex_;
+    WaitList& list_;
+    std::optional<StopCallback> on_stop_;
+};
+}
+
+/**
+ * @brief Counting semaphore for coroutines. acquire() suspends instead of blocking the thread
+ * while no unit is available. Waiters are served in FIFO order.
+ *
+ * Usable from any thread. A waiter is resumed on the thread calling release(), hop with
+ * `co_await scheduler::runOnMainThread()` afterwards if that matters. Waiting tasks that are
+ * stopped throw OperationCancelled.
+ *
+ * @code
+ * async_semaphore in_flight(32);
+ * co_await in_flight.acquire();
+ * co_await dht->put(key, value);
+ * in_flight.release();
+ * @endcode
+ */
+struct async_semaphore
+{
+    explicit async_semaphore(size_t count) : count_(count)
+    {
+    }
+    async_semaphore(const async_semaphore&) = delete;
+    async_semaphore& operator=(const async_semaphore&) = delete;
+
+    struct AcquireAwaiter : public detail::StoppableWait
+    {
+        explicit AcquireAwaiter(async_semaphore& sem) : StoppableWait(sem.mutex_, sem.waiters_), sem_(sem)
+        {
+        }
+        template <typename Promise>
+        bool await_suspend(std::coroutine_handle<Promise> handle)
+        {
+            return suspend(handle, [this] { return sem_.tryAcquireLocked(); });
+        }
+        void await_resume()
+        {
+            throwIfCancelled();
+        }
+
+        async_semaphore& sem_;
+    };
+
+    /**
+     * @brief Takes one unit, suspends until one is released if none is available
+     */
+    [[nodiscard]]
+    AcquireAwaiter acquire()
+    {
+        return AcquireAwaiter{*this};
+    }
+
+    bool try_acquire()
+    {
+        std::lock_guard lock{mutex_};
+        return tryAcquireLocked();
+    }
+
+    /**
+     * @brief Returns `n` units. Each one goes straight to the longest waiting coroutine
+     */
+    void release(size_t n = 1)
+    {
+        detail::WaitList woken;
+        {
+            std::lock_guard lock{mutex_};
+            for(; n != 0 && !waiters_.empty(); n--) {
+                auto node = waiters_.pop();
+                node->state = detail::WaitNode::Woken;
+                woken.push(node);
+            }
+            count_ += n;
+        }
+        woken.resumeAll();
+    }
+
+    size_t available() const
+    {
+        std::lock_guard lock{mutex_};
+        return count_;
+    }
+
+protected:
+    bool tryAcquireLocked()
+    {
+        if(count_ == 0)
+            return false;
+        count_--;
+        return true;
+    }
+
+    mutable std::mutex mutex_;
+    detail::WaitList waiters_;
+    size_t count_;
+};
+
+struct async_mutex;
+
+/**
+ * @brief Unlocks an async_mutex when destroyed
+ */
+struct async_lock_guard
+{
+    explicit async_lock_guard(async_mutex& mutex) noexcept : mutex_(&mutex)
+    {
+    }
+    async_lock_guard(async_lock_guard&& other) noexcept : mutex_(std::exchange(other.mutex_, nullptr))
+    {
+    }
+    async_lock_guard& operator=(async_lock_guard&&) = delete;
+    ~async_lock_guard();
+
+protected:
+    async_mutex* mutex_;
+};
+
+/**
+ * @brief Mutex for coroutines. Holding it across co_await is fine, waiting for it suspends
+ * instead of blocking the thread. Same threading rules as async_semaphore
+ *
+ * @code
+ * auto guard = co_await mutex.scoped_lock();
+ * @endcode
+ */
+struct async_mutex
+{
+    struct ScopedLockAwaiter : public async_semaphore::AcquireAwaiter
+    {
+        explicit ScopedLockAwaiter(async_mutex& mutex) : AcquireAwaiter(mutex.sem_), mutex_(mutex)
+        {
+        }
+        async_lock_guard await_resume()
+        {
+            AcquireAwaiter::await_resume();
+            return async_lock_guard{mutex_};
+        }
+
+        async_mutex& mutex_;
+    };
+
+    [[nodiscard]]
+    async_semaphore::AcquireAwaiter lock()
+    {
+        return sem_.acquire();
+    }
+
+    /**
+     * @brief Locks the mutex and returns a guard unlocking it
+     */
+    [[nodiscard]]
+    ScopedLockAwaiter scoped_lock()
+    {
+        return ScopedLockAwaiter{*this};
+    }
+
+    bool try_lock()
+    {
+        return sem_.try_acquire();
+    }
+
+    /**
+     * @brief Unlocks the mutex. Hands it to the longest waiting coroutine if there is one
+     */
+    void unlock()
+    {
+        sem_.release();
+    }
+
+protected:
+    async_semaphore sem_{1};
+};
+
+inline async_lock_guard::~async_lock_guard()
+{
+    if(mutex_ != nullptr)
+        mutex_->unlock();
+}
+
+/**
+ * @brief Thrown when sending on a closed channel
+ */
+struct ChannelClosed : public std::runtime_error
+{
+    ChannelClosed() : std::runtime_error("Channel closed")
+    {
+    }
+};
+
+/**
+ * @brief Bounded multi producer, multi consumer channel for coroutines.
+ *
+ * send() suspends while `capacity` values are buffered, so fast producers are slowed down
+ * to the pace of the consumers. A capacity of 0 hands every value directly from sender
+ * to receiver. receive() suspends until a value is available and returns std::nullopt once
+ * the channel is closed and drained. Same threading rules as async_semaphore.
+ *
+ * @code
+ * channel<std::string> messages(64);
+ * // producer
+ * co_await messages.send(std::string(data));
+ * // consumer
+ * while(auto message = co_await messages.receive())
+ *     process(*message);
+ * @endcode
+ */
+template <typename T>
+struct channel
+{
+    explicit channel(size_t capacity) : capacity_(capacity)
+    {
+    }
+    channel(const channel&) = delete;
+    channel& operator=(const channel&) = delete;
+
+    struct SendAwaiter : public detail::StoppableWait
+    {
+        SendAwaiter(channel& chan, T&& value)
+            : StoppableWait(chan.mutex_, chan.senders_), chan_(chan), value_(std::move(value))
+        {
+        }
+        template <typename Promise>
+        bool await_suspend(std::coroutine_handle<Promise> handle)
+        {
+            detail::WaitNode* receiver = nullptr;
+            bool suspended = suspend(handle, [&] {
+                closed_ = chan_.closed_;
+                return closed_ || chan_.trySendLocked(value_, receiver);
+            });
+            if(receiver != nullptr)
+                receiver->handle.resume();
+            return suspended;
+        }
+        void await_resume()
+        {
+            throwIfCancelled();
+            if(closed_)
+                throw ChannelClosed();
+        }
+
+        channel& chan_;
+        std::optional<T> value_;
+        bool closed_ = false;
+    };
+
+    struct ReceiveAwaiter : public detail::StoppableWait
+    {
+        explicit ReceiveAwaiter(channel& chan) : StoppableWait(chan.mutex_, chan.receivers_), chan_(chan)
+        {
+        }
+        template <typename Promise>
+        bool await_suspend(std::coroutine_handle<Promise> handle)
+        {
+            detail::WaitNode* sender = nullptr;
+            bool suspended = suspend(handle, [&] {
+                return chan_.tryReceiveLocked(value_, sender) || chan_.closed_;
+            });
+            if(sender != nullptr)
+                sender->handle.resume();
+            return suspended;
+        }
+        std::optional<T> await_resume()
+        {
+            throwIfCancelled();
+            return std::move(value_);
+        }
+
+        channel& chan_;
+        std::optional<T> value_;
+    };
+
+    /**
+     * @brief Sends `value`, suspends while the channel is full. Throws ChannelClosed if the
+     * channel is closed before the value could be delivered
+     */
+    [[nodiscard]]
+    SendAwaiter send(T value)
+    {
+        return SendAwaiter{*this, std::move(value)};
+    }
+
+    /**
+     * @brief Receives the next value, std::nullopt once the channel is closed and drained
+     */
+    [[nodiscard]]
+    ReceiveAwaiter receive()
+    {
+        return ReceiveAwaiter{*this};
+    }
+
+    /**
+     * @brief Sends without waiting. Fails if the channel is full or closed, `value` is left
+     * untouched then
+     */
+    bool try_send(T& value)
+    {
+        detail::WaitNode* receiver = nullptr;
+        std::optional<T> slot{std::move(value)};
+        bool sent;
+        {
+            std::lock_guard lock{mutex_};
+            sent = !closed_ && trySendLocked(slot, receiver);
+        }
+        if(!sent)
+            value = std::move(*slot);
+        if(receiver != nullptr)
+            receiver->handle.resume();
+        return sent;
+    }
+
+    std::optional<T> try_receive()
+    {
+        detail::WaitNode* sender = nullptr;
+        std::optional<T> value;
+        {
+            std::lock_guard lock{mutex_};
+            tryReceiveLocked(value, sender);
+        }
+        if(sender != nullptr)
+            sender->handle.resume();
+        return value;
+    }
+
+    /**
+     * @brief Closes the channel. Waiting senders throw ChannelClosed, receivers drain what is
+     * buffered and then get std::nullopt
+     */
+    void close()
+    {
+        detail::WaitList senders, receivers;
+        {
+            std::lock_guard lock{mutex_};
+            closed_ = true;
+            for(auto list : {&senders_, &receivers_}) {
+                auto& woken = list == &senders_ ? senders : receivers;
+                while(auto node = list->pop()) {
+                    node->state = detail::WaitNode::Woken;
+                    woken.push(node);
+                }
+            }
+            for(auto node = senders.head; node != nullptr; node = node->next)
+                static_cast<SendAwaiter*>(node)->closed_ = true;
+        }
+        senders.resumeAll();
+        receivers.resumeAll();
+    }
+
+    bool closed() const
+    {
+        std::lock_guard lock{mutex_};
+        return closed_;
+    }
+
+    size_t size() const
+    {
+        std::lock_guard lock{mutex_};
+        return buffer_.size();
+    }
+
+protected:
+    // Hands `value` to a waiting receiver or buffers it. The receiver has to be resumed
+    // once the lock is released
+    bool trySendLocked(std::optional<T>& value, detail::WaitNode*& receiver)
+    {
+        if(!receivers_.empty()) {
+            receiver = receivers_.pop();
+            receiver->state = detail::WaitNode::Woken;
+            static_cast<ReceiveAwaiter*>(receiver)->value_ = std::move(value);
+            return true;
+        }
+        if(buffer_.size() < capacity_) {
+            buffer_.push_back(std::move(*value));
+            return true;
+        }
+        return false;
+    }
+
+    // Takes the oldest value. A sender waiting for room gets its value into the buffer and
+    // has to be resumed once the lock is released
+    bool tryReceiveLocked(std::optional<T>& value, detail::WaitNode*& sender)
+    {
+        if(!buffer_.empty()) {
+            value = std::move(buffer_.front());
+            buffer_.pop_front();
+        }
+        if(!senders_.empty()) {
+            sender = senders_.pop();
+            sender->state = detail::WaitNode::Woken;
+            auto& sent = static_cast<SendAwaiter*>(sender)->value_;
+            if(value.has_value())
+                buffer_.push_back(std::move(*sent));
+            else
+                value = std::move(sent);
+        }
+        return value.has_value();
+    }
+
+    mutable std::mutex mutex_;
+    detail::WaitList senders_;
+    detail::WaitList receivers_;
+    std::deque<T> buffer_;
+    size_t capacity_;
+    bool closed_ = false;
+};
+
+namespace internal
+{
+template <typename T>
 auto getAwaiterImpl(T &&value) noexcept(
     noexcept(static_cast<T &&>(value).operator co_await()))
     -> decltype(static_cast<T &&>(value).operator co_await())
@@ -812,4 +1726,515 @@ std::function<void()> async_func(Coro &&coro)
     };
 }
 
-}
\ No newline at end of file
+namespace detail
+{
+// Counts down the tasks of a combinator. Starts at one more than the number of tasks,
+// the extra count belongs to the awaiting coroutine. Whoever brings it to zero
+// continues the awaiting coroutine, so tasks that finish before it even suspended
+// don't resume it early.
+struct CountdownLatch
+{
+    explicit CountdownLatch(size_t count) : count_(count + 1)
+    {
+    }
+
+    // Returns true if the awaiting coroutine has to suspend
+    bool wait(std::coroutine_handle<> waiter)
+    {
+        waiter_ = waiter;
+        return count_.fetch_sub(1, std::memory_order_acq_rel) > 1;
+    }
+
+    void arrive()
+    {
+        if (count_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            waiter_.resume();
+    }
+
+    std::atomic<size_t> count_;
+    std::coroutine_handle<> waiter_;
+};
+
+// State shared by the tasks of when_all. The first failure stops the tasks that are
+// still running, they have no use anymore
+struct FanOut
+{
+    explicit FanOut(size_t count) : latch(count)
+    {
+    }
+
+    // Tasks with a stop token of their own keep it and aren't stopped by their siblings
+    template <typename T>
+    void adopt(Task<T> &task)
+    {
+        if (task.coro_ && !task.coro_.promise().stop_token_.stop_possible())
+            task.setStopToken(stop.get_token());
+    }
+
+    void fail(std::exception_ptr e)
+    {
+        if (error != nullptr)
+            return;
+        error = std::move(e);
+        stop.request_stop();
+    }
+
+    CountdownLatch latch;
+    std::exception_ptr error;
+    std::stop_source stop;
+};
+
+template <typename T>
+using NonVoid = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+// Awaits `task`, hands the result (or monostate) to `store` then counts down the latch
+template <typename T, typename Store>
+AsyncTask awaitAndArrive(Task<T> &task, Store store, FanOut &fan_out)
+{
+    try {
+        if constexpr (std::is_void_v<T>) {
+            co_await task;
+            store(std::monostate{});
+        }
+        else
+            store(co_await task);
+    }
+    catch (...) {
+        fan_out.fail(std::current_exception());
+    }
+    fan_out.latch.arrive();
+}
+
+// Starts everything `launch` starts and suspends until the latch is released
+template <typename Launch>
+struct LatchAwaiter
+{
+    CountdownLatch &latch;
+    Launch launch;
+
+    bool await_ready() noexcept
+    {
+        return false;
+    }
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        latch.waiter_ = handle;
+        launch();
+        return latch.wait(handle);
+    }
+    void await_resume() noexcept
+    {
+    }
+};
+}
+
+/**
+ * @brief Awaits all tasks concurrently. If any of them throws, the others are stopped
+ * and the first exception is rethrown once all of them finished
+ *
+ * @return the results in the order of `tasks`. Nothing for Task<void>
+ */
+template <typename T>
+auto when_all(std::vector<Task<T>> tasks)
+    -> Task<std::conditional_t<std::is_void_v<T>, void, std::vector<detail::NonVoid<T>>>>
+{
+    std::vector<std::optional<detail::NonVoid<T>>> results(tasks.size());
+    detail::FanOut fan_out(tasks.size());
+    StopCallback forward_stop(co_await currentStopToken(), [&fan_out] {
+        fan_out.stop.request_stop();
+    });
+    co_await detail::LatchAwaiter{fan_out.latch, [&] {
+        for (size_t i = 0; i < tasks.size(); i++) {
+            fan_out.adopt(tasks[i]);
+            detail::awaitAndArrive(tasks[i], [&results, i](auto &&value) {
+                results[i].emplace(std::forward<decltype(value)>(value));
+            }, fan_out);
+        }
+    }};
+    if (fan_out.error != nullptr)
+        std::rethrow_exception(fan_out.error);
+    if constexpr (!std::is_void_v<T>) {
+        std::vector<T> values;
+        values.reserve(results.size());
+        for (auto &result : results)
+            values.push_back(std::move(*result));
+        co_return values;
+    }
+}
+
+/**
+ * @brief Awaits tasks of different types concurrently. Task<void> results are std::monostate
+ */
+template <typename... Ts>
+Task<std::tuple<detail::NonVoid<Ts>...>> when_all(Task<Ts>... tasks)
+{
+    std::tuple<std::optional<detail::NonVoid<Ts>>...> results;
+    detail::FanOut fan_out(sizeof...(Ts));
+    StopCallback forward_stop(co_await currentStopToken(), [&fan_out] {
+        fan_out.stop.request_stop();
+    });
+    co_await detail::LatchAwaiter{fan_out.latch, [&] {
+        (fan_out.adopt(tasks), ...);
+        [&]<size_t... Is>(std::index_sequence<Is...>) {
+            (detail::awaitAndArrive(tasks, [&results](auto &&value) {
+                std::get<Is>(results).emplace(std::forward<decltype(value)>(value));
+            }, fan_out), ...);
+        }(std::index_sequence_for<Ts...>{});
+    }};
+    if (fan_out.error != nullptr)
+        std::rethrow_exception(fan_out.error);
+    co_return std::apply([](auto &...result) {
+        return std::tuple<detail::NonVoid<Ts>...>{std::move(*result)...};
+    }, results);
+}
+
+/**
+ * @brief Awaits the first of `tasks` to finish and rethrows its exception if it failed.
+ *
+ * The other tasks are stopped once there is a winner. Tasks that don't observe their
+ * stop token keep running in the background until they finish on their own, their
+ * results are discarded.
+ *
+ * @return index of the first task to finish and its result (std::monostate for Task<void>)
+ */
+template <typename T>
+Task<std::pair<size_t, detail::NonVoid<T>>> when_any(std::vector<Task<T>> tasks)
+{
+    if (tasks.empty())
+        throw std::invalid_argument("when_any() needs at least one task");
+
+    // Outlives this coroutine for as long as the losers are still running
+    struct State
+    {
+        std::vector<Task<T>> tasks;
+        std::optional<std::pair<size_t, detail::NonVoid<T>>> winner;
+        std::exception_ptr error;
+        std::atomic<bool> decided{false};
+        std::stop_source stop;
+        // The first task to finish and the awaiting coroutine count it down
+        detail::CountdownLatch latch{1};
+    };
+    auto state = std::make_shared<State>();
+    state->tasks = std::move(tasks);
+    for (auto &task : state->tasks) {
+        if (task.coro_ && !task.coro_.promise().stop_token_.stop_possible())
+            task.setStopToken(state->stop.get_token());
+    }
+    StopCallback forward_stop(co_await currentStopToken(), [&state] {
+        state->stop.request_stop();
+    });
+
+    // NOTE: Capturing `state` by value here trips GCC into destroying the lambda twice
+    co_await detail::LatchAwaiter{state->latch, [&state] {
+        for (size_t i = 0; i < state->tasks.size(); i++) {
+            [](std::shared_ptr<State> state, size_t i) -> AsyncTask {
+                std::optional<detail::NonVoid<T>> value;
+                std::exception_ptr error;
+                try {
+                    if constexpr (std::is_void_v<T>) {
+                        co_await state->tasks[i];
+                        value.emplace();
+                    }
+                    else
+                        value.emplace(co_await state->tasks[i]);
+                }
+                catch (...) {
+                    error = std::current_exception();
+                }
+                if (state->decided.exchange(true))
+                    co_return;
+                if (error != nullptr)
+                    state->error = error;
+                else
+                    state->winner.emplace(i, std::move(*value));
+                state->stop.request_stop();
+                state->latch.arrive();
+            }(state, i);
+        }
+    }};
+    if (state->error != nullptr)
+        std::rethrow_exception(state->error);
+    co_return std::move(*state->winner);
+}
+
+/**
+ * @brief Calls `fn` on every element of `range` with at most `limit` of the returned
+ * tasks in flight at once. After the first exception no new ones are started and the
+ * running ones are stopped, the exception is rethrown once they finished.
+ *
+ * `range` must outlive the returned task.
+ *
+ * @return the results in the order of `range`. Nothing if `fn` returns Task<void>
+ */
+template <typename Range, typename Fn>
+auto for_each_concurrent(Range &&range, size_t limit, Fn fn)
+    -> Task<std::conditional_t<
+        std::is_void_v<await_result_t<std::invoke_result_t<Fn &, decltype(*std::begin(range))>>>, void,
+        std::vector<std::decay_t<await_result_t<std::invoke_result_t<Fn &, decltype(*std::begin(range))>>>>>>
+{
+    using R = std::decay_t<await_result_t<std::invoke_result_t<Fn &, decltype(*std::begin(range))>>>;
+    std::vector<decltype(std::begin(range))> items;
+    for (auto it = std::begin(range); it != std::end(range); ++it)
+        items.push_back(it);
+
+    std::vector<std::optional<detail::NonVoid<R>>> results(items.size());
+    size_t next = 0;
+    bool failed = false;
+    // Each worker keeps one call in flight, pulling the next element when it's done.
+    // The calls inherit the worker's stop token, which when_all stops on failure
+    auto worker = [&]() -> Task<> {
+        while (!failed && next < items.size()) {
+            size_t i = next++;
+            try {
+                if constexpr (std::is_void_v<R>)
+                    co_await fn(*items[i]);
+                else
+                    results[i].emplace(co_await fn(*items[i]));
+            }
+            catch (...) {
+                failed = true;
+                throw;
+            }
+        }
+    };
+
+    std::vector<Task<>> workers;
+    size_t num_workers = std::min(std::max<size_t>(limit, 1), items.size());
+    for (size_t i = 0; i < num_workers; i++)
+        workers.push_back(worker());
+    co_await when_all(std::move(workers));
+
+    if constexpr (!std::is_void_v<R>) {
+        std::vector<R> values;
+        values.reserve(results.size());
+        for (auto &result : results)
+            values.push_back(std::move(*result));
+        co_return values;
+    }
+}
+
+namespace detail
+{
+// Shared by a TaskGroup and its children, so children that outlive an abandoned group
+// still have somewhere to report to
+struct TaskGroupState
+{
+    // Keeps the first real failure. Cancellations caused by stopping the group aren't one
+    void fail(std::exception_ptr e)
+    {
+        bool cancelled_by_group = false;
+        try {
+            std::rethrow_exception(e);
+        }
+        catch (const OperationCancelled &) {
+            cancelled_by_group = stop.stop_requested();
+        }
+        catch (...) {
+        }
+        if (cancelled_by_group)
+            return;
+        {
+            std::lock_guard lock{mutex};
+            if (error != nullptr)
+                return;
+            error = std::move(e);
+        }
+        stop.request_stop();
+    }
+
+    void finish()
+    {
+        std::coroutine_handle<> handle;
+        {
+            std::lock_guard lock{mutex};
+            if (--running == 0)
+                handle = std::exchange(joiner, nullptr);
+        }
+        if (handle)
+            handle.resume();
+    }
+
+    std::mutex mutex;
+    size_t running = 0;
+    std::coroutine_handle<> joiner;
+    std::exception_ptr error;
+    std::stop_source stop;
+};
+
+template <typename T>
+AsyncTask runInGroup(Task<T> task, std::shared_ptr<TaskGroupState> state)
+{
+    try {
+        co_await task;
+    }
+    catch (...) {
+        state->fail(std::current_exception());
+    }
+    state->finish();
+}
+}
+
+/**
+ * @brief Owns a set of concurrently running child tasks.
+ *
+ * Children start right away when spawned and run under the group's stop token unless
+ * they have one of their own. The first exception of a child stops the others, join()
+ * rethrows it once all of them finished. Stopping a child aborts the GNUnet operations it
+ * is waiting on (DHT gets, timers...), so nothing it started outlives the group.
+ *
+ * Always co_await join() before the group goes out of scope. A group destroyed while
+ * children are still running stops them and drops their exceptions. with_task_group()
+ * takes care of that even if the scope is left by an exception.
+ *
+ * @code
+ * TaskGroup group;
+ * for(auto& key : keys)
+ *     group.spawn(dht->put(key, value));
+ * co_await group.join();
+ * @endcode
+ */
+struct TaskGroup
+{
+    /**
+     * @param parent stops the group when stopped. ie. the token of the coroutine owning the group
+     */
+    explicit TaskGroup(std::stop_token parent = {}) : state_(std::make_shared<detail::TaskGroupState>())
+    {
+        if (parent.stop_possible())
+            forward_stop_.emplace(std::move(parent), [state = state_] { state->stop.request_stop(); });
+    }
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+    ~TaskGroup()
+    {
+        forward_stop_.reset();
+        if (running() != 0)
+            cancel();
+    }
+
+    /**
+     * @brief Starts `task` as a child of the group
+     */
+    template <typename T>
+    void spawn(Task<T> task)
+    {
+        if (task.coro_ && !task.coro_.promise().stop_token_.stop_possible())
+            task.setStopToken(state_->stop.get_token());
+        {
+            std::lock_guard lock{state_->mutex};
+            state_->running++;
+        }
+        detail::runInGroup(std::move(task), state_);
+    }
+
+    struct JoinAwaiter
+    {
+        bool await_ready() noexcept
+        {
+            std::lock_guard lock{state_->mutex};
+            return state_->running == 0;
+        }
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            std::lock_guard lock{state_->mutex};
+            if (state_->running == 0)
+                return false;
+            state_->joiner = handle;
+            return true;
+        }
+        void await_resume()
+        {
+            std::lock_guard lock{state_->mutex};
+            if (state_->error != nullptr)
+                std::rethrow_exception(std::exchange(state_->error, nullptr));
+        }
+
+        std::shared_ptr<detail::TaskGroupState> state_;
+    };
+
+    /**
+     * @brief Waits until all children finished. Rethrows the first exception of a child
+     */
+    [[nodiscard]]
+    JoinAwaiter join()
+    {
+        return JoinAwaiter{state_};
+    }
+
+    /**
+     * @brief Stops all children. Their OperationCancelled isn't reported by join()
+     */
+    void cancel()
+    {
+        state_->stop.request_stop();
+    }
+
+    /**
+     * @brief Stop token of the group, for children that aren't Tasks
+     */
+    std::stop_token token() const
+    {
+        return state_->stop.get_token();
+    }
+
+    /**
+     * @brief Number of children still running
+     */
+    size_t running() const
+    {
+        std::lock_guard lock{state_->mutex};
+        return state_->running;
+    }
+
+protected:
+    std::shared_ptr<detail::TaskGroupState> state_;
+    std::optional<StopCallback> forward_stop_;
+};
+
+/**
+ * @brief Runs `fn` with a TaskGroup and waits for all children it spawned, even when `fn`
+ * throws. Children are stopped if `fn` throws or the awaiting task is stopped.
+ *
+ * @code
+ * co_await with_task_group([&](TaskGroup& group) -> Task<> {
+ *     group.spawn(lookup(a));
+ *     group.spawn(lookup(b));
+ *     co_return;
+ * });
+ * @endcode
+ *
+ * @return what `fn` returns
+ */
+template <typename Fn>
+auto with_task_group(Fn fn) -> Task<await_result_t<std::invoke_result_t<Fn &, TaskGroup &>>>
+{
+    using R = await_result_t<std::invoke_result_t<Fn &, TaskGroup &>>;
+    TaskGroup group(co_await currentStopToken());
+    std::exception_ptr error;
+    try {
+        if constexpr (std::is_void_v<R>) {
+            co_await fn(group);
+            co_await group.join();
+            co_return;
+        }
+        else {
+            auto result = co_await fn(group);
+            co_await group.join();
+            co_return result;
+        }
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+    // Can't co_await inside the catch block
+    group.cancel();
+    try {
+        co_await group.join();
+    }
+    catch (...) {
+    }
+    std::rethrow_exception(error);
+}
+
+}
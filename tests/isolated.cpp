@@ -0,0 +1,247 @@
+#include <drogon/drogon_test.h>
+
+#include <gnunetpp-scheduler.hpp>
+#include "inner/Infra.hpp"
+
+#include <algorithm>
+#include <future>
+#include <set>
+#include <thread>
+
+using namespace drogon;
+using namespace std::chrono_literals;
+
+// Tests that change process wide scheduler state, like the clock or how coroutines are
+// resumed. Each runs to completion on the GNUnet thread before the next one starts, so
+// they can't disturb each other or the timing of the tests in gnunetpp-selftest
+template <typename Fn>
+static void runIsolated(Fn fn)
+{
+    std::promise<void> done;
+    gnunetpp::scheduler::queue([&] {
+        gnunetpp::async_run([&]() -> gnunetpp::Task<> {
+            std::exception_ptr error;
+            try {
+                co_await fn();
+            }
+            catch(...) {
+                error = std::current_exception();
+            }
+            gnunetpp::scheduler::enableVirtualTime(false);
+            gnunetpp::scheduler::setDeferredResume(false);
+            if(error)
+                done.set_exception(error);
+            else
+                done.set_value();
+        });
+    });
+    done.get_future().get();
+}
+
+#define ENTER_ISOLATED runIsolated([=]() -> gnunetpp::Task<> {
+#define EXIT_ISOLATED });
+
+// Runs a 10ms repeating task `runs` times and returns when each run happened, relative to
+// when it was created. The first run keeps the GNUnet thread busy for 35ms, so the task
+// falls behind by three intervals. Needs virtual time
+static gnunetpp::Task<std::vector<std::chrono::microseconds>> overrunTimes(gnunetpp::scheduler::RepeatOptions options, size_t runs)
+{
+    using namespace gnunetpp;
+    auto times = std::make_shared<std::vector<std::chrono::microseconds>>();
+    auto start = scheduler::now();
+    auto id = std::make_shared<TaskID>();
+    *id = scheduler::runEvery(10ms, [times, start, id, runs] {
+        times->push_back(std::chrono::duration_cast<std::chrono::microseconds>(scheduler::now() - start));
+        if(times->size() == 1)
+            scheduler::advanceVirtualTime(35ms);
+        if(times->size() == runs)
+            scheduler::cancel(*id);
+    }, options);
+    co_await scheduler::sleep(1s);
+    co_return *times;
+}
+
+// Timers run on the first tick at or after they are due
+static bool ranAt(std::chrono::microseconds time, std::chrono::microseconds due)
+{
+    return time >= due && time < due + 1ms;
+}
+
+DROGON_TEST(VirtualTime)
+{
+ENTER_ISOLATED
+    gnunetpp::scheduler::enableVirtualTime(true);
+    auto real_start = std::chrono::steady_clock::now();
+    auto start = gnunetpp::scheduler::now();
+    auto fired = std::make_shared<std::vector<int>>();
+    for(int i = 0; i < 1000; i++)
+        gnunetpp::scheduler::runLater(std::chrono::seconds(i % 10), [fired, i] { fired->push_back(i); });
+    co_await gnunetpp::scheduler::sleep(1h);
+    CHECK(fired->size() == 1000);
+    CHECK(gnunetpp::scheduler::now() - start >= 1h);
+    CHECK(std::chrono::steady_clock::now() - real_start < 10s);
+    // Timers fire in deadline order, those with the same deadline in the order they were armed
+    std::vector<int> expected;
+    for(int deadline = 0; deadline < 10; deadline++) {
+        for(int i = deadline; i < 1000; i += 10)
+            expected.push_back(i);
+    }
+    CHECK(*fired == expected);
+
+    // A seed shuffles timers due on the same tick, but never across ticks
+    gnunetpp::scheduler::enableVirtualTime(true, 42);
+    fired->clear();
+    for(int i = 0; i < 1000; i++)
+        gnunetpp::scheduler::runLater(std::chrono::seconds(i % 10), [fired, i] { fired->push_back(i); });
+    co_await gnunetpp::scheduler::sleep(1h);
+    CHECK(fired->size() == 1000);
+    CHECK(*fired != expected);
+    CHECK(std::is_sorted(fired->begin(), fired->end(), [](int a, int b) { return a % 10 < b % 10; }));
+
+    bool timed_out = false;
+    try {
+        co_await gnunetpp::scheduler::withTimeout(gnunetpp::scheduler::sleep(24h), 30s);
+    }
+    catch(const gnunetpp::scheduler::TimeoutError&) {
+        timed_out = true;
+    }
+    CHECK(timed_out);
+
+    gnunetpp::scheduler::enableVirtualTime(false);
+    // Back on the real clock, which doesn't jump back
+    auto now = gnunetpp::scheduler::now();
+    CHECK(now - start >= 1h);
+    co_await gnunetpp::scheduler::sleep(1ms);
+    CHECK(gnunetpp::scheduler::now() > now);
+EXIT_ISOLATED
+}
+
+DROGON_TEST(DeferredResume)
+{
+ENTER_ISOLATED
+    struct Operation : public gnunetpp::EagerAwaiter<int>
+    {
+        void complete(int value)
+        {
+            setValue(value);
+        }
+    };
+    gnunetpp::scheduler::setDeferredResume(true);
+    std::vector<int> order;
+    Operation first, second;
+    auto wait = [&](Operation& operation) -> gnunetpp::Task<> {
+        order.push_back(co_await operation);
+    };
+    gnunetpp::async_run([&] { return wait(first); });
+    gnunetpp::async_run([&] { return wait(second); });
+    // Both resume once the current callback is done, not inside complete()
+    first.complete(1);
+    second.complete(2);
+    order.push_back(0);
+    co_await gnunetpp::scheduler::sleep(1ms);
+    CHECK((order == std::vector<int>{0, 1, 2}));
+EXIT_ISOLATED
+}
+
+DROGON_TEST(RepeatPolicies)
+{
+ENTER_ISOLATED
+    using namespace gnunetpp;
+    scheduler::enableVirtualTime(true);
+
+    // Skip drops the runs due at 20, 30 and 40ms and stays on the original schedule
+    auto times = co_await overrunTimes({.mode = scheduler::RepeatMode::FixedRate, .overrun = scheduler::OverrunPolicy::Skip}, 3);
+    CO_REQUIRE(times.size() == 3);
+    CHECK(ranAt(times[0], 10ms));
+    CHECK(ranAt(times[1], 50ms));
+    CHECK(ranAt(times[2], 60ms));
+
+    // CatchUp runs the missed ones back to back as soon as the thread is free again
+    times = co_await overrunTimes({.mode = scheduler::RepeatMode::FixedRate, .overrun = scheduler::OverrunPolicy::CatchUp}, 6);
+    CO_REQUIRE(times.size() == 6);
+    CHECK(ranAt(times[0], 10ms));
+    for(size_t i = 1; i < 4; i++)
+        CHECK(times[i] == times[0] + 35ms);
+    CHECK(ranAt(times[4], 50ms));
+    CHECK(ranAt(times[5], 60ms));
+
+    // FixedDelay measures from the end of the previous run
+    times = co_await overrunTimes({.mode = scheduler::RepeatMode::FixedDelay}, 3);
+    CO_REQUIRE(times.size() == 3);
+    CHECK(ranAt(times[0], 10ms));
+    CHECK(ranAt(times[1], times[0] + 45ms));
+    CHECK(ranAt(times[2], times[1] + 10ms));
+EXIT_ISOLATED
+}
+
+DROGON_TEST(TimerSlack)
+{
+ENTER_ISOLATED
+    using namespace gnunetpp;
+    scheduler::enableVirtualTime(true);
+    auto start = scheduler::now();
+    auto times = std::make_shared<std::vector<std::pair<std::chrono::microseconds, std::chrono::microseconds>>>();
+    for(int i = 1; i <= 20; i++) {
+        auto delay = std::chrono::milliseconds(i);
+        scheduler::runLater(delay, [times, start, delay] {
+            times->emplace_back(std::chrono::duration_cast<std::chrono::microseconds>(scheduler::now() - start), delay);
+        }, false, 10ms);
+    }
+    co_await scheduler::sleep(1s);
+    CO_REQUIRE(times->size() == 20);
+    std::set<std::chrono::microseconds::rep> wakeups;
+    for(auto [time, due] : *times) {
+        // Late by less than the slack, on an 8ms boundary so neighbouring timers share a wakeup
+        CHECK(time >= due);
+        CHECK(time < due + 10ms);
+        auto at = (start + time).time_since_epoch();
+        CHECK(at % 8ms == 0us);
+        wakeups.insert(at.count());
+    }
+    CHECK(wakeups.size() <= 4);
+EXIT_ISOLATED
+}
+
+DROGON_TEST(OffloadReconfigure)
+{
+ENTER_ISOLATED
+    using namespace gnunetpp;
+    // One worker, so most jobs are still queued when the pool is replaced
+    scheduler::configureOffload({.threads = 1});
+    auto finished = std::make_shared<std::vector<int>>();
+    for(int i = 0; i < 8; i++) {
+        async_run([finished, i]() -> gnunetpp::Task<> {
+            finished->push_back(co_await scheduler::offload([i] {
+                std::this_thread::sleep_for(10ms);
+                return i;
+            }));
+            CHECK(inMainThread());
+        });
+    }
+    // The old pool runs the 80ms worth of queued jobs in the background, not on this thread
+    auto before = std::chrono::steady_clock::now();
+    scheduler::configureOffload({.threads = 2});
+    CHECK(std::chrono::steady_clock::now() - before < 40ms);
+    // Every coroutine waiting on the old pool resumes
+    for(int i = 0; i < 200 && finished->size() < 8; i++)
+        co_await scheduler::sleep(5ms);
+    std::sort(finished->begin(), finished->end());
+    CHECK((*finished == std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7}));
+    CHECK(inMainThread());
+    CHECK(co_await scheduler::offload([] { return 42; }) == 42);
+    CHECK(scheduler::offloadStats().threads == 2);
+    scheduler::configureOffload({});
+EXIT_ISOLATED
+}
+
+int main(int argc, char** argv)
+{
+    int status = 0;
+    gnunetpp::run([&](const GNUNET_CONFIGURATION_Handle*) {
+        std::thread([&, argc, argv] {
+            status = test::run(argc, argv);
+            gnunetpp::scheduler::queue([] { gnunetpp::shutdown(); });
+        }).detach();
+    });
+    return status;
+}
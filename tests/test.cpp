@@ -10,8 +10,19 @@
 #include <gnunetpp-cadet.hpp>
 #include <gnunetpp-datastore.hpp>
 #include "inner/Infra.hpp"
-
+#include "inner/MPSCQueue.hpp"
+#include "inner/SlotMap.hpp"
+#include "inner/TimingWheel.hpp"
+#include "inner/Function.hpp"
+#include "inner/FramePool.hpp"
+#include "inner/RingBuffer.hpp"
+
+#include <array>
 #include <random>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace drogon;
 using namespace std::chrono_literals;
@@ -100,6 +111,19 @@ DROGON_TEST(Sechduler)
         SUCCESS();
     });
 
+    auto count = std::make_shared<int>(0);
+    auto id = std::make_shared<TaskID>();
+    *id = scheduler::runEvery(10ms, [TEST_CTX, count, id]() {
+        if(++*count != 3)
+            return;
+        scheduler::cancel(*id);
+        SUCCESS();
+    });
+    // This isn't the GNUnet thread, the timer is cancelled before it's even added
+    scheduler::cancel(scheduler::runLater(1ms, [TEST_CTX]() {
+        FAIL("cancelled timer ran");
+    }));
+
     // call from another thread
     app().getLoop()->queueInLoop([TEST_CTX]() {
         scheduler::run([TEST_CTX]() {
@@ -108,6 +132,658 @@ DROGON_TEST(Sechduler)
     });
 }
 
+DROGON_TEST(Offload)
+{
+ENTER_MAIN_THREAD
+    auto value = co_await gnunetpp::scheduler::offload([] { return 42; });
+    CHECK(value == 42);
+    CHECK(gnunetpp::inMainThread());
+    // Results are moved to the awaiting coroutine
+    auto ptr = co_await gnunetpp::scheduler::offload([] { return std::make_unique<int>(7); });
+    CO_REQUIRE(ptr != nullptr);
+    CHECK(*ptr == 7);
+    CHECK_THROWS(co_await gnunetpp::scheduler::offload([]() -> int {
+        throw std::runtime_error("failed");
+    }));
+    CHECK(gnunetpp::inMainThread());
+EXIT_MAIN_THREAD
+}
+
+DROGON_TEST(Combinators)
+{
+ENTER_MAIN_THREAD
+    auto delayed = [](int value, std::chrono::milliseconds delay) -> Task<int> {
+        co_await gnunetpp::scheduler::sleep(delay);
+        co_return value;
+    };
+    std::vector<Task<int>> tasks;
+    tasks.push_back(delayed(1, 30ms));
+    tasks.push_back(delayed(2, 10ms));
+    tasks.push_back(delayed(3, 20ms));
+    CHECK(co_await gnunetpp::when_all(std::move(tasks)) == std::vector<int>{1, 2, 3});
+
+    tasks.clear();
+    tasks.push_back(delayed(1, 50ms));
+    tasks.push_back(delayed(2, 10ms));
+    auto [index, value] = co_await gnunetpp::when_any(std::move(tasks));
+    CHECK(index == 1);
+    CHECK(value == 2);
+
+    std::vector<int> input = {5, 4, 3, 2, 1};
+    int in_flight = 0;
+    int max_in_flight = 0;
+    auto squares = co_await gnunetpp::for_each_concurrent(input, 2, [&](int x) -> Task<int> {
+        max_in_flight = std::max(max_in_flight, ++in_flight);
+        co_await gnunetpp::scheduler::sleep(std::chrono::milliseconds(x));
+        in_flight--;
+        co_return x * x;
+    });
+    CHECK(squares == std::vector<int>{25, 16, 9, 4, 1});
+    CHECK(max_in_flight == 2);
+EXIT_MAIN_THREAD
+}
+
+DROGON_TEST(AsyncPrimitives)
+{
+ENTER_MAIN_THREAD
+    gnunetpp::async_semaphore semaphore(2);
+    int in_flight = 0;
+    int max_in_flight = 0;
+    auto worker = [&]() -> Task<> {
+        co_await semaphore.acquire();
+        max_in_flight = std::max(max_in_flight, ++in_flight);
+        co_await gnunetpp::scheduler::sleep(5ms);
+        in_flight--;
+        semaphore.release();
+    };
+    std::vector<Task<>> workers;
+    for(int i = 0; i < 5; i++)
+        workers.push_back(worker());
+    co_await gnunetpp::when_all(std::move(workers));
+    CHECK(max_in_flight == 2);
+    CHECK(semaphore.available() == 2);
+
+    gnunetpp::async_mutex mutex;
+    CHECK(mutex.try_lock());
+    std::stop_source source;
+    gnunetpp::scheduler::runLater(1ms, [&source] { source.request_stop(); });
+    CHECK_THROWS_AS(co_await gnunetpp::withStopToken([&]() -> Task<> { co_await mutex.lock(); }(), source.get_token())
+        , gnunetpp::OperationCancelled);
+    mutex.unlock();
+    {
+        auto guard = co_await mutex.scoped_lock();
+        CHECK(mutex.try_lock() == false);
+    }
+    CHECK(mutex.try_lock());
+    mutex.unlock();
+
+    // The producer runs ahead by at most the capacity of the channel
+    gnunetpp::channel<int> channel(2);
+    gnunetpp::async_run([&channel]() -> Task<> {
+        for(int i = 0; i < 10; i++)
+            co_await channel.send(i);
+        channel.close();
+    });
+    CHECK(channel.size() == 2);
+    int sum = 0;
+    while(auto value = co_await channel.receive())
+        sum += *value;
+    CHECK(sum == 45);
+    CHECK_THROWS_AS(co_await channel.send(1), gnunetpp::ChannelClosed);
+EXIT_MAIN_THREAD
+}
+
+DROGON_TEST(AsyncPrimitivesThreads)
+{
+ENTER_MAIN_THREAD
+    // A waiter resumes on the thread that released it and hops back to the GNUnet thread
+    gnunetpp::async_semaphore ready(0);
+    std::vector<std::thread> releasers;
+    for(int i = 0; i < 4; i++) {
+        releasers.emplace_back([&ready] {
+            for(int j = 0; j < 100; j++)
+                ready.release();
+        });
+    }
+    for(int i = 0; i < 400; i++) {
+        co_await ready.acquire();
+        co_await gnunetpp::scheduler::runOnMainThread();
+        CO_REQUIRE(gnunetpp::inMainThread());
+    }
+    for(auto& thread : releasers)
+        thread.join();
+    CHECK(ready.available() == 0);
+
+    // Coroutines started on several threads take turns on one mutex. The last one to finish
+    // wakes this coroutine from whatever thread it ended up on
+    gnunetpp::async_mutex mutex;
+    gnunetpp::async_semaphore finished(0);
+    int counter = 0;
+    std::vector<std::thread> lockers;
+    for(int i = 0; i < 4; i++) {
+        lockers.emplace_back([&] {
+            gnunetpp::async_run([&]() -> Task<> {
+                for(int j = 0; j < 1000; j++) {
+                    auto guard = co_await mutex.scoped_lock();
+                    counter++;
+                }
+                finished.release();
+            });
+        });
+    }
+    for(int i = 0; i < 4; i++)
+        co_await finished.acquire();
+    co_await gnunetpp::scheduler::runOnMainThread();
+    CHECK(gnunetpp::inMainThread());
+    CHECK(counter == 4000);
+    for(auto& thread : lockers)
+        thread.join();
+EXIT_MAIN_THREAD
+}
+
+DROGON_TEST(StopToken)
+{
+ENTER_MAIN_THREAD
+    std::stop_source source;
+    gnunetpp::scheduler::runLater(10ms, [&source] { source.request_stop(); });
+    auto begin = std::chrono::steady_clock::now();
+    CHECK_THROWS_AS(co_await gnunetpp::withStopToken(gnunetpp::scheduler::sleep(10s), source.get_token())
+        , gnunetpp::OperationCancelled);
+    CHECK(std::chrono::steady_clock::now() - begin < 1s);
+
+    // Stops propagate into the tasks being awaited
+    std::stop_source parent;
+    parent.request_stop();
+    auto child = []() -> Task<> { co_await gnunetpp::scheduler::sleep(10s); };
+    CHECK_THROWS_AS(co_await gnunetpp::withStopToken(child(), parent.get_token()), gnunetpp::OperationCancelled);
+
+    // when_any stops the losers
+    bool loser_cancelled = false;
+    auto loser = [&]() -> Task<int> {
+        try {
+            co_await gnunetpp::scheduler::sleep(10s);
+        }
+        catch(const gnunetpp::OperationCancelled&) {
+            loser_cancelled = true;
+        }
+        co_return 1;
+    };
+    auto winner = []() -> Task<int> { co_return 2; };
+    std::vector<Task<int>> tasks;
+    tasks.push_back(loser());
+    tasks.push_back(winner());
+    auto [index, value] = co_await gnunetpp::when_any(std::move(tasks));
+    CHECK(index == 1);
+    CHECK(loser_cancelled);
+EXIT_MAIN_THREAD
+}
+
+DROGON_TEST(TaskGroup)
+{
+ENTER_MAIN_THREAD
+    int finished = 0;
+    int cancelled = 0;
+    auto sleeper = [&](std::chrono::milliseconds delay) -> Task<> {
+        try {
+            co_await gnunetpp::scheduler::sleep(delay);
+            finished++;
+        }
+        catch(const gnunetpp::OperationCancelled&) {
+            cancelled++;
+            throw;
+        }
+    };
+    auto failing = []() -> Task<> {
+        co_await gnunetpp::scheduler::sleep(5ms);
+        throw std::runtime_error("failed");
+    };
+
+    gnunetpp::TaskGroup group;
+    group.spawn(sleeper(1ms));
+    group.spawn(sleeper(2ms));
+    CHECK(group.running() == 2);
+    co_await group.join();
+    CHECK(finished == 2);
+
+    // The first failure stops the rest of the group
+    gnunetpp::TaskGroup failing_group;
+    failing_group.spawn(sleeper(10s));
+    failing_group.spawn(failing());
+    CHECK_THROWS_AS(co_await failing_group.join(), std::runtime_error);
+    CHECK(cancelled == 1);
+
+    // Children are stopped and joined when the scope is left early
+    CHECK_THROWS_AS(co_await gnunetpp::with_task_group([&](gnunetpp::TaskGroup& scope) -> Task<> {
+        scope.spawn(sleeper(10s));
+        co_await gnunetpp::scheduler::sleep(1ms);
+        throw std::logic_error("early exit");
+    }), std::logic_error);
+    CHECK(cancelled == 2);
+EXIT_MAIN_THREAD
+}
+
+DROGON_TEST(TimeoutAndRetry)
+{
+ENTER_MAIN_THREAD
+    using namespace gnunetpp::scheduler;
+    CHECK_THROWS_AS(co_await withTimeout(sleep(10s), 5ms), TimeoutError);
+    auto quick = []() -> Task<int> {
+        co_await sleep(1ms);
+        co_return 42;
+    };
+    CHECK(co_await withTimeout(quick(), 10s) == 42);
+
+    int attempts = 0;
+    auto flaky = [&]() -> Task<int> {
+        attempts++;
+        co_await sleep(1ms);
+        if(attempts < 3)
+            throw std::runtime_error("flaky");
+        co_return attempts;
+    };
+    CHECK(co_await retry({.initial_delay = 1ms}, flaky) == 3);
+
+    // Every attempt times out and the last failure is rethrown
+    attempts = 0;
+    auto stuck = [&]() -> Task<> {
+        attempts++;
+        co_await sleep(10s);
+    };
+    CHECK_THROWS_AS(co_await retry({.max_attempts = 2, .initial_delay = 1ms, .attempt_timeout = 5ms}, stuck), TimeoutError);
+    CHECK(attempts == 2);
+
+    // The delay stops growing at max_delay, even when the multiplier overflows any duration
+    attempts = 0;
+    auto failing = [&]() -> Task<> {
+        attempts++;
+        co_await sleep(0ms);
+        throw std::runtime_error("failing");
+    };
+    auto start = std::chrono::steady_clock::now();
+    CHECK_THROWS_AS(co_await retry({.max_attempts = 6, .initial_delay = 1ms, .max_delay = 2ms
+        , .multiplier = 1e300, .jitter = 0}, failing), std::runtime_error);
+    CHECK(attempts == 6);
+    CHECK(std::chrono::steady_clock::now() - start >= 9ms);
+EXIT_MAIN_THREAD
+}
+
+DROGON_TEST(YieldIfExpired)
+{
+ENTER_MAIN_THREAD
+    auto busy = [](std::chrono::microseconds duration) {
+        auto end = std::chrono::steady_clock::now() + duration;
+        while(std::chrono::steady_clock::now() < end) {}
+    };
+    auto before = gnunetpp::scheduler::yieldStats();
+    auto timer_fired = std::make_shared<bool>(false);
+    gnunetpp::scheduler::runLater(1ms, [timer_fired] { *timer_fired = true; });
+    // 10ms of work in 2ms slices lets the timer run in between
+    for(int i = 0; i < 100; i++) {
+        busy(100us);
+        co_await gnunetpp::scheduler::yieldIfExpired(2ms);
+    }
+    CHECK(*timer_fired);
+    CHECK(gnunetpp::scheduler::yieldStats().yields >= before.yields + 3);
+
+    // A service resuming the coroutine straight from a GNUnet callback starts a new slice,
+    // the time spent before it suspended doesn't count against the callback
+    struct Operation : public gnunetpp::EagerAwaiter<int>
+    {
+        void complete(int value)
+        {
+            setValue(value);
+        }
+        bool in_callback = false;
+    };
+    Operation operation;
+    co_await gnunetpp::scheduler::yieldIfExpired(50ms);
+    busy(3ms);
+    GNUNET_SCHEDULER_add_now([](void* cls) {
+        auto operation = static_cast<Operation*>(cls);
+        operation->in_callback = true;
+        operation->complete(1);
+        operation->in_callback = false;
+    }, &operation);
+    CHECK(co_await operation == 1);
+    co_await gnunetpp::scheduler::yieldIfExpired(2ms);
+    CHECK(operation.in_callback);
+EXIT_MAIN_THREAD
+}
+
+DROGON_TEST(PendingOperations)
+{
+ENTER_MAIN_THREAD
+    using gnunetpp::scheduler::PendingOperationInfo;
+    struct LookupAwaiter : public gnunetpp::EagerAwaiter<int>
+    {
+        LookupAwaiter(const std::string& name, std::vector<PendingOperationInfo>& seen)
+        {
+            describe("test lookup", [&] { return name; });
+            gnunetpp::scheduler::runLater(20ms, [this, &seen] {
+                seen = gnunetpp::scheduler::pendingOperations();
+                setValue(42);
+            });
+        }
+    };
+    auto find = [](const std::vector<PendingOperationInfo>& ops, const std::string& kind) {
+        return std::find_if(ops.begin(), ops.end(), [&](auto& op) { return op.kind == kind; });
+    };
+
+    gnunetpp::scheduler::enableOperationTracking();
+    gnunetpp::async_run([]() -> Task<> { co_await gnunetpp::scheduler::sleep(50ms); });
+    std::vector<PendingOperationInfo> seen;
+    int value = co_await LookupAwaiter("example.gnu", seen);
+    CHECK(value == 42);
+
+    auto lookup = find(seen, "test lookup");
+    CO_REQUIRE(lookup != seen.end());
+    CHECK(lookup->target == "example.gnu");
+    CHECK(lookup->age >= 10ms);
+    auto sleeping = find(seen, "sleep");
+    CO_REQUIRE(sleeping != seen.end());
+    CHECK(sleeping->target == "50000us");
+    // Oldest first
+    CHECK(sleeping < lookup);
+    auto oldest = gnunetpp::scheduler::oldestPendingOperation();
+    CO_REQUIRE(oldest.has_value());
+    CHECK(oldest->age >= 20ms);
+
+    auto now = gnunetpp::scheduler::pendingOperations();
+    CHECK(find(now, "test lookup") == now.end());
+    gnunetpp::scheduler::enableOperationTracking(false);
+EXIT_MAIN_THREAD
+}
+
+DROGON_TEST(Priority)
+{
+ENTER_MAIN_THREAD
+    using gnunetpp::scheduler::Priority;
+    std::vector<int> order;
+    gnunetpp::scheduler::queue([&order] { order.push_back(0); }, Priority::Idle);
+    gnunetpp::scheduler::queue([&order] { order.push_back(1); });
+    gnunetpp::scheduler::queue([&order] { order.push_back(2); }, Priority::Urgent);
+    CHECK(gnunetpp::scheduler::queueStats(Priority::Idle).depth >= 1);
+    // Idle work only runs once everything else is done
+    co_await gnunetpp::scheduler::yield(Priority::Idle);
+    CHECK((order == std::vector<int>{2, 1, 0}));
+    CHECK(gnunetpp::scheduler::queueStats(Priority::Idle).depth == 0);
+    CHECK(gnunetpp::scheduler::queueStats(Priority::Idle).queued >= 2);
+
+    bool fired = false;
+    gnunetpp::scheduler::runLater(1ms, [&fired] { fired = true; }, false, 0us, Priority::High);
+    co_await gnunetpp::scheduler::sleep(20ms);
+    CHECK(fired);
+EXIT_MAIN_THREAD
+}
+
+DROGON_TEST(Instrumentation)
+{
+ENTER_MAIN_THREAD
+    gnunetpp::scheduler::enableInstrumentation();
+    gnunetpp::scheduler::resetInstrumentation();
+    gnunetpp::scheduler::runLater(1ms, [] { std::this_thread::sleep_for(2ms); });
+    co_await gnunetpp::scheduler::sleep(20ms);
+    gnunetpp::scheduler::enableInstrumentation(false);
+
+    auto stats = gnunetpp::scheduler::instrumentationStats();
+    CHECK(stats.loop_lag_ns.count >= 2);
+    CO_REQUIRE(stats.callbacks.size() > 0);
+    CHECK(stats.callbacks[0].site == "timer");
+    CHECK(stats.callbacks[0].duration_ns.max >= 2'000'000);
+    CHECK(stats.callbacks[0].duration_ns.quantile(1.0) == stats.callbacks[0].duration_ns.max);
+
+    // Nothing is recorded while disabled
+    co_await gnunetpp::scheduler::sleep(1ms);
+    CHECK(gnunetpp::scheduler::instrumentationStats().loop_lag_ns.count == stats.loop_lag_ns.count);
+EXIT_MAIN_THREAD
+}
+
+DROGON_TEST(Watchdog)
+{
+ENTER_MAIN_THREAD
+    gnunetpp::scheduler::startWatchdog({.threshold = 50ms});
+    gnunetpp::scheduler::queue([] { std::this_thread::sleep_for(200ms); });
+    co_await gnunetpp::scheduler::sleep(100ms);
+    auto stats = gnunetpp::scheduler::watchdogStats();
+    gnunetpp::scheduler::stopWatchdog();
+
+    CHECK(stats.running);
+    CHECK(stats.stalls == 1);
+    CO_REQUIRE(stats.recent.size() == 1);
+    CHECK(stats.recent[0].site == "queue");
+    CHECK(stats.recent[0].duration >= 150ms);
+    CHECK(gnunetpp::scheduler::watchdogStats().running == false);
+EXIT_MAIN_THREAD
+}
+
+DROGON_TEST(FdReadiness)
+{
+ENTER_MAIN_THREAD
+    int fds[2];
+    CO_REQUIRE(pipe2(fds, O_NONBLOCK) == 0);
+    co_await gnunetpp::scheduler::writable(fds[1]);
+
+    gnunetpp::scheduler::FdWatch watch(fds[0]);
+    std::string received;
+    for(int i = 0; i < 3; i++) {
+        gnunetpp::scheduler::runLater(1ms, [fd = fds[1]] { CHECK(write(fd, "abc", 3) == 3); });
+        co_await watch.readable();
+        char buf[16];
+        ssize_t n;
+        while((n = read(fds[0], buf, sizeof(buf))) > 0)
+            received.append(buf, n);
+    }
+    CHECK(received == "abcabcabc");
+
+    std::stop_source source;
+    gnunetpp::scheduler::runLater(1ms, [&source] { source.request_stop(); });
+    CHECK_THROWS_AS(co_await gnunetpp::withStopToken(watch.readable(), source.get_token()), gnunetpp::OperationCancelled);
+    close(fds[0]);
+    close(fds[1]);
+EXIT_MAIN_THREAD
+}
+
+DROGON_TEST(FdReader)
+{
+ENTER_MAIN_THREAD
+    int fds[2];
+    CO_REQUIRE(pipe2(fds, O_NONBLOCK) == 0);
+    std::string long_line(10000, 'x');
+    std::string input = "hello\nwor" + std::string("ld\r\n") + long_line + "\nlast";
+    CHECK(write(fds[1], input.data(), input.size()) == (ssize_t)input.size());
+    close(fds[1]);
+
+    gnunetpp::scheduler::FdReader reader(fds[0]);
+    std::vector<std::string> lines;
+    auto range = reader.lines();
+    for(auto it = co_await range.begin(); it != range.end(); co_await ++it)
+        lines.emplace_back(*it);
+    CHECK((lines == std::vector<std::string>{"hello", "world", long_line, "last"}));
+    CHECK(!reader.lineTerminated());
+    close(fds[0]);
+
+    CO_REQUIRE(pipe2(fds, O_NONBLOCK) == 0);
+    CHECK(write(fds[1], "\0\0\0\2ab\0\0\0\0\0\0\0\3cd", 16) == 16);
+    close(fds[1]);
+    gnunetpp::scheduler::FdReader record_reader(fds[0]);
+    CHECK(co_await record_reader.readRecord() == "ab");
+    CHECK(co_await record_reader.readRecord() == "");
+    CHECK_THROWS(co_await record_reader.readRecord());
+    close(fds[0]);
+EXIT_MAIN_THREAD
+}
+
+DROGON_TEST(RingBuffer)
+{
+    gnunetpp::detail::RingBuffer buffer(16);
+    auto space = buffer.writable();
+    REQUIRE(space.size() == 16);
+    memcpy(space.data(), "0123456789abcdef", 16);
+    buffer.commit(16);
+    CHECK(buffer.full());
+    buffer.consume(10);
+
+    // Writes wrap around to the front
+    space = buffer.writable();
+    REQUIRE(space.size() == 10);
+    memcpy(space.data(), "XYZ", 3);
+    buffer.commit(3);
+    CHECK(buffer.find('Y') == 7);
+    CHECK(buffer.find('q') == gnunetpp::detail::RingBuffer::npos);
+    CHECK(buffer.peek(9) == "abcdefXYZ");
+
+    buffer.reserve(100);
+    CHECK(buffer.capacity() == 128);
+    CHECK(buffer.peek(9) == "abcdefXYZ");
+    buffer.consume(9);
+    CHECK(buffer.empty());
+}
+
+DROGON_TEST(SlotMap)
+{
+    gnunetpp::detail::SlotMap<std::string, 4> map;
+    auto [id1, v1] = map.add("hello");
+    auto [id2, v2] = map.add("world");
+    CHECK(id1 != 0);
+    CHECK(id1 != id2);
+    CHECK(*map.get(id1) == "hello");
+    CHECK(map.remove(id1));
+    CHECK(map.get(id1) == nullptr);
+    CHECK(map.remove(id1) == false);
+
+    // the freed slot gets reused but the old handle must stay stale
+    auto [id3, v3] = map.add("again");
+    CHECK(id3 != id1);
+    CHECK(map.get(id1) == nullptr);
+    CHECK(*map.get(id3) == "again");
+
+    // references are stable across growth
+    std::string* ptr = map.get(id2);
+    for(int i = 0; i < 100; i++)
+        map.add(std::to_string(i));
+    CHECK(map.get(id2) == ptr);
+    CHECK(map.size() == 102);
+    CHECK(map.take(id2).value() == "world");
+    CHECK(map.size() == 101);
+}
+
+DROGON_TEST(MPSCQueue)
+{
+    gnunetpp::detail::MPSCQueue<std::unique_ptr<int>> queue;
+    for(int i = 0; i < 5; i++)
+        queue.push(std::make_unique<int>(i));
+    std::vector<int> seen;
+    auto consume = [&seen](std::unique_ptr<int>& value) {
+        seen.push_back(*value);
+        if(*value == 1)
+            throw std::runtime_error("consumer failed");
+    };
+    CHECK_THROWS(queue.drain(consume));
+    CHECK(!queue.empty());
+    // Whatever the throwing drain didn't get to comes before newer items
+    queue.push(std::make_unique<int>(5));
+    CHECK(queue.drain(consume) == 4);
+    CHECK((seen == std::vector<int>{0, 1, 2, 3, 4, 5}));
+    CHECK(queue.empty());
+}
+
+DROGON_TEST(TimingWheel)
+{
+    using gnunetpp::detail::TimerNode;
+    gnunetpp::detail::TimingWheel wheel(1000);
+    // cover level 0, level 1, level 2 and an already passed deadline
+    std::vector<TimerNode> nodes(5);
+    std::vector<uint64_t> deadlines = {1010, 1300, 70000, 500, 1300};
+    for(size_t i = 0; i < nodes.size(); i++) {
+        nodes[i].cookie = i;
+        wheel.insert(&nodes[i], deadlines[i]);
+    }
+    wheel.remove(&nodes[4]);
+    CHECK(wheel.size() == 4);
+    CHECK(wheel.nextDeadline() == 1000);
+
+    std::vector<size_t> fired;
+    auto collect = [&](TimerNode* node) { fired.push_back(node->cookie); };
+    wheel.advance(1000, collect);
+    CHECK((fired == std::vector<size_t>{3}));
+    CHECK(wheel.nextDeadline() == 1010);
+    wheel.advance(1299, collect);
+    CHECK((fired == std::vector<size_t>{3, 0}));
+    wheel.advance(100000, collect);
+    CHECK((fired == std::vector<size_t>{3, 0, 1, 2}));
+    CHECK(wheel.empty());
+    CHECK(wheel.nextDeadline().has_value() == false);
+}
+
+DROGON_TEST(Function)
+{
+    gnunetpp::Function<int(int)> empty;
+    CHECK(empty == nullptr);
+    CHECK_THROWS(empty(1));
+
+    // move-only captures
+    auto ptr = std::make_unique<int>(42);
+    gnunetpp::Function<int()> fn = [ptr = std::move(ptr)] { return *ptr; };
+    auto moved = std::move(fn);
+    CHECK(fn == nullptr);
+    CHECK(moved() == 42);
+
+    // too big for the inline buffer, ends up on the heap
+    std::array<int, 64> big{};
+    big[63] = 7;
+    gnunetpp::Function<int(int)> heap = [big](int x) { return big[63] + x; };
+    STATIC_REQUIRE(gnunetpp::Function<void()>::storedInline<decltype(big)>() == false);
+    CHECK(heap(1) == 8);
+    heap = nullptr;
+    CHECK(!heap);
+
+    std::function<void()> empty_std;
+    gnunetpp::Function<void()> from_std = empty_std;
+    CHECK(from_std == nullptr);
+}
+
+DROGON_TEST(FramePool)
+{
+    using gnunetpp::detail::FramePool;
+    // Freed frames are handed out again for the same size class
+    void* frame = FramePool::allocate(100);
+    FramePool::deallocate(frame, 100);
+    void* again = FramePool::allocate(120);
+    CHECK(again == frame);
+    FramePool::deallocate(again, 120);
+
+    // Results live in the frame, move-only types included
+    auto task = []() -> gnunetpp::Task<std::unique_ptr<int>> {
+        co_return std::make_unique<int>(42);
+    };
+    std::unique_ptr<int> result;
+    gnunetpp::async_run([&]() -> gnunetpp::Task<> {
+        result = co_await task();
+    });
+    REQUIRE(result != nullptr);
+    CHECK(*result == 42);
+}
+
+DROGON_TEST(GeneratorWrapper)
+{
+    // Elements are moved through the iterator, so move-only types work
+    auto awaiter = std::make_unique<gnunetpp::QueuedAwaiter<std::unique_ptr<int>>>();
+    auto queue = awaiter.get();
+    gnunetpp::GeneratorWrapper<std::unique_ptr<int>> gen(std::move(awaiter), [] {});
+    std::vector<int> received;
+    bool done = false;
+    gnunetpp::async_run([&]() -> gnunetpp::Task<> {
+        for(auto it = co_await gen.begin(); it != gen.end(); co_await ++it)
+            received.push_back(**it);
+        done = true;
+    });
+    queue->addValue(std::make_unique<int>(1));
+    queue->addValue(std::make_unique<int>(2));
+    CHECK((received == std::vector<int>{1, 2}));
+    queue->finish();
+    CHECK(done);
+}
+
 DROGON_TEST(ECDSA)
 {
     auto sk = gnunetpp::crypto::anonymousKey();